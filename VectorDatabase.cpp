@@ -10,6 +10,12 @@
 #include <cmath>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <iterator>
 #include <fstream>
 #include <memory>
 #include <queue>
@@ -17,6 +23,42 @@
 #include <random>
 #include <chrono>
 #include <iomanip>
+#include <sstream>
+#include <limits>
+#include <type_traits>
+#include <numeric>
+#include <new>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <array>
+#include <tuple>
+#include <bitset>
+#include <future>
+#include <string_view>
+#include <variant>
+
+#include <filesystem>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+#endif
 
 // Forward declarations
 enum class DistanceMetric {
@@ -29,7 +71,33 @@ enum class DistanceMetric {
 enum class IndexType {
     LINEAR,
     KD_TREE,
-    HASH_TABLE
+    HASH_TABLE,
+    HNSW,
+    IVF
+};
+
+// In-memory representation of stored vectors
+enum class VectorEncoding {
+    FLOAT32,
+    FP16,
+    BF16,
+    INT8,
+    PQ
+};
+
+// When write-ahead log records are forced to stable storage
+enum class WalSyncMode {
+    ALWAYS,    // every write waits for fsync (concurrent writers share one)
+    INTERVAL,  // fsync in the background every wal_sync_interval_ms
+    NONE       // records reach the OS at once, fsync only at checkpoints
+};
+
+// Layout of a bulk import file (AUTO picks by extension: .fvecs, .npy, else FBIN)
+enum class ImportFormat {
+    AUTO,
+    FBIN,   // u32 count, u32 dimension, then the floats
+    FVECS,  // per vector an i32 dimension and its floats
+    NPY     // NumPy float32 or float16 array of shape (count, dimension)
 };
 
 struct VectorDatabaseConfig {
@@ -37,6 +105,69 @@ struct VectorDatabaseConfig {
     IndexType index_type = IndexType::LINEAR;
     size_t max_vectors = 100000;
     size_t thread_count = std::thread::hardware_concurrency();
+    // IDs are unsigned 64-bit integers, stored without strings and used through
+    // the integer overloads (insert, get_vector, remove, search_ids, ...);
+    // string IDs are then accepted and returned in their decimal form
+    bool integer_ids = false;
+    // KD_TREE: target number of vectors per leaf bucket
+    size_t kd_tree_leaf_size = 16;
+    // HASH_TABLE (LSH): hash tables, hash bits per table, extra buckets probed per table
+    size_t lsh_tables = 8;
+    size_t lsh_hash_bits = 12;
+    size_t lsh_probes = 4;
+    // HASH_TABLE with EUCLIDEAN/MANHATTAN: bucket width, 0 = estimate from the data
+    float lsh_bucket_width = 0.0f;
+    // HNSW: links per node, build-time and default query-time candidate list sizes
+    size_t hnsw_m = 16;
+    size_t hnsw_ef_construction = 200;
+    size_t hnsw_ef_search = 64;
+    // IVF: inverted lists (0 = about sqrt of the row count), default lists
+    // probed per query, and rows sampled to train the k-means centroids
+    size_t ivf_lists = 0;
+    size_t ivf_nprobe = 8;
+    size_t ivf_train_sample = 65536;
+    // Compressed vector storage; PQ subspaces (0 = one per 8 dimensions)
+    VectorEncoding encoding = VectorEncoding::FLOAT32;
+    size_t pq_subspaces = 0;
+    // Compressed encodings: file keeping exact vectors on disk (empty = none),
+    // and how many top candidates to re-rank with them (0 = no re-rank)
+    std::string full_precision_path;
+    size_t rerank_candidates = 0;
+    // Durability: path prefix of the snapshot (<path>.snapshot) and write-ahead
+    // log (<path>.wal), empty = in-memory only. Writes are logged and replayed
+    // over the snapshot on construction; a background checkpoint folds the log
+    // into a new snapshot once it exceeds checkpoint_wal_bytes (0 = never)
+    std::string durability_path;
+    WalSyncMode wal_sync = WalSyncMode::INTERVAL;
+    size_t wal_sync_interval_ms = 10;
+    size_t checkpoint_wal_bytes = size_t(64) << 20;
+    // Deletes leave a tombstone that searches skip; a background task removes
+    // the tombstoned rows from the storage and index once this fraction of
+    // the rows is deleted (0 = remove rows at once, without tombstones)
+    double compaction_threshold = 0.1;
+    // Cache of unfiltered search and search_radius results, in entries
+    // (0 = off), invalidated by any write. Query components are rounded to
+    // multiples of query_cache_quantization for the key (0 = exact match),
+    // so nearly identical queries share the results of the first one.
+    size_t query_cache_entries = 0;
+    float query_cache_quantization = 0.0f;
+    // NUMA: pin the worker threads to the CPUs of this node (-1 = unpinned).
+    // A ShardedVectorDatabase with numa_aware spreads its shards over the
+    // nodes and runs each shard's writes and scans on threads of its node,
+    // so the shard's vectors are allocated and read in local memory.
+    int numa_node = -1;
+    bool numa_aware = false;
+    // search_async() micro-batching: queued queries are answered together in
+    // one search_batch pass once async_max_batch are waiting or the oldest
+    // has waited async_max_wait_us
+    size_t async_max_batch = 64;
+    size_t async_max_wait_us = 200;
+    // rebuild_index(): writes made while it runs are kept for replay on the
+    // new index, up to rebuild_max_delta_bytes (beyond that the rebuild gives
+    // up); the new index is swapped in once at most rebuild_swap_entries of
+    // them are left to replay under the write lock
+    size_t rebuild_max_delta_bytes = size_t(256) << 20;
+    size_t rebuild_swap_entries = 1024;
     
     VectorDatabaseConfig() = default;
 };
@@ -48,6 +179,9 @@ struct SearchResult {
     
     SearchResult(const std::string& _id, float _distance, const std::vector<float>& _vector)
         : id(_id), distance(_distance), vector(_vector) {}
+    
+    SearchResult(const std::string& _id, float _distance, const float* _data, size_t _dimension)
+        : id(_id), distance(_distance), vector(_data, _data + _dimension) {}
         
     // Comparator for priority queue (min-heap for distances)
     bool operator>(const SearchResult& other) const {
@@ -55,470 +189,9046 @@ struct SearchResult {
     }
 };
 
-// Utility class for high-dimensional vector operations
-class VectorUtils {
-public:
-    // Generate random vector with specified dimension
-    static std::vector<float> generateRandomVector(size_t dimension, float min_val = -1.0f, float max_val = 1.0f) {
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_real_distribution<float> dis(min_val, max_val);
-        
-        std::vector<float> vector(dimension);
-        for (size_t i = 0; i < dimension; ++i) {
-            vector[i] = dis(gen);
-        }
-        return vector;
-    }
+// Lightweight search result: ID and distance only. Use get_vector() to fetch
+// the vector data for the hits that are actually needed.
+struct SearchHit {
+    std::string id;
+    float distance;
     
-    // Generate random normalized vector (unit vector)
-    static std::vector<float> generateRandomUnitVector(size_t dimension) {
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::normal_distribution<float> dis(0.0f, 1.0f);
-        
-        std::vector<float> vector(dimension);
-        float norm = 0.0f;
-        
-        // Generate random vector from normal distribution
-        for (size_t i = 0; i < dimension; ++i) {
-            vector[i] = dis(gen);
-            norm += vector[i] * vector[i];
-        }
-        
-        // Normalize to unit length
-        norm = std::sqrt(norm);
-        if (norm > 0.0f) {
-            for (size_t i = 0; i < dimension; ++i) {
-                vector[i] /= norm;
-            }
-        }
-        
-        return vector;
+    SearchHit(const std::string& _id, float _distance)
+        : id(_id), distance(_distance) {}
+};
+
+// Search result of a database with integer IDs
+struct SearchIdHit {
+    uint64_t id;
+    float distance;
+    
+    SearchIdHit(uint64_t _id, float _distance)
+        : id(_id), distance(_distance) {}
+};
+
+// Per-query search knobs; zero fields fall back to the database configuration
+struct SearchParams {
+    size_t ef_search = 0;  // HNSW candidate list size
+    size_t nprobe = 0;     // IVF lists scanned
+    
+    SearchParams() = default;
+};
+
+// Typed per-vector attribute value: integer, real or string
+using AttributeValue = std::variant<int64_t, double, std::string>;
+using Attributes = std::map<std::string, AttributeValue>;
+
+// Any integer, floating-point or string-like value as an AttributeValue
+template <typename T>
+AttributeValue toAttributeValue(T&& value) {
+    using V = std::decay_t<T>;
+    if constexpr (std::is_same_v<V, AttributeValue>) {
+        return std::forward<T>(value);
+    } else if constexpr (std::is_integral_v<V>) {
+        return AttributeValue(static_cast<int64_t>(value));
+    } else if constexpr (std::is_floating_point_v<V>) {
+        return AttributeValue(static_cast<double>(value));
+    } else {
+        return AttributeValue(std::string(std::forward<T>(value)));
     }
+}
+
+// Predicate over vector attributes for filtered search, e.g.
+//   Filter::eq("tenant_id", 7) && Filter::gt("ts", cutoff)
+// Numbers compare with numbers and strings with strings; a comparison never
+// matches a vector that lacks the attribute or holds a value of the other kind.
+class Filter {
+public:
+    enum class Op { EQ, NE, LT, LE, GT, GE, EXISTS, AND, OR, NOT };
     
-    // Generate vectors based on Gaussian distribution around a center
-    static std::vector<float> generateGaussianVector(const std::vector<float>& center, float std_dev = 0.1f) {
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::normal_distribution<float> dis(0.0f, std_dev);
-        
-        std::vector<float> vector(center.size());
-        for (size_t i = 0; i < center.size(); ++i) {
-            vector[i] = center[i] + dis(gen);
-        }
-        
-        return vector;
+    template <typename T> static Filter eq(std::string attribute, T&& value) { return compare(Op::EQ, std::move(attribute), std::forward<T>(value)); }
+    template <typename T> static Filter ne(std::string attribute, T&& value) { return compare(Op::NE, std::move(attribute), std::forward<T>(value)); }
+    template <typename T> static Filter lt(std::string attribute, T&& value) { return compare(Op::LT, std::move(attribute), std::forward<T>(value)); }
+    template <typename T> static Filter le(std::string attribute, T&& value) { return compare(Op::LE, std::move(attribute), std::forward<T>(value)); }
+    template <typename T> static Filter gt(std::string attribute, T&& value) { return compare(Op::GT, std::move(attribute), std::forward<T>(value)); }
+    template <typename T> static Filter ge(std::string attribute, T&& value) { return compare(Op::GE, std::move(attribute), std::forward<T>(value)); }
+    
+    // Vectors that have the attribute, whatever its value
+    static Filter exists(std::string attribute) {
+        Filter filter(Op::EXISTS);
+        filter.attribute_ = std::move(attribute);
+        return filter;
     }
     
-    // Calculate vector magnitude/norm
-    static float calculateMagnitude(const std::vector<float>& vector) {
-        float sum = 0.0f;
-        for (float val : vector) {
-            sum += val * val;
-        }
-        return std::sqrt(sum);
+    friend Filter operator&&(Filter a, Filter b) { return combine(Op::AND, std::move(a), std::move(b)); }
+    friend Filter operator||(Filter a, Filter b) { return combine(Op::OR, std::move(a), std::move(b)); }
+    friend Filter operator!(Filter a) {
+        Filter filter(Op::NOT);
+        filter.operands_.push_back(std::move(a));
+        return filter;
     }
     
-    // Normalize vector to unit length
-    static std::vector<float> normalize(const std::vector<float>& vector) {
-        float magnitude = calculateMagnitude(vector);
-        if (magnitude == 0.0f) return vector;
-        
-        std::vector<float> normalized(vector.size());
-        for (size_t i = 0; i < vector.size(); ++i) {
-            normalized[i] = vector[i] / magnitude;
-        }
-        return normalized;
+    Op op() const { return op_; }
+    const std::string& attribute() const { return attribute_; }
+    const AttributeValue& value() const { return value_; }
+    const std::vector<Filter>& operands() const { return operands_; }
+    
+private:
+    Op op_;
+    std::string attribute_;
+    AttributeValue value_;
+    std::vector<Filter> operands_;
+    
+    explicit Filter(Op op) : op_(op) {}
+    
+    template <typename T>
+    static Filter compare(Op op, std::string attribute, T&& value) {
+        Filter filter(op);
+        filter.attribute_ = std::move(attribute);
+        filter.value_ = toAttributeValue(std::forward<T>(value));
+        return filter;
     }
     
-    // Add two vectors
-    static std::vector<float> add(const std::vector<float>& a, const std::vector<float>& b) {
-        if (a.size() != b.size()) {
-            throw std::invalid_argument("Vector dimensions must match for addition");
+    static Filter combine(Op op, Filter a, Filter b) {
+        Filter filter(op);
+        filter.operands_.push_back(std::move(a));
+        filter.operands_.push_back(std::move(b));
+        return filter;
+    }
+};
+
+// IEEE 754 half-precision conversion (round to nearest even), portable C++
+inline uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    uint32_t exponent = (bits >> 23) & 0xffu;
+    uint32_t mantissa = bits & 0x7fffffu;
+
+    if (exponent == 0xffu) {
+        return static_cast<uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));  // inf / nan
+    }
+    int half_exponent = static_cast<int>(exponent) - 127 + 15;
+    if (half_exponent >= 0x1f) {
+        return static_cast<uint16_t>(sign | 0x7c00u);  // overflow to inf
+    }
+    if (half_exponent <= 0) {
+        if (half_exponent < -10) {
+            return static_cast<uint16_t>(sign);  // underflow to zero
         }
-        
-        std::vector<float> result(a.size());
-        for (size_t i = 0; i < a.size(); ++i) {
-            result[i] = a[i] + b[i];
+        // Subnormal half: shift the implicit bit in and round
+        mantissa |= 0x800000u;
+        uint32_t shift = static_cast<uint32_t>(14 - half_exponent);
+        uint32_t half_mantissa = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half_mantissa & 1u))) {
+            ++half_mantissa;
         }
-        return result;
+        return static_cast<uint16_t>(sign | half_mantissa);
     }
-    
-    // Scalar multiplication
-    static std::vector<float> multiply(const std::vector<float>& vector, float scalar) {
-        std::vector<float> result(vector.size());
-        for (size_t i = 0; i < vector.size(); ++i) {
-            result[i] = vector[i] * scalar;
-        }
-        return result;
+
+    uint32_t half = sign | (static_cast<uint32_t>(half_exponent) << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u))) {
+        ++half;  // may carry into the exponent, which is still correct
     }
-    
-    // Print vector in a compact format (useful for high-dimensional vectors)
-    static void printVector(const std::vector<float>& vector, size_t max_elements = 5) {
-        std::cout << "[";
-        if (vector.size() <= max_elements * 2) {
-            // Print all elements if vector is small
-            for (size_t i = 0; i < vector.size(); ++i) {
-                std::cout << std::fixed << std::setprecision(3) << vector[i];
-                if (i < vector.size() - 1) std::cout << ", ";
-            }
-        } else {
-            // Print first few and last few elements for large vectors
-            for (size_t i = 0; i < max_elements; ++i) {
-                std::cout << std::fixed << std::setprecision(3) << vector[i] << ", ";
-            }
-            std::cout << "..., ";
-            for (size_t i = vector.size() - max_elements; i < vector.size(); ++i) {
-                std::cout << std::fixed << std::setprecision(3) << vector[i];
-                if (i < vector.size() - 1) std::cout << ", ";
-            }
+    return static_cast<uint16_t>(half);
+}
+
+inline float halfToFloat(uint16_t half) {
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+    uint32_t exponent = (half >> 10) & 0x1fu;
+    uint32_t mantissa = half & 0x3ffu;
+    uint32_t bits;
+
+    if (exponent == 0x1fu) {
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // Subnormal half: normalize into a float
+        int shift = 0;
+        while ((mantissa & 0x400u) == 0) {
+            mantissa <<= 1;
+            ++shift;
         }
-        std::cout << "] (dim=" << vector.size() << ")";
+        bits = sign | (static_cast<uint32_t>(127 - 15 + 1 - shift) << 23) | ((mantissa & 0x3ffu) << 13);
     }
-};
 
-class VectorDatabase {
-private:
-    size_t dimension_;
-    VectorDatabaseConfig config_;
-    std::unordered_map<std::string, std::vector<float>> vectors_;
-    mutable std::mutex database_mutex_;
-    
-    // Distance calculation functions
-    float calculateEuclideanDistance(const std::vector<float>& a, const std::vector<float>& b) const {
-        if (a.size() != b.size()) return std::numeric_limits<float>::max();
-        
-        float sum = 0.0f;
-        for (size_t i = 0; i < a.size(); ++i) {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// bfloat16: the upper half of a float (round to nearest even, NaN kept quiet)
+inline uint16_t floatToBfloat16(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7fffffffu) > 0x7f800000u) {
+        return static_cast<uint16_t>((bits >> 16) | 0x40u);
+    }
+    bits += 0x7fffu + ((bits >> 16) & 1u);
+    return static_cast<uint16_t>(bits >> 16);
+}
+
+inline float bfloat16ToFloat(uint16_t value) {
+    uint32_t bits = static_cast<uint32_t>(value) << 16;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// SIMD distance kernels
+// ---------------------------------------------------------------------------
+// Each kernel works on two raw float arrays of length n. Wide implementations
+// process several lanes per iteration with independent accumulators and finish
+// the remainder (n not a multiple of the lane width) with a masked or scalar
+// tail. Kernels are templated on a compile-time dimension (0 = runtime length)
+// so common embedding sizes get fixed trip counts the compiler can fully
+// unroll. The best instruction set for the running CPU is picked once by
+// detectSimdLevel(), and DistanceKernels::forDimension() binds the matching
+// specializations when a database is created.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VECTORDB_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define VECTORDB_NEON 1
+#include <arm_neon.h>
+#endif
+
+// GCC/Clang need per-function target attributes to emit wider instructions
+// than the baseline ISA; MSVC accepts the intrinsics unconditionally.
+#if defined(VECTORDB_X86) && (defined(__GNUC__) || defined(__clang__))
+#define VECTORDB_TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define VECTORDB_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define VECTORDB_TARGET_AVX2
+#define VECTORDB_TARGET_AVX512
+#endif
+
+namespace simd_kernels {
+
+// Portable reference implementations, also used as the fallback path
+template <size_t Dim>
+inline float l2SquaredScalar(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <size_t Dim>
+inline float dotScalar(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <size_t Dim>
+inline float l1Scalar(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum += std::abs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+// Early-abandoning variants: the result is exact when it does not exceed
+// bound, otherwise some partial sum above bound is returned. The partial sum
+// is checked every kAbandonBlock floats, and accumulation follows the exact
+// kernel of the same instruction set, so a row is never abandoned if the
+// exact kernel would have placed it within the bound.
+constexpr size_t kAbandonBlock = 128;
+
+template <size_t Dim>
+inline float l2SquaredBoundedScalar(const float* a, const float* b, size_t length, float bound) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float sum = 0.0f;
+    size_t i = 0;
+    while (i < n) {
+        const size_t block_end = std::min(n, i + kAbandonBlock);
+        for (; i < block_end; ++i) {
             float diff = a[i] - b[i];
             sum += diff * diff;
         }
-        return std::sqrt(sum);
+        if (sum > bound) return sum;
     }
-    
-    float calculateCosineDistance(const std::vector<float>& a, const std::vector<float>& b) const {
-        if (a.size() != b.size()) return std::numeric_limits<float>::max();
-        
-        float dot_product = 0.0f;
-        float norm_a = 0.0f;
-        float norm_b = 0.0f;
-        
-        for (size_t i = 0; i < a.size(); ++i) {
-            dot_product += a[i] * b[i];
-            norm_a += a[i] * a[i];
-            norm_b += b[i] * b[i];
+    return sum;
+}
+
+template <size_t Dim>
+inline float l1BoundedScalar(const float* a, const float* b, size_t length, float bound) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float sum = 0.0f;
+    size_t i = 0;
+    while (i < n) {
+        const size_t block_end = std::min(n, i + kAbandonBlock);
+        for (; i < block_end; ++i) {
+            sum += std::abs(a[i] - b[i]);
         }
-        
-        if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
-        
-        float cosine_similarity = dot_product / (std::sqrt(norm_a) * std::sqrt(norm_b));
-        return 1.0f - cosine_similarity;  // Convert similarity to distance
+        if (sum > bound) return sum;
     }
-    
-    float calculateManhattanDistance(const std::vector<float>& a, const std::vector<float>& b) const {
-        if (a.size() != b.size()) return std::numeric_limits<float>::max();
-        
-        float sum = 0.0f;
-        for (size_t i = 0; i < a.size(); ++i) {
-            sum += std::abs(a[i] - b[i]);
+    return sum;
+}
+
+template <size_t Dim>
+inline float cosineScalar(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float dot_product = 0.0f;
+    float norm_a = 0.0f;
+    float norm_b = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        dot_product += a[i] * b[i];
+        norm_a += a[i] * a[i];
+        norm_b += b[i] * b[i];
+    }
+    if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+    return 1.0f - dot_product / (std::sqrt(norm_a) * std::sqrt(norm_b));
+}
+
+// Dot products of one vector x against four vectors y[0..3], used by the
+// blocked batch search so each loaded database row feeds four queries
+template <size_t Dim>
+inline void dot4Scalar(const float* x, const float* const* y, size_t length, float* out) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float sum0 = 0.0f, sum1 = 0.0f, sum2 = 0.0f, sum3 = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum0 += x[i] * y[0][i];
+        sum1 += x[i] * y[1][i];
+        sum2 += x[i] * y[2][i];
+        sum3 += x[i] * y[3][i];
+    }
+    out[0] = sum0;
+    out[1] = sum1;
+    out[2] = sum2;
+    out[3] = sum3;
+}
+
+// Element conversions for the FP16 and BF16 encodings: n packed 16-bit
+// values (little-endian, any alignment) to floats and back. Searches widen
+// each encoded row with these before the float kernels measure it.
+inline void halfToFloatScalar(const uint8_t* src, float* dst, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        uint16_t half;
+        std::memcpy(&half, src + i * sizeof(half), sizeof(half));
+        dst[i] = halfToFloat(half);
+    }
+}
+
+inline void floatToHalfScalar(const float* src, uint8_t* dst, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        uint16_t half = floatToHalf(src[i]);
+        std::memcpy(dst + i * sizeof(half), &half, sizeof(half));
+    }
+}
+
+inline void bfloat16ToFloatScalar(const uint8_t* src, float* dst, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        uint16_t value;
+        std::memcpy(&value, src + i * sizeof(value), sizeof(value));
+        dst[i] = bfloat16ToFloat(value);
+    }
+}
+
+inline void floatToBfloat16Scalar(const float* src, uint8_t* dst, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        uint16_t value = floatToBfloat16(src[i]);
+        std::memcpy(dst + i * sizeof(value), &value, sizeof(value));
+    }
+}
+
+#if defined(VECTORDB_X86)
+
+VECTORDB_TARGET_AVX2 inline float horizontalSumAvx2(__m256 v) {
+    __m128 low = _mm256_castps256_ps128(v);
+    __m128 high = _mm256_extractf128_ps(v, 1);
+    __m128 sum = _mm_add_ps(low, high);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    return _mm_cvtss_f32(sum);
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX2 inline float l2SquaredAvx2(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+        acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float sum = horizontalSumAvx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i < n; ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX2 inline float dotAvx2(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = horizontalSumAvx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX2 inline float l1Avx2(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        acc0 = _mm256_add_ps(acc0, _mm256_andnot_ps(sign_mask, d0));
+        acc1 = _mm256_add_ps(acc1, _mm256_andnot_ps(sign_mask, d1));
+        acc2 = _mm256_add_ps(acc2, _mm256_andnot_ps(sign_mask, d2));
+        acc3 = _mm256_add_ps(acc3, _mm256_andnot_ps(sign_mask, d3));
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_add_ps(acc0, _mm256_andnot_ps(sign_mask, d));
+    }
+    float sum = horizontalSumAvx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i < n; ++i) {
+        sum += std::abs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX2 inline float l2SquaredBoundedAvx2(const float* a, const float* b, size_t length, float bound) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    while (i + 32 <= n) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+        acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+        i += 32;
+        if (i % kAbandonBlock == 0) {
+            float partial = horizontalSumAvx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+            if (partial > bound) return partial;
         }
-        return sum;
     }
-    
-    float calculateDotProductDistance(const std::vector<float>& a, const std::vector<float>& b) const {
-        if (a.size() != b.size()) return std::numeric_limits<float>::max();
-        
-        float dot_product = 0.0f;
-        for (size_t i = 0; i < a.size(); ++i) {
-            dot_product += a[i] * b[i];
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float sum = horizontalSumAvx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i < n; ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX2 inline float l1BoundedAvx2(const float* a, const float* b, size_t length, float bound) {
+    const size_t n = Dim != 0 ? Dim : length;
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    while (i + 32 <= n) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        acc0 = _mm256_add_ps(acc0, _mm256_andnot_ps(sign_mask, d0));
+        acc1 = _mm256_add_ps(acc1, _mm256_andnot_ps(sign_mask, d1));
+        acc2 = _mm256_add_ps(acc2, _mm256_andnot_ps(sign_mask, d2));
+        acc3 = _mm256_add_ps(acc3, _mm256_andnot_ps(sign_mask, d3));
+        i += 32;
+        if (i % kAbandonBlock == 0) {
+            float partial = horizontalSumAvx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+            if (partial > bound) return partial;
         }
-        return -dot_product;  // Negative because we want higher dot products to be "closer"
     }
-    
-    float calculateDistance(const std::vector<float>& a, const std::vector<float>& b) const {
-        switch (config_.distance_metric) {
-            case DistanceMetric::EUCLIDEAN:
-                return calculateEuclideanDistance(a, b);
-            case DistanceMetric::COSINE:
-                return calculateCosineDistance(a, b);
-            case DistanceMetric::MANHATTAN:
-                return calculateManhattanDistance(a, b);
-            case DistanceMetric::DOT_PRODUCT:
-                return calculateDotProductDistance(a, b);
-            default:
-                return calculateEuclideanDistance(a, b);
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_add_ps(acc0, _mm256_andnot_ps(sign_mask, d));
+    }
+    float sum = horizontalSumAvx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i < n; ++i) {
+        sum += std::abs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX2 inline float cosineAvx2(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m256 dot_acc = _mm256_setzero_ps();
+    __m256 norm_a_acc = _mm256_setzero_ps();
+    __m256 norm_b_acc = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 va = _mm256_loadu_ps(a + i);
+        __m256 vb = _mm256_loadu_ps(b + i);
+        dot_acc = _mm256_fmadd_ps(va, vb, dot_acc);
+        norm_a_acc = _mm256_fmadd_ps(va, va, norm_a_acc);
+        norm_b_acc = _mm256_fmadd_ps(vb, vb, norm_b_acc);
+    }
+    float dot_product = horizontalSumAvx2(dot_acc);
+    float norm_a = horizontalSumAvx2(norm_a_acc);
+    float norm_b = horizontalSumAvx2(norm_b_acc);
+    for (; i < n && (Dim == 0 || Dim % 8 != 0); ++i) {
+        dot_product += a[i] * b[i];
+        norm_a += a[i] * a[i];
+        norm_b += b[i] * b[i];
+    }
+    if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+    return 1.0f - dot_product / (std::sqrt(norm_a) * std::sqrt(norm_b));
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX2 inline void dot4Avx2(const float* x, const float* const* y, size_t length, float* out) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        acc0 = _mm256_fmadd_ps(vx, _mm256_loadu_ps(y[0] + i), acc0);
+        acc1 = _mm256_fmadd_ps(vx, _mm256_loadu_ps(y[1] + i), acc1);
+        acc2 = _mm256_fmadd_ps(vx, _mm256_loadu_ps(y[2] + i), acc2);
+        acc3 = _mm256_fmadd_ps(vx, _mm256_loadu_ps(y[3] + i), acc3);
+    }
+    out[0] = horizontalSumAvx2(acc0);
+    out[1] = horizontalSumAvx2(acc1);
+    out[2] = horizontalSumAvx2(acc2);
+    out[3] = horizontalSumAvx2(acc3);
+    for (; i < n && (Dim == 0 || Dim % 8 != 0); ++i) {
+        out[0] += x[i] * y[0][i];
+        out[1] += x[i] * y[1][i];
+        out[2] += x[i] * y[2][i];
+        out[3] += x[i] * y[3][i];
+    }
+}
+
+// AVX-512 kernels handle the tail with a masked load instead of a scalar loop
+VECTORDB_TARGET_AVX512 inline __mmask16 tailMaskAvx512(size_t remaining) {
+    return static_cast<__mmask16>((1u << remaining) - 1u);
+}
+
+// Reduce through memory: GCC 12's extract/shuffle intrinsics trip -Wuninitialized
+VECTORDB_TARGET_AVX512 inline float horizontalSumAvx512(__m512 v) {
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    float low = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + (lanes[4] + lanes[5]) + (lanes[6] + lanes[7]);
+    float high = (lanes[8] + lanes[9]) + (lanes[10] + lanes[11]) + (lanes[12] + lanes[13]) + (lanes[14] + lanes[15]);
+    return low + high;
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX512 inline float l2SquaredAvx512(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    if (i < n) {
+        __mmask16 mask = tailMaskAvx512(n - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        acc1 = _mm512_fmadd_ps(d, d, acc1);
+    }
+    return horizontalSumAvx512(_mm512_add_ps(acc0, acc1));
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX512 inline float dotAvx512(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < n) {
+        __mmask16 mask = tailMaskAvx512(n - i);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+    return horizontalSumAvx512(_mm512_add_ps(acc0, acc1));
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX512 inline float l1Avx512(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_add_ps(acc0, _mm512_abs_ps(d0));
+        acc1 = _mm512_add_ps(acc1, _mm512_abs_ps(d1));
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_add_ps(acc0, _mm512_abs_ps(d));
+    }
+    if (i < n) {
+        __mmask16 mask = tailMaskAvx512(n - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        acc1 = _mm512_add_ps(acc1, _mm512_abs_ps(d));
+    }
+    return horizontalSumAvx512(_mm512_add_ps(acc0, acc1));
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX512 inline float l2SquaredBoundedAvx512(const float* a, const float* b, size_t length, float bound) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    while (i + 32 <= n) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+        i += 32;
+        if (i % kAbandonBlock == 0) {
+            float partial = horizontalSumAvx512(_mm512_add_ps(acc0, acc1));
+            if (partial > bound) return partial;
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    if (i < n) {
+        __mmask16 mask = tailMaskAvx512(n - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        acc1 = _mm512_fmadd_ps(d, d, acc1);
+    }
+    return horizontalSumAvx512(_mm512_add_ps(acc0, acc1));
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX512 inline float l1BoundedAvx512(const float* a, const float* b, size_t length, float bound) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    while (i + 32 <= n) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_add_ps(acc0, _mm512_abs_ps(d0));
+        acc1 = _mm512_add_ps(acc1, _mm512_abs_ps(d1));
+        i += 32;
+        if (i % kAbandonBlock == 0) {
+            float partial = horizontalSumAvx512(_mm512_add_ps(acc0, acc1));
+            if (partial > bound) return partial;
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_add_ps(acc0, _mm512_abs_ps(d));
+    }
+    if (i < n) {
+        __mmask16 mask = tailMaskAvx512(n - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        acc1 = _mm512_add_ps(acc1, _mm512_abs_ps(d));
+    }
+    return horizontalSumAvx512(_mm512_add_ps(acc0, acc1));
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX512 inline float cosineAvx512(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m512 dot_acc = _mm512_setzero_ps();
+    __m512 norm_a_acc = _mm512_setzero_ps();
+    __m512 norm_b_acc = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 va = _mm512_loadu_ps(a + i);
+        __m512 vb = _mm512_loadu_ps(b + i);
+        dot_acc = _mm512_fmadd_ps(va, vb, dot_acc);
+        norm_a_acc = _mm512_fmadd_ps(va, va, norm_a_acc);
+        norm_b_acc = _mm512_fmadd_ps(vb, vb, norm_b_acc);
+    }
+    if (i < n) {
+        __mmask16 mask = tailMaskAvx512(n - i);
+        __m512 va = _mm512_maskz_loadu_ps(mask, a + i);
+        __m512 vb = _mm512_maskz_loadu_ps(mask, b + i);
+        dot_acc = _mm512_fmadd_ps(va, vb, dot_acc);
+        norm_a_acc = _mm512_fmadd_ps(va, va, norm_a_acc);
+        norm_b_acc = _mm512_fmadd_ps(vb, vb, norm_b_acc);
+    }
+    float dot_product = horizontalSumAvx512(dot_acc);
+    float norm_a = horizontalSumAvx512(norm_a_acc);
+    float norm_b = horizontalSumAvx512(norm_b_acc);
+    if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+    return 1.0f - dot_product / (std::sqrt(norm_a) * std::sqrt(norm_b));
+}
+
+template <size_t Dim>
+VECTORDB_TARGET_AVX512 inline void dot4Avx512(const float* x, const float* const* y, size_t length, float* out) {
+    const size_t n = Dim != 0 ? Dim : length;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 vx = _mm512_loadu_ps(x + i);
+        acc0 = _mm512_fmadd_ps(vx, _mm512_loadu_ps(y[0] + i), acc0);
+        acc1 = _mm512_fmadd_ps(vx, _mm512_loadu_ps(y[1] + i), acc1);
+        acc2 = _mm512_fmadd_ps(vx, _mm512_loadu_ps(y[2] + i), acc2);
+        acc3 = _mm512_fmadd_ps(vx, _mm512_loadu_ps(y[3] + i), acc3);
+    }
+    if (i < n) {
+        __mmask16 mask = tailMaskAvx512(n - i);
+        __m512 vx = _mm512_maskz_loadu_ps(mask, x + i);
+        acc0 = _mm512_fmadd_ps(vx, _mm512_maskz_loadu_ps(mask, y[0] + i), acc0);
+        acc1 = _mm512_fmadd_ps(vx, _mm512_maskz_loadu_ps(mask, y[1] + i), acc1);
+        acc2 = _mm512_fmadd_ps(vx, _mm512_maskz_loadu_ps(mask, y[2] + i), acc2);
+        acc3 = _mm512_fmadd_ps(vx, _mm512_maskz_loadu_ps(mask, y[3] + i), acc3);
+    }
+    out[0] = horizontalSumAvx512(acc0);
+    out[1] = horizontalSumAvx512(acc1);
+    out[2] = horizontalSumAvx512(acc2);
+    out[3] = horizontalSumAvx512(acc3);
+}
+
+// F16C conversions (part of the AVX2 level) and their AVX-512F forms. The
+// AVX-512 ones use full-mask maskz variants: GCC 12 flags the undefined
+// pass-through operand of the plain intrinsics under -Wmaybe-uninitialized.
+VECTORDB_TARGET_AVX2 inline void halfToFloatAvx2(const uint8_t* src, float* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(half));
+    }
+    halfToFloatScalar(src + i * 2, dst + i, n - i);
+}
+
+VECTORDB_TARGET_AVX2 inline void floatToHalfAvx2(const float* src, uint8_t* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), half);
+    }
+    floatToHalfScalar(src + i, dst + i * 2, n - i);
+}
+
+VECTORDB_TARGET_AVX2 inline void bfloat16ToFloatAvx2(const uint8_t* src, float* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2)));
+        _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16)));
+    }
+    bfloat16ToFloatScalar(src + i * 2, dst + i, n - i);
+}
+
+VECTORDB_TARGET_AVX2 inline void floatToBfloat16Avx2(const float* src, uint8_t* dst, size_t n) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i bias = _mm256_set1_epi32(0x7fff);
+    const __m256i quiet = _mm256_set1_epi32(0x40);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 values = _mm256_loadu_ps(src + i);
+        __m256i bits = _mm256_castps_si256(values);
+        __m256i upper = _mm256_srli_epi32(bits, 16);
+        __m256i rounded = _mm256_srli_epi32(
+            _mm256_add_epi32(bits, _mm256_add_epi32(bias, _mm256_and_si256(upper, one))), 16);
+        __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(values, values, _CMP_UNORD_Q));
+        __m256i result = _mm256_blendv_epi8(rounded, _mm256_or_si256(upper, quiet), nan);
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), packed);
+    }
+    floatToBfloat16Scalar(src + i, dst + i * 2, n - i);
+}
+
+VECTORDB_TARGET_AVX512 inline void halfToFloatAvx512(const uint8_t* src, float* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i half = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2));
+        _mm512_storeu_ps(dst + i, _mm512_maskz_cvtph_ps(0xffff, half));
+    }
+    halfToFloatScalar(src + i * 2, dst + i, n - i);
+}
+
+VECTORDB_TARGET_AVX512 inline void floatToHalfAvx512(const float* src, uint8_t* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i half = _mm512_maskz_cvtps_ph(0xffff, _mm512_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2), half);
+    }
+    floatToHalfScalar(src + i, dst + i * 2, n - i);
+}
+
+VECTORDB_TARGET_AVX512 inline void bfloat16ToFloatAvx512(const uint8_t* src, float* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i wide = _mm512_maskz_cvtepu16_epi32(0xffff, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2)));
+        _mm512_storeu_ps(dst + i, _mm512_castsi512_ps(_mm512_maskz_slli_epi32(0xffff, wide, 16)));
+    }
+    bfloat16ToFloatScalar(src + i * 2, dst + i, n - i);
+}
+
+VECTORDB_TARGET_AVX512 inline void floatToBfloat16Avx512(const float* src, uint8_t* dst, size_t n) {
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i bias = _mm512_set1_epi32(0x7fff);
+    const __m512i quiet = _mm512_set1_epi32(0x40);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 values = _mm512_loadu_ps(src + i);
+        __m512i bits = _mm512_castps_si512(values);
+        __m512i upper = _mm512_maskz_srli_epi32(0xffff, bits, 16);
+        __m512i rounded = _mm512_maskz_srli_epi32(0xffff,
+            _mm512_add_epi32(bits, _mm512_add_epi32(bias, _mm512_and_si512(upper, one))), 16);
+        __mmask16 nan = _mm512_cmp_ps_mask(values, values, _CMP_UNORD_Q);
+        __m512i result = _mm512_mask_mov_epi32(rounded, nan, _mm512_or_si512(upper, quiet));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2), _mm512_maskz_cvtepi32_epi16(0xffff, result));
+    }
+    floatToBfloat16Scalar(src + i, dst + i * 2, n - i);
+}
+
+#endif  // VECTORDB_X86
+
+#if defined(VECTORDB_NEON)
+
+template <size_t Dim>
+inline float l2SquaredNeon(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        float32x4_t d2 = vsubq_f32(vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));
+        float32x4_t d3 = vsubq_f32(vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+        acc0 = vfmaq_f32(acc0, d0, d0);
+        acc1 = vfmaq_f32(acc1, d1, d1);
+        acc2 = vfmaq_f32(acc2, d2, d2);
+        acc3 = vfmaq_f32(acc3, d3, d3);
+    }
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t d = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        acc0 = vfmaq_f32(acc0, d, d);
+    }
+    float sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    for (; i < n; ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <size_t Dim>
+inline float dotNeon(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc2 = vfmaq_f32(acc2, vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));
+        acc3 = vfmaq_f32(acc3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <size_t Dim>
+inline float l1Neon(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vaddq_f32(acc0, vabdq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+        acc1 = vaddq_f32(acc1, vabdq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4)));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vaddq_f32(acc0, vabdq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += std::abs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+template <size_t Dim>
+inline float l2SquaredBoundedNeon(const float* a, const float* b, size_t length, float bound) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    while (i + 16 <= n) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        float32x4_t d2 = vsubq_f32(vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));
+        float32x4_t d3 = vsubq_f32(vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+        acc0 = vfmaq_f32(acc0, d0, d0);
+        acc1 = vfmaq_f32(acc1, d1, d1);
+        acc2 = vfmaq_f32(acc2, d2, d2);
+        acc3 = vfmaq_f32(acc3, d3, d3);
+        i += 16;
+        if (i % kAbandonBlock == 0) {
+            float partial = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+            if (partial > bound) return partial;
+        }
+    }
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t d = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        acc0 = vfmaq_f32(acc0, d, d);
+    }
+    float sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    for (; i < n; ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <size_t Dim>
+inline float l1BoundedNeon(const float* a, const float* b, size_t length, float bound) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    while (i + 8 <= n) {
+        acc0 = vaddq_f32(acc0, vabdq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+        acc1 = vaddq_f32(acc1, vabdq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4)));
+        i += 8;
+        if (i % kAbandonBlock == 0) {
+            float partial = vaddvq_f32(vaddq_f32(acc0, acc1));
+            if (partial > bound) return partial;
+        }
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vaddq_f32(acc0, vabdq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += std::abs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+template <size_t Dim>
+inline float cosineNeon(const float* a, const float* b, size_t length) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float32x4_t dot_acc = vdupq_n_f32(0.0f);
+    float32x4_t norm_a_acc = vdupq_n_f32(0.0f);
+    float32x4_t norm_b_acc = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t va = vld1q_f32(a + i);
+        float32x4_t vb = vld1q_f32(b + i);
+        dot_acc = vfmaq_f32(dot_acc, va, vb);
+        norm_a_acc = vfmaq_f32(norm_a_acc, va, va);
+        norm_b_acc = vfmaq_f32(norm_b_acc, vb, vb);
+    }
+    float dot_product = vaddvq_f32(dot_acc);
+    float norm_a = vaddvq_f32(norm_a_acc);
+    float norm_b = vaddvq_f32(norm_b_acc);
+    for (; i < n; ++i) {
+        dot_product += a[i] * b[i];
+        norm_a += a[i] * a[i];
+        norm_b += b[i] * b[i];
+    }
+    if (norm_a == 0.0f || norm_b == 0.0f) return 1.0f;
+    return 1.0f - dot_product / (std::sqrt(norm_a) * std::sqrt(norm_b));
+}
+
+template <size_t Dim>
+inline void dot4Neon(const float* x, const float* const* y, size_t length, float* out) {
+    const size_t n = Dim != 0 ? Dim : length;
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t vx = vld1q_f32(x + i);
+        acc0 = vfmaq_f32(acc0, vx, vld1q_f32(y[0] + i));
+        acc1 = vfmaq_f32(acc1, vx, vld1q_f32(y[1] + i));
+        acc2 = vfmaq_f32(acc2, vx, vld1q_f32(y[2] + i));
+        acc3 = vfmaq_f32(acc3, vx, vld1q_f32(y[3] + i));
+    }
+    out[0] = vaddvq_f32(acc0);
+    out[1] = vaddvq_f32(acc1);
+    out[2] = vaddvq_f32(acc2);
+    out[3] = vaddvq_f32(acc3);
+    for (; i < n; ++i) {
+        out[0] += x[i] * y[0][i];
+        out[1] += x[i] * y[1][i];
+        out[2] += x[i] * y[2][i];
+        out[3] += x[i] * y[3][i];
+    }
+}
+
+// FP16 and BF16 conversions, four values per step
+inline void halfToFloatNeon(const uint8_t* src, float* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float16x4_t half = vreinterpret_f16_u8(vld1_u8(src + i * 2));
+        vst1q_f32(dst + i, vcvt_f32_f16(half));
+    }
+    halfToFloatScalar(src + i * 2, dst + i, n - i);
+}
+
+inline void floatToHalfNeon(const float* src, uint8_t* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1_u8(dst + i * 2, vreinterpret_u8_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+    }
+    floatToHalfScalar(src + i, dst + i * 2, n - i);
+}
+
+inline void bfloat16ToFloatNeon(const uint8_t* src, float* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32x4_t wide = vshll_n_u16(vreinterpret_u16_u8(vld1_u8(src + i * 2)), 16);
+        vst1q_f32(dst + i, vreinterpretq_f32_u32(wide));
+    }
+    bfloat16ToFloatScalar(src + i * 2, dst + i, n - i);
+}
+
+inline void floatToBfloat16Neon(const float* src, uint8_t* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t values = vld1q_f32(src + i);
+        uint32x4_t bits = vreinterpretq_u32_f32(values);
+        uint32x4_t upper = vshrq_n_u32(bits, 16);
+        uint32x4_t rounded = vshrq_n_u32(
+            vaddq_u32(bits, vaddq_u32(vdupq_n_u32(0x7fff), vandq_u32(upper, vdupq_n_u32(1)))), 16);
+        uint32x4_t nan = vmvnq_u32(vceqq_f32(values, values));
+        uint32x4_t result = vbslq_u32(nan, vorrq_u32(upper, vdupq_n_u32(0x40)), rounded);
+        vst1_u8(dst + i * 2, vreinterpret_u8_u16(vmovn_u32(result)));
+    }
+    floatToBfloat16Scalar(src + i, dst + i * 2, n - i);
+}
+
+#endif  // VECTORDB_NEON
+
+}  // namespace simd_kernels
+
+// Instruction sets the distance kernels can be compiled for
+enum class SimdLevel {
+    SCALAR,
+    NEON,
+    AVX2,
+    AVX512
+};
+
+// Detect the widest SIMD level usable on this CPU (and enabled by the OS)
+inline SimdLevel detectSimdLevel() {
+#if defined(VECTORDB_X86)
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    if (max_leaf < 7) return SimdLevel::SCALAR;
+    
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool f16c = (info[2] & (1 << 29)) != 0;
+    if (!osxsave) return SimdLevel::SCALAR;
+    
+    unsigned long long xcr0 = _xgetbv(0);
+    bool os_avx = (xcr0 & 0x6) == 0x6;
+    bool os_avx512 = (xcr0 & 0xE6) == 0xE6;
+    
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    bool avx512f = (info[1] & (1 << 16)) != 0;
+    
+    if (avx512f && os_avx512) return SimdLevel::AVX512;
+    if (avx2 && fma && f16c && os_avx) return SimdLevel::AVX2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    bool f16c = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C) != 0;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && f16c) return SimdLevel::AVX2;
+#endif
+    return SimdLevel::SCALAR;
+#elif defined(VECTORDB_NEON)
+    return SimdLevel::NEON;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+// Table of distance kernels for one instruction set
+struct DistanceKernels {
+    using Kernel = float (*)(const float*, const float*, size_t);
+    using Kernel4 = void (*)(const float*, const float* const*, size_t, float*);
+    using BoundedKernel = float (*)(const float*, const float*, size_t, float);
+    using Widen = void (*)(const uint8_t*, float*, size_t);
+    using Narrow = void (*)(const float*, uint8_t*, size_t);
+    
+    SimdLevel level;
+    const char* name;
+    Kernel l2_squared;
+    Kernel dot;
+    Kernel l1;
+    Kernel cosine;
+    Kernel4 dot4;
+    BoundedKernel l2_squared_bounded;
+    BoundedKernel l1_bounded;
+    // FP16 / BF16 element conversions
+    Widen half_to_float;
+    Narrow float_to_half;
+    Widen bf16_to_float;
+    Narrow float_to_bf16;
+    
+    template <size_t Dim>
+    static DistanceKernels forLevelAndDimension(SimdLevel level) {
+        using namespace simd_kernels;
+        switch (level) {
+#if defined(VECTORDB_X86)
+            case SimdLevel::AVX512:
+                return {level, "AVX-512", l2SquaredAvx512<Dim>, dotAvx512<Dim>, l1Avx512<Dim>, cosineAvx512<Dim>, dot4Avx512<Dim>,
+                        l2SquaredBoundedAvx512<Dim>, l1BoundedAvx512<Dim>,
+                        halfToFloatAvx512, floatToHalfAvx512, bfloat16ToFloatAvx512, floatToBfloat16Avx512};
+            case SimdLevel::AVX2:
+                return {level, "AVX2/FMA", l2SquaredAvx2<Dim>, dotAvx2<Dim>, l1Avx2<Dim>, cosineAvx2<Dim>, dot4Avx2<Dim>,
+                        l2SquaredBoundedAvx2<Dim>, l1BoundedAvx2<Dim>,
+                        halfToFloatAvx2, floatToHalfAvx2, bfloat16ToFloatAvx2, floatToBfloat16Avx2};
+#endif
+#if defined(VECTORDB_NEON)
+            case SimdLevel::NEON:
+                return {level, "NEON", l2SquaredNeon<Dim>, dotNeon<Dim>, l1Neon<Dim>, cosineNeon<Dim>, dot4Neon<Dim>,
+                        l2SquaredBoundedNeon<Dim>, l1BoundedNeon<Dim>,
+                        halfToFloatNeon, floatToHalfNeon, bfloat16ToFloatNeon, floatToBfloat16Neon};
+#endif
+            default:
+                return {SimdLevel::SCALAR, "Scalar", l2SquaredScalar<Dim>, dotScalar<Dim>, l1Scalar<Dim>, cosineScalar<Dim>, dot4Scalar<Dim>,
+                        l2SquaredBoundedScalar<Dim>, l1BoundedScalar<Dim>,
+                        halfToFloatScalar, floatToHalfScalar, bfloat16ToFloatScalar, floatToBfloat16Scalar};
+        }
+    }
+    
+    // Kernels for an instruction set, specialized for common embedding sizes
+    static DistanceKernels forLevel(SimdLevel level, size_t dimension = 0) {
+        switch (dimension) {
+            case 128: return forLevelAndDimension<128>(level);
+            case 384: return forLevelAndDimension<384>(level);
+            case 768: return forLevelAndDimension<768>(level);
+            case 1536: return forLevelAndDimension<1536>(level);
+            default: return forLevelAndDimension<0>(level);
+        }
+    }
+    
+    // Kernels for the running CPU and a given vector dimension
+    static DistanceKernels forDimension(size_t dimension) {
+        static const SimdLevel level = detectSimdLevel();
+        return forLevel(level, dimension);
+    }
+    
+    // Generic-length kernels for the running CPU
+    static const DistanceKernels& active() {
+        static const DistanceKernels kernels = forDimension(0);
+        return kernels;
+    }
+};
+
+// Utility class for high-dimensional vector operations
+class VectorUtils {
+public:
+    // Generate random vector with specified dimension
+    static std::vector<float> generateRandomVector(size_t dimension, float min_val = -1.0f, float max_val = 1.0f) {
+        static std::random_device rd;
+        static std::mt19937 gen(rd());
+        std::uniform_real_distribution<float> dis(min_val, max_val);
+        
+        std::vector<float> vector(dimension);
+        for (size_t i = 0; i < dimension; ++i) {
+            vector[i] = dis(gen);
+        }
+        return vector;
+    }
+    
+    // Generate random normalized vector (unit vector)
+    static std::vector<float> generateRandomUnitVector(size_t dimension) {
+        static std::random_device rd;
+        static std::mt19937 gen(rd());
+        std::normal_distribution<float> dis(0.0f, 1.0f);
+        
+        std::vector<float> vector(dimension);
+        float norm = 0.0f;
+        
+        // Generate random vector from normal distribution
+        for (size_t i = 0; i < dimension; ++i) {
+            vector[i] = dis(gen);
+            norm += vector[i] * vector[i];
+        }
+        
+        // Normalize to unit length
+        norm = std::sqrt(norm);
+        if (norm > 0.0f) {
+            for (size_t i = 0; i < dimension; ++i) {
+                vector[i] /= norm;
+            }
+        }
+        
+        return vector;
+    }
+    
+    // Generate vectors based on Gaussian distribution around a center
+    static std::vector<float> generateGaussianVector(const std::vector<float>& center, float std_dev = 0.1f) {
+        static std::random_device rd;
+        static std::mt19937 gen(rd());
+        std::normal_distribution<float> dis(0.0f, std_dev);
+        
+        std::vector<float> vector(center.size());
+        for (size_t i = 0; i < center.size(); ++i) {
+            vector[i] = center[i] + dis(gen);
+        }
+        
+        return vector;
+    }
+    
+    // Calculate vector magnitude/norm
+    static float calculateMagnitude(const std::vector<float>& vector) {
+        float sum = 0.0f;
+        for (float val : vector) {
+            sum += val * val;
+        }
+        return std::sqrt(sum);
+    }
+    
+    // Normalize vector to unit length
+    static std::vector<float> normalize(const std::vector<float>& vector) {
+        float magnitude = calculateMagnitude(vector);
+        if (magnitude == 0.0f) return vector;
+        
+        std::vector<float> normalized(vector.size());
+        for (size_t i = 0; i < vector.size(); ++i) {
+            normalized[i] = vector[i] / magnitude;
+        }
+        return normalized;
+    }
+    
+    // Add two vectors
+    static std::vector<float> add(const std::vector<float>& a, const std::vector<float>& b) {
+        if (a.size() != b.size()) {
+            throw std::invalid_argument("Vector dimensions must match for addition");
+        }
+        
+        std::vector<float> result(a.size());
+        for (size_t i = 0; i < a.size(); ++i) {
+            result[i] = a[i] + b[i];
+        }
+        return result;
+    }
+    
+    // Scalar multiplication
+    static std::vector<float> multiply(const std::vector<float>& vector, float scalar) {
+        std::vector<float> result(vector.size());
+        for (size_t i = 0; i < vector.size(); ++i) {
+            result[i] = vector[i] * scalar;
+        }
+        return result;
+    }
+    
+    // Print vector in a compact format (useful for high-dimensional vectors)
+    static void printVector(const std::vector<float>& vector, size_t max_elements = 5) {
+        std::cout << "[";
+        if (vector.size() <= max_elements * 2) {
+            // Print all elements if vector is small
+            for (size_t i = 0; i < vector.size(); ++i) {
+                std::cout << std::fixed << std::setprecision(3) << vector[i];
+                if (i < vector.size() - 1) std::cout << ", ";
+            }
+        } else {
+            // Print first few and last few elements for large vectors
+            for (size_t i = 0; i < max_elements; ++i) {
+                std::cout << std::fixed << std::setprecision(3) << vector[i] << ", ";
+            }
+            std::cout << "..., ";
+            for (size_t i = vector.size() - max_elements; i < vector.size(); ++i) {
+                std::cout << std::fixed << std::setprecision(3) << vector[i];
+                if (i < vector.size() - 1) std::cout << ", ";
+            }
+        }
+        std::cout << "] (dim=" << vector.size() << ")";
+    }
+};
+
+// Allocator returning 64-byte aligned blocks so vector rows line up with cache lines and SIMD loads
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+    
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+    
+    AlignedAllocator() noexcept = default;
+    
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+    
+    T* allocate(size_t count) {
+        if (count > std::numeric_limits<size_t>::max() / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        size_t bytes = (count * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+#if defined(_MSC_VER)
+        void* ptr = _aligned_malloc(bytes, Alignment);
+#else
+        void* ptr = std::aligned_alloc(Alignment, bytes);
+#endif
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+    
+    void deallocate(T* ptr, size_t) noexcept {
+#if defined(_MSC_VER)
+        _aligned_free(ptr);
+#else
+        std::free(ptr);
+#endif
+    }
+    
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+    
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+// Persistent worker pool used to split scans across threads.
+// parallelFor() queues one task per index and the calling thread keeps
+// executing queued tasks until its own batch is done, so several queries can
+// share the pool without deadlocking or leaving the caller idle.
+class ThreadPool {
+private:
+    std::function<void()> on_start_;
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable task_available_;
+    bool stopping_ = false;
+    
+    void workerLoop() {
+        if (on_start_) {
+            on_start_();
+        }
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                task_available_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (stopping_ && tasks_.empty()) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+    
+    bool runPendingTask() {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (tasks_.empty()) {
+                return false;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+        return true;
+    }
+
+public:
+    // on_start, if set, runs first on every worker thread (e.g. to pin it)
+    explicit ThreadPool(size_t worker_count, std::function<void()> on_start = nullptr)
+        : on_start_(std::move(on_start)) {
+        workers_.reserve(worker_count);
+        for (size_t i = 0; i < worker_count; ++i) {
+            workers_.emplace_back([this] { workerLoop(); });
+        }
+    }
+    
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        task_available_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+    
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    
+    size_t size() const { return workers_.size(); }
+    
+    // Run fn on a worker thread; unlike parallelFor the caller does not take part
+    template <typename Fn>
+    std::future<std::invoke_result_t<Fn>> submit(Fn&& fn) {
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<Fn>()>>(std::forward<Fn>(fn));
+        std::future<std::invoke_result_t<Fn>> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace_back([task] { (*task)(); });
+        }
+        task_available_.notify_one();
+        return result;
+    }
+    
+    // Run fn(i) for every i in [0, count) and return once all calls finished.
+    // If calls throw, the rest still run and the first exception is rethrown
+    // on the caller once none of them can touch this frame any more.
+    template <typename Fn>
+    void parallelFor(size_t count, Fn&& fn) {
+        if (count == 0) {
+            return;
+        }
+        
+        // Guarded by done_mutex: the caller must not return (and destroy these
+        // locals) while a worker is still signalling completion
+        size_t remaining = count;
+        std::exception_ptr error;
+        std::mutex done_mutex;
+        std::condition_variable done;
+        
+        auto run = [&](size_t i) {
+            std::exception_ptr thrown;
+            try {
+                fn(i);
+            } catch (...) {
+                thrown = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(done_mutex);
+            if (thrown && !error) {
+                error = thrown;
+            }
+            if (--remaining == 0) {
+                done.notify_one();
+            }
+        };
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 1; i < count; ++i) {
+                tasks_.emplace_back([&run, i] { run(i); });
+            }
+        }
+        task_available_.notify_all();
+        
+        run(0);
+        
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(done_mutex);
+                if (remaining == 0) {
+                    break;
+                }
+            }
+            if (!runPendingTask()) {
+                std::unique_lock<std::mutex> lock(done_mutex);
+                if (done.wait_for(lock, std::chrono::milliseconds(1), [&] { return remaining == 0; })) {
+                    break;
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// NUMA nodes of the machine and the CPUs of each that this process may run
+// on, read once from the OS (sysfs on Linux, the NUMA API on Windows). Other
+// systems, and machines with one node, report a single node and pinning is
+// a no-op. Memory follows first touch, so a thread pinned to a node places
+// the pages it allocates and writes on that node.
+class NumaTopology {
+private:
+    std::vector<std::vector<unsigned>> node_cpus_;
+#if defined(_WIN32)
+    std::vector<GROUP_AFFINITY> node_affinity_;
+#endif
+    
+#if defined(__linux__)
+    // "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11}
+    static std::vector<unsigned> parseCpuList(const std::string& text) {
+        std::vector<unsigned> cpus;
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t end = text.find(',', pos);
+            if (end == std::string::npos) end = text.size();
+            std::string range = text.substr(pos, end - pos);
+            size_t dash = range.find('-');
+            try {
+                unsigned first = static_cast<unsigned>(std::stoul(range.substr(0, dash)));
+                unsigned last = dash == std::string::npos ? first : static_cast<unsigned>(std::stoul(range.substr(dash + 1)));
+                for (unsigned cpu = first; cpu <= last; ++cpu) {
+                    cpus.push_back(cpu);
+                }
+            } catch (const std::exception&) {
+                // blank or malformed entry: skip it
+            }
+            pos = end + 1;
+        }
+        return cpus;
+    }
+#endif
+    
+    NumaTopology() {
+#if defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+        
+        std::map<unsigned, std::vector<unsigned>> nodes;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+            const std::string name = entry.path().filename().string();
+            if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+                name.find_first_not_of("0123456789", 4) != std::string::npos) {
+                continue;
+            }
+            std::ifstream file(entry.path() / "cpulist");
+            std::string text;
+            std::getline(file, text);
+            std::vector<unsigned> cpus;
+            for (unsigned cpu : parseCpuList(text)) {
+                if (!have_mask || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))) {
+                    cpus.push_back(cpu);
+                }
+            }
+            // Nodes without usable CPUs (memory-only or outside our cpuset) cannot run workers
+            if (!cpus.empty()) {
+                nodes[static_cast<unsigned>(std::stoul(name.substr(4)))] = std::move(cpus);
+            }
+        }
+        for (auto& node : nodes) {
+            node_cpus_.push_back(std::move(node.second));
+        }
+#elif defined(_WIN32)
+        ULONG highest = 0;
+        if (GetNumaHighestNodeNumber(&highest)) {
+            for (USHORT node = 0; node <= highest; ++node) {
+                GROUP_AFFINITY affinity = {};
+                if (!GetNumaNodeProcessorMaskEx(node, &affinity) || affinity.Mask == 0) {
+                    continue;
+                }
+                std::vector<unsigned> cpus;
+                for (unsigned bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit) {
+                    if (affinity.Mask & (KAFFINITY(1) << bit)) {
+                        cpus.push_back(affinity.Group * 64u + bit);
+                    }
+                }
+                node_cpus_.push_back(std::move(cpus));
+                node_affinity_.push_back(affinity);
+            }
+        }
+#endif
+        if (node_cpus_.size() <= 1) {
+            node_cpus_.assign(1, std::vector<unsigned>());
+#if defined(_WIN32)
+            node_affinity_.clear();
+#endif
+        }
+    }
+
+public:
+    static const NumaTopology& system() {
+        static const NumaTopology topology;
+        return topology;
+    }
+    
+    size_t nodeCount() const { return node_cpus_.size(); }
+    
+    // CPUs of a node (empty on single-node systems, where nothing is pinned)
+    const std::vector<unsigned>& cpus(size_t node) const { return node_cpus_[node % node_cpus_.size()]; }
+    
+    // Restrict the calling thread to the CPUs of a node; false if not pinned
+    bool pinCurrentThread(size_t node) const {
+        if (nodeCount() <= 1) {
+            return false;
+        }
+        node %= nodeCount();
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (unsigned cpu : node_cpus_[node]) {
+            if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+        }
+        return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+        return SetThreadGroupAffinity(GetCurrentThread(), &node_affinity_[node], nullptr) != 0;
+#else
+        return false;
+#endif
+    }
+};
+
+// Runs a function on its own thread every interval until destroyed
+class PeriodicTask {
+private:
+    std::function<void()> fn_;
+    std::chrono::milliseconds interval_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::thread thread_;
+    
+public:
+    PeriodicTask(std::chrono::milliseconds interval, std::function<void()> fn)
+        : fn_(std::move(fn)), interval_(interval), thread_([this] {
+              std::unique_lock<std::mutex> lock(mutex_);
+              while (!wake_.wait_for(lock, interval_, [this] { return stopping_; })) {
+                  lock.unlock();
+                  fn_();
+                  lock.lock();
+              }
+          }) {}
+    
+    ~PeriodicTask() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+    
+    PeriodicTask(const PeriodicTask&) = delete;
+    PeriodicTask& operator=(const PeriodicTask&) = delete;
+};
+
+// Micro-batching scheduler behind search_async(). Queries submitted from any
+// number of threads are queued; one scheduler thread takes up to max_batch of
+// them once that many are waiting or the oldest has waited max_wait, answers
+// each group with equal k and parameters through a single call of the batch
+// function, and hands every request its results through its callback.
+// Callbacks run on the scheduler thread, so they should be short and must not
+// throw. If the batch function throws, callbacks receive empty results and
+// futures the exception. Requests still queued at destruction are answered
+// before it returns.
+template <typename Result>
+class BatchScheduler {
+public:
+    using Results = std::vector<Result>;
+    using BatchFn = std::function<std::vector<Results>(const std::vector<std::vector<float>>&, size_t,
+                                                       const SearchParams&)>;
+    using Callback = std::function<void(Results)>;
+    
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t batches = 0;  // calls of the batch function
+    };
+
+private:
+    struct Request {
+        std::vector<float> query;
+        size_t k;
+        SearchParams params;
+        Callback done;
+        std::chrono::steady_clock::time_point queued;
+        // Set for futures, to pass on an exception from the batch function
+        std::function<void(std::exception_ptr)> failed;
+        // Answered with no results without being searched
+        bool rejected = false;
+    };
+    
+    BatchFn batch_;
+    size_t max_batch_;
+    std::chrono::microseconds max_wait_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<Request> pending_;
+    Stats stats_;
+    bool stopping_ = false;
+    std::thread thread_;
+    
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+            if (pending_.empty()) {
+                return;
+            }
+            wake_.wait_until(lock, pending_.front().queued + max_wait_,
+                             [this] { return stopping_ || pending_.size() >= max_batch_; });
+            
+            size_t count = std::min(pending_.size(), max_batch_);
+            std::vector<Request> batch(std::make_move_iterator(pending_.begin()),
+                                       std::make_move_iterator(pending_.begin() + count));
+            pending_.erase(pending_.begin(), pending_.begin() + count);
+            lock.unlock();
+            dispatch(batch);
+            lock.lock();
+        }
+    }
+    
+    void enqueue(Request request, bool front) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (front) {
+                pending_.push_front(std::move(request));
+            } else {
+                pending_.push_back(std::move(request));
+            }
+            ++stats_.requests;
+        }
+        wake_.notify_one();
+    }
+    
+    // Answer a batch, one batch call per distinct (k, params)
+    void dispatch(std::vector<Request>& batch) {
+        std::map<std::tuple<size_t, size_t, size_t>, std::vector<size_t>> groups;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const Request& request = batch[i];
+            if (request.rejected) {
+                batch[i].done(Results());
+                continue;
+            }
+            groups[{request.k, request.params.ef_search, request.params.nprobe}].push_back(i);
+        }
+        
+        for (const auto& group : groups) {
+            const std::vector<size_t>& members = group.second;
+            std::vector<std::vector<float>> queries;
+            queries.reserve(members.size());
+            for (size_t i : members) {
+                queries.push_back(std::move(batch[i].query));
+            }
+            const Request& first = batch[members.front()];
+            std::vector<Results> results;
+            std::exception_ptr error;
+            try {
+                results = batch_(queries, first.k, first.params);
+            } catch (const std::exception& e) {
+                std::cerr << "Error: Async search batch failed: " << e.what() << std::endl;
+                error = std::current_exception();
+            } catch (...) {
+                std::cerr << "Error: Async search batch failed" << std::endl;
+                error = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ++stats_.batches;
+            }
+            for (size_t j = 0; j < members.size(); ++j) {
+                Request& request = batch[members[j]];
+                if (error && request.failed) {
+                    request.failed(error);
+                } else {
+                    request.done(j < results.size() ? std::move(results[j]) : Results());
+                }
+            }
+        }
+    }
+
+public:
+    BatchScheduler(BatchFn batch, size_t max_batch, std::chrono::microseconds max_wait)
+        : batch_(std::move(batch)), max_batch_(std::max<size_t>(1, max_batch)), max_wait_(max_wait),
+          thread_([this] { run(); }) {}
+    
+    ~BatchScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+    
+    BatchScheduler(const BatchScheduler&) = delete;
+    BatchScheduler& operator=(const BatchScheduler&) = delete;
+    
+    void submit(std::vector<float> query, size_t k, const SearchParams& params, Callback done) {
+        enqueue({std::move(query), k, params, std::move(done), std::chrono::steady_clock::now(), nullptr, false},
+                false);
+    }
+    
+    std::future<Results> submit(std::vector<float> query, size_t k, const SearchParams& params) {
+        auto promise = std::make_shared<std::promise<Results>>();
+        std::future<Results> result = promise->get_future();
+        enqueue({std::move(query), k, params,
+                 [promise](Results results) { promise->set_value(std::move(results)); },
+                 std::chrono::steady_clock::now(),
+                 [promise](std::exception_ptr error) { promise->set_exception(error); }, false},
+                false);
+        return result;
+    }
+    
+    // Answer done with no results on the scheduler thread, for a query that
+    // cannot be searched, so callbacks never run on the submitting thread.
+    // It goes to the front of the queue and is due at once.
+    void reject(Callback done) {
+        enqueue({{}, 0, SearchParams(), std::move(done), std::chrono::steady_clock::now() - max_wait_, nullptr, true},
+                true);
+    }
+    
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+};
+
+// Reader-writer lock that prefers writers: once a writer is waiting, new
+// readers queue behind it, so a steady stream of searches cannot starve
+// inserts (glibc's std::shared_mutex prefers readers). Meets the SharedMutex
+// requirements, so it works with std::shared_lock and std::unique_lock.
+// Acquisitions that have to block are counted together with the time they
+// waited; uncontended ones are not timed.
+class ReadWriteMutex {
+public:
+    struct WaitStats {
+        uint64_t read_waits = 0;
+        uint64_t read_wait_ns = 0;
+        uint64_t write_waits = 0;
+        uint64_t write_wait_ns = 0;
+    };
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable readers_cv_;
+    std::condition_variable writers_cv_;
+    size_t active_readers_ = 0;
+    size_t waiting_writers_ = 0;
+    bool writer_active_ = false;
+    WaitStats wait_stats_;
+    
+    // Block on cv until ready(), adding the time waited to waits and wait_ns
+    template <typename Ready>
+    void waitFor(std::unique_lock<std::mutex>& guard, std::condition_variable& cv, Ready ready,
+                 uint64_t& waits, uint64_t& wait_ns) {
+        if (ready()) {
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        cv.wait(guard, ready);
+        ++waits;
+        wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+public:
+    ReadWriteMutex() = default;
+    ReadWriteMutex(const ReadWriteMutex&) = delete;
+    ReadWriteMutex& operator=(const ReadWriteMutex&) = delete;
+    
+    void lock() {
+        std::unique_lock<std::mutex> guard(mutex_);
+        ++waiting_writers_;
+        waitFor(guard, writers_cv_, [this] { return !writer_active_ && active_readers_ == 0; },
+                wait_stats_.write_waits, wait_stats_.write_wait_ns);
+        --waiting_writers_;
+        writer_active_ = true;
+    }
+    
+    bool try_lock() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (writer_active_ || active_readers_ != 0) {
+            return false;
+        }
+        writer_active_ = true;
+        return true;
+    }
+    
+    void unlock() {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            writer_active_ = false;
+        }
+        writers_cv_.notify_one();
+        readers_cv_.notify_all();
+    }
+    
+    void lock_shared() {
+        std::unique_lock<std::mutex> guard(mutex_);
+        waitFor(guard, readers_cv_, [this] { return !writer_active_ && waiting_writers_ == 0; },
+                wait_stats_.read_waits, wait_stats_.read_wait_ns);
+        ++active_readers_;
+    }
+    
+    bool try_lock_shared() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (writer_active_ || waiting_writers_ != 0) {
+            return false;
+        }
+        ++active_readers_;
+        return true;
+    }
+    
+    void unlock_shared() {
+        bool last_reader;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            last_reader = --active_readers_ == 0;
+        }
+        if (last_reader) {
+            writers_cv_.notify_one();
+        }
+    }
+    
+    WaitStats waitStats() const {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return wait_stats_;
+    }
+};
+
+// Compressed representation of vectors for the non-FLOAT32 encodings:
+//  - FP16: every component as an IEEE half (2x smaller);
+//  - BF16: every component as a bfloat16, the upper half of the float: the
+//    full float range at 8 bits of mantissa (2x smaller);
+//  - INT8: scalar quantization to 256 levels between per-dimension min/max
+//    learned from the first vectors (4x smaller; later outliers are clamped);
+//  - PQ:   product quantization, the vector split into subspaces that each
+//    store the index of the nearest of 256 k-means centroids (one byte per
+//    subspace). Queries compare against codes through an asymmetric distance
+//    table of partial distances from the query to every centroid.
+class VectorCodec {
+public:
+    static constexpr size_t kCentroids = 256;
+
+private:
+    static constexpr size_t kTrainSample = 16384;
+    static constexpr size_t kTrainIterations = 8;
+    static constexpr uint32_t kSeed = 0x5eed1234u;
+
+    VectorEncoding encoding_;
+    size_t dimension_;
+    size_t subspaces_;
+    bool trained_;
+    std::vector<float> min_;    // INT8
+    std::vector<float> scale_;  // INT8
+    std::vector<size_t> sub_begin_;  // PQ: subspace s covers [sub_begin_[s], sub_begin_[s + 1])
+    std::vector<float> codebooks_;   // PQ: subspace s holds kCentroids rows of its width at kCentroids * sub_begin_[s]
+    std::vector<float> centroid_norms_;  // PQ: squared centroid norms, laid out like a distance table
+
+    size_t width(size_t subspace) const { return sub_begin_[subspace + 1] - sub_begin_[subspace]; }
+
+    const float* codebook(size_t subspace) const { return codebooks_.data() + kCentroids * sub_begin_[subspace]; }
+
+    static float squaredDistance(const float* a, const float* b, size_t length) {
+        float sum = 0.0f;
+        for (size_t i = 0; i < length; ++i) {
+            float diff = a[i] - b[i];
+            sum += diff * diff;
+        }
+        return sum;
+    }
+
+    uint8_t nearestCentroid(size_t subspace, const float* values) const {
+        const size_t w = width(subspace);
+        const float* centroids = codebook(subspace);
+        size_t best = 0;
+        float best_distance = std::numeric_limits<float>::max();
+        for (size_t c = 0; c < kCentroids; ++c) {
+            float distance = squaredDistance(values, centroids + c * w, w);
+            if (distance < best_distance) {
+                best_distance = distance;
+                best = c;
+            }
+        }
+        return static_cast<uint8_t>(best);
+    }
+
+    void trainScalar(const float* data, size_t count, size_t stride) {
+        min_.assign(dimension_, std::numeric_limits<float>::max());
+        std::vector<float> max(dimension_, std::numeric_limits<float>::lowest());
+        for (size_t i = 0; i < count; ++i) {
+            const float* row = data + i * stride;
+            for (size_t d = 0; d < dimension_; ++d) {
+                min_[d] = std::min(min_[d], row[d]);
+                max[d] = std::max(max[d], row[d]);
+            }
+        }
+        scale_.resize(dimension_);
+        for (size_t d = 0; d < dimension_; ++d) {
+            scale_[d] = (max[d] - min_[d]) / 255.0f;
+        }
+    }
+
+    // Independent k-means (L2) per subspace on a random sample of the rows
+    void trainProduct(const float* data, size_t count, size_t stride) {
+        std::mt19937 rng(kSeed);
+        std::vector<size_t> sample(count);
+        for (size_t i = 0; i < count; ++i) {
+            sample[i] = i;
+        }
+        std::shuffle(sample.begin(), sample.end(), rng);
+        sample.resize(std::min(count, kTrainSample));
+
+        codebooks_.assign(kCentroids * dimension_, 0.0f);
+        std::vector<uint8_t> assignment(sample.size());
+        for (size_t s = 0; s < subspaces_; ++s) {
+            const size_t w = width(s);
+            const size_t offset = sub_begin_[s];
+            float* centroids = codebooks_.data() + kCentroids * offset;
+            for (size_t c = 0; c < kCentroids; ++c) {
+                const float* row = data + sample[c % sample.size()] * stride + offset;
+                std::copy(row, row + w, centroids + c * w);
+            }
+
+            std::vector<double> sums(kCentroids * w);
+            std::vector<size_t> counts(kCentroids);
+            for (size_t iteration = 0; iteration < kTrainIterations; ++iteration) {
+                std::fill(sums.begin(), sums.end(), 0.0);
+                std::fill(counts.begin(), counts.end(), 0);
+                for (size_t i = 0; i < sample.size(); ++i) {
+                    const float* values = data + sample[i] * stride + offset;
+                    assignment[i] = nearestCentroid(s, values);
+                    double* sum = sums.data() + assignment[i] * w;
+                    for (size_t j = 0; j < w; ++j) {
+                        sum[j] += values[j];
+                    }
+                    ++counts[assignment[i]];
+                }
+                for (size_t c = 0; c < kCentroids; ++c) {
+                    if (counts[c] == 0) {
+                        // Reseed an empty centroid from a random sampled row
+                        const float* row = data + sample[rng() % sample.size()] * stride + offset;
+                        std::copy(row, row + w, centroids + c * w);
+                        continue;
+                    }
+                    for (size_t j = 0; j < w; ++j) {
+                        centroids[c * w + j] = static_cast<float>(sums[c * w + j] / counts[c]);
+                    }
+                }
+            }
+        }
+
+        centroid_norms_.resize(tableSize());
+        for (size_t s = 0; s < subspaces_; ++s) {
+            const size_t w = width(s);
+            for (size_t c = 0; c < kCentroids; ++c) {
+                const float* centroid = codebook(s) + c * w;
+                centroid_norms_[s * kCentroids + c] = std::inner_product(centroid, centroid + w, centroid, 0.0f);
+            }
+        }
+    }
+
+public:
+    VectorCodec(VectorEncoding encoding, size_t dimension, size_t subspaces)
+        : encoding_(encoding), dimension_(dimension),
+          subspaces_(std::max<size_t>(1, std::min(dimension, subspaces != 0 ? subspaces : (dimension + 7) / 8))),
+          trained_(encoding == VectorEncoding::FP16 || encoding == VectorEncoding::BF16) {
+        if (encoding_ == VectorEncoding::PQ) {
+            // Spread dimensions as evenly as possible across the subspaces
+            sub_begin_.resize(subspaces_ + 1);
+            for (size_t s = 0; s <= subspaces_; ++s) {
+                sub_begin_[s] = dimension_ * s / subspaces_;
+            }
+        }
+    }
+
+    VectorEncoding encoding() const { return encoding_; }
+    bool trained() const { return trained_; }
+    size_t subspaces() const { return subspaces_; }
+
+    const char* name() const {
+        switch (encoding_) {
+            case VectorEncoding::FP16:
+                return "FP16";
+            case VectorEncoding::BF16:
+                return "BF16";
+            case VectorEncoding::INT8:
+                return "INT8 (scalar quantization)";
+            case VectorEncoding::PQ:
+                return "PQ (product quantization)";
+            default:
+                return "FLOAT32";
+        }
+    }
+
+    // Bytes per encoded vector
+    size_t codeSize() const {
+        switch (encoding_) {
+            case VectorEncoding::FP16:
+            case VectorEncoding::BF16:
+                return dimension_ * sizeof(uint16_t);
+            case VectorEncoding::PQ:
+                return subspaces_;
+            default:
+                return dimension_;
+        }
+    }
+
+    // Vectors to collect (kept as floats) before training
+    size_t trainRows() const {
+        switch (encoding_) {
+            case VectorEncoding::INT8:
+                return 1024;
+            case VectorEncoding::PQ:
+                return 4096;
+            default:
+                return 0;
+        }
+    }
+
+    // Learn the encoding from count rows of dimension_ floats, stride apart
+    void train(const float* data, size_t count, size_t stride) {
+        if (count == 0) {
+            return;
+        }
+        if (encoding_ == VectorEncoding::INT8) {
+            trainScalar(data, count, stride);
+        } else if (encoding_ == VectorEncoding::PQ) {
+            trainProduct(data, count, stride);
+        }
+        trained_ = true;
+    }
+
+    void encode(const float* values, uint8_t* code) const {
+        switch (encoding_) {
+            case VectorEncoding::FP16:
+                DistanceKernels::active().float_to_half(values, code, dimension_);
+                break;
+            case VectorEncoding::BF16:
+                DistanceKernels::active().float_to_bf16(values, code, dimension_);
+                break;
+            case VectorEncoding::INT8:
+                for (size_t d = 0; d < dimension_; ++d) {
+                    float level = scale_[d] > 0.0f ? (values[d] - min_[d]) / scale_[d] : 0.0f;
+                    code[d] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, std::round(level))));
+                }
+                break;
+            case VectorEncoding::PQ:
+                for (size_t s = 0; s < subspaces_; ++s) {
+                    code[s] = nearestCentroid(s, values + sub_begin_[s]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    void decode(const uint8_t* code, float* values) const {
+        switch (encoding_) {
+            case VectorEncoding::FP16:
+                DistanceKernels::active().half_to_float(code, values, dimension_);
+                break;
+            case VectorEncoding::BF16:
+                DistanceKernels::active().bf16_to_float(code, values, dimension_);
+                break;
+            case VectorEncoding::INT8:
+                for (size_t d = 0; d < dimension_; ++d) {
+                    values[d] = min_[d] + scale_[d] * code[d];
+                }
+                break;
+            case VectorEncoding::PQ:
+                for (size_t s = 0; s < subspaces_; ++s) {
+                    const size_t w = width(s);
+                    const float* centroid = codebook(s) + code[s] * w;
+                    std::copy(centroid, centroid + w, values + sub_begin_[s]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    // PQ asymmetric distance table: for every subspace and centroid the
+    // partial squared L2 / L1 distance or dot product with the query
+    size_t tableSize() const { return subspaces_ * kCentroids; }
+
+    void buildTable(DistanceMetric metric, const float* query, float* table) const {
+        for (size_t s = 0; s < subspaces_; ++s) {
+            const size_t w = width(s);
+            const float* q = query + sub_begin_[s];
+            const float* centroids = codebook(s);
+            float* out = table + s * kCentroids;
+            for (size_t c = 0; c < kCentroids; ++c) {
+                const float* centroid = centroids + c * w;
+                float sum = 0.0f;
+                for (size_t j = 0; j < w; ++j) {
+                    switch (metric) {
+                        case DistanceMetric::EUCLIDEAN: {
+                            float diff = q[j] - centroid[j];
+                            sum += diff * diff;
+                            break;
+                        }
+                        case DistanceMetric::MANHATTAN:
+                            sum += std::abs(q[j] - centroid[j]);
+                            break;
+                        default:
+                            sum += q[j] * centroid[j];
+                            break;
+                    }
+                }
+                out[c] = sum;
+            }
+        }
+    }
+
+    float tableSum(const float* table, const uint8_t* code) const {
+        float sum = 0.0f;
+        for (size_t s = 0; s < subspaces_; ++s) {
+            sum += table[s * kCentroids + code[s]];
+        }
+        return sum;
+    }
+
+    // L2 norm of the vector a PQ code reconstructs
+    float reconstructedNorm(const uint8_t* code) const {
+        return std::sqrt(tableSum(centroid_norms_.data(), code));
+    }
+
+    // Bytes held by the trained parameters
+    size_t memoryBytes() const {
+        return (min_.capacity() + scale_.capacity() + codebooks_.capacity() + centroid_norms_.capacity()) *
+                   sizeof(float) +
+               sub_begin_.capacity() * sizeof(size_t);
+    }
+};
+
+// Full-precision copies of quantized vectors in a file on disk, one fixed-size
+// record per storage row, read back only to re-rank the best candidates.
+// Reads may come from concurrent searches, so file access is serialized.
+class FullPrecisionFile {
+private:
+    std::string path_;
+    size_t record_bytes_;
+    mutable std::fstream file_;
+    mutable std::mutex file_mutex_;
+
+    bool open(std::ios::openmode mode) {
+        file_.close();
+        file_.clear();
+        file_.open(path_, mode | std::ios::in | std::ios::out | std::ios::binary);
+        if (!file_.is_open()) {
+            std::cerr << "Error: Cannot open full-precision vector file: " << path_ << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+public:
+    FullPrecisionFile(const std::string& path, size_t dimension)
+        : path_(path), record_bytes_(dimension * sizeof(float)) {
+        open(std::ios::trunc);
+    }
+
+    // The file is scratch space for this storage and goes away with it
+    ~FullPrecisionFile() {
+        file_.close();
+        std::remove(path_.c_str());
+    }
+
+    const std::string& path() const { return path_; }
+    bool good() const { return file_.is_open(); }
+
+    bool write(size_t row, const float* values) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        file_.seekp(static_cast<std::streamoff>(row * record_bytes_));
+        file_.write(reinterpret_cast<const char*>(values), static_cast<std::streamsize>(record_bytes_));
+        return file_.good();
+    }
+
+    bool read(size_t row, float* values) const {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        file_.seekg(static_cast<std::streamoff>(row * record_bytes_));
+        file_.read(reinterpret_cast<char*>(values), static_cast<std::streamsize>(record_bytes_));
+        if (!file_.good()) {
+            file_.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // Copy record from over record to (swap-with-last removal)
+    bool move(size_t from, size_t to) {
+        std::vector<float> values(record_bytes_ / sizeof(float));
+        return read(from, values.data()) && write(to, values.data());
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        open(std::ios::trunc);
+    }
+
+    // Move the file to a new path, keeping its contents
+    bool rename(const std::string& path) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        file_.close();
+        std::remove(path.c_str());
+        if (std::rename(path_.c_str(), path.c_str()) != 0) {
+            std::cerr << "Error: Cannot move full-precision vector file to: " << path << std::endl;
+            open(std::ios::openmode());
+            return false;
+        }
+        path_ = path;
+        return open(std::ios::openmode());
+    }
+};
+
+// Set of storage rows as a flat bitset. Rows are dense, so one bit per row
+// costs at most rows / 8 bytes and a membership test is a shift and a mask
+// inside the scan and index traversal loops.
+class RowBitmap {
+private:
+    std::vector<uint64_t> words_;
+    size_t size_ = 0;
+
+    void clearTail() {
+        if (size_ % 64 != 0) {
+            words_.back() &= (uint64_t(1) << (size_ % 64)) - 1;
+        }
+    }
+
+public:
+    explicit RowBitmap(size_t size = 0, bool value = false)
+        : words_((size + 63) / 64, value ? ~uint64_t(0) : 0), size_(size) {
+        clearTail();
+    }
+
+    size_t size() const { return size_; }
+    bool test(size_t row) const { return (words_[row / 64] >> (row % 64)) & 1; }
+    void set(size_t row) { words_[row / 64] |= uint64_t(1) << (row % 64); }
+    void reset(size_t row) { words_[row / 64] &= ~(uint64_t(1) << (row % 64)); }
+
+    // Grow or shrink to size rows; rows added take value
+    void resize(size_t size, bool value = false) {
+        const size_t old_size = size_;
+        words_.resize((size + 63) / 64, 0);
+        size_ = size;
+        for (size_t row = old_size; value && row < size; ++row) {
+            set(row);
+        }
+        clearTail();
+    }
+
+    size_t count() const {
+        size_t total = 0;
+        for (uint64_t word : words_) {
+            total += std::bitset<64>(word).count();
+        }
+        return total;
+    }
+
+    RowBitmap& operator&=(const RowBitmap& other) {
+        for (size_t i = 0; i < words_.size(); ++i) {
+            words_[i] &= other.words_[i];
+        }
+        return *this;
+    }
+
+    RowBitmap& operator|=(const RowBitmap& other) {
+        for (size_t i = 0; i < words_.size(); ++i) {
+            words_[i] |= other.words_[i];
+        }
+        return *this;
+    }
+
+    void flip() {
+        for (uint64_t& word : words_) {
+            word = ~word;
+        }
+        clearTail();
+    }
+
+    // Call fn(row) for every set row in [begin, end), in ascending order
+    template <typename Fn>
+    void forEach(size_t begin, size_t end, Fn&& fn) const {
+        end = std::min(end, size_);
+        for (size_t row = begin; row < end; ) {
+            uint64_t word = words_[row / 64] >> (row % 64);
+            if (word == 0) {
+                row = (row / 64 + 1) * 64;
+                continue;
+            }
+            if (word & 1) {
+                fn(row);
+            }
+            ++row;
+        }
+    }
+};
+
+// Typed attributes of the rows of a VectorStorage, stored by column. Every
+// attribute name has one column whose kind (integer, real or string) is set
+// by the first value written; string columns are dictionary encoded. Columns
+// only extend to the last row given a value, and rows without one are
+// absent. Rows follow the storage's swap-with-last removal. A Filter is
+// evaluated into a RowBitmap with one sequential pass per referenced column.
+class AttributeTable {
+public:
+    // Matches the alternative index of AttributeValue
+    enum class Kind : uint8_t { INTEGER = 0, REAL = 1, STRING = 2 };
+
+private:
+    struct Column {
+        Kind kind = Kind::INTEGER;
+        std::vector<uint8_t> present;  // one flag per row
+        std::vector<int64_t> integers;
+        std::vector<double> reals;
+        std::vector<uint32_t> codes;   // STRING: index into dictionary
+        std::vector<std::string> dictionary;
+        std::unordered_map<std::string, uint32_t> dictionary_codes;
+
+        size_t rows() const { return present.size(); }
+
+        void resize(size_t rows) {
+            present.resize(rows, 0);
+            switch (kind) {
+                case Kind::INTEGER: integers.resize(rows, 0); break;
+                case Kind::REAL: reals.resize(rows, 0.0); break;
+                case Kind::STRING: codes.resize(rows, 0); break;
+            }
+        }
+
+        void copyRow(size_t from, size_t to) {
+            present[to] = present[from];
+            switch (kind) {
+                case Kind::INTEGER: integers[to] = integers[from]; break;
+                case Kind::REAL: reals[to] = reals[from]; break;
+                case Kind::STRING: codes[to] = codes[from]; break;
+            }
+        }
+
+        uint32_t codeOf(const std::string& value) {
+            auto it = dictionary_codes.find(value);
+            if (it != dictionary_codes.end()) {
+                return it->second;
+            }
+            uint32_t code = static_cast<uint32_t>(dictionary.size());
+            dictionary.push_back(value);
+            dictionary_codes.emplace(value, code);
+            return code;
+        }
+    };
+
+    std::map<std::string, Column> columns_;
+
+    static Kind kindOf(const AttributeValue& value) { return static_cast<Kind>(value.index()); }
+
+    static const char* kindName(Kind kind) {
+        switch (kind) {
+            case Kind::INTEGER: return "integer";
+            case Kind::REAL: return "real";
+            default: return "string";
+        }
+    }
+
+    template <typename T>
+    static bool holds(Filter::Op op, const T& value, const T& operand) {
+        switch (op) {
+            case Filter::Op::EQ: return value == operand;
+            case Filter::Op::NE: return value != operand;
+            case Filter::Op::LT: return value < operand;
+            case Filter::Op::LE: return value <= operand;
+            case Filter::Op::GT: return value > operand;
+            case Filter::Op::GE: return value >= operand;
+            default: return false;
+        }
+    }
+
+    RowBitmap compareColumn(const Filter& filter, size_t rows) const {
+        RowBitmap matches(rows);
+        auto it = columns_.find(filter.attribute());
+        if (it == columns_.end()) {
+            return matches;
+        }
+        const Column& column = it->second;
+        const size_t count = std::min(rows, column.rows());
+        const AttributeValue& operand = filter.value();
+        const Filter::Op op = filter.op();
+
+        if ((column.kind == Kind::STRING) != (kindOf(operand) == Kind::STRING)) {
+            return matches;
+        }
+        if (column.kind == Kind::STRING) {
+            // Decide once per distinct value, then per row by code
+            const std::string& text = std::get<std::string>(operand);
+            std::vector<uint8_t> pass(column.dictionary.size());
+            for (size_t code = 0; code < pass.size(); ++code) {
+                pass[code] = holds(op, column.dictionary[code], text);
+            }
+            for (size_t row = 0; row < count; ++row) {
+                if (column.present[row] && pass[column.codes[row]]) {
+                    matches.set(row);
+                }
+            }
+        } else if (column.kind == Kind::INTEGER && kindOf(operand) == Kind::INTEGER) {
+            const int64_t number = std::get<int64_t>(operand);
+            for (size_t row = 0; row < count; ++row) {
+                if (column.present[row] && holds(op, column.integers[row], number)) {
+                    matches.set(row);
+                }
+            }
+        } else {
+            const double number = kindOf(operand) == Kind::INTEGER ? static_cast<double>(std::get<int64_t>(operand))
+                                                                   : std::get<double>(operand);
+            for (size_t row = 0; row < count; ++row) {
+                double value = column.kind == Kind::INTEGER ? static_cast<double>(column.integers[row])
+                                                            : column.reals[row];
+                if (column.present[row] && holds(op, value, number)) {
+                    matches.set(row);
+                }
+            }
+        }
+        return matches;
+    }
+
+    template <typename T>
+    static void put(std::vector<char>& out, const T& value) {
+        const char* bytes = reinterpret_cast<const char*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    static void putString(std::vector<char>& out, const std::string& text) {
+        put(out, static_cast<uint32_t>(text.size()));
+        out.insert(out.end(), text.begin(), text.end());
+    }
+
+    // Bounds-checked reads from an encoded buffer
+    struct Reader {
+        const char* data;
+        size_t remaining;
+
+        template <typename T>
+        bool get(T& value) {
+            if (remaining < sizeof(T)) {
+                return false;
+            }
+            std::memcpy(&value, data, sizeof(T));
+            data += sizeof(T);
+            remaining -= sizeof(T);
+            return true;
+        }
+
+        bool getString(std::string& text) {
+            uint32_t length;
+            if (!get(length) || remaining < length) {
+                return false;
+            }
+            text.assign(data, length);
+            data += length;
+            remaining -= length;
+            return true;
+        }
+    };
+
+public:
+    bool empty() const { return columns_.empty(); }
+    size_t columnCount() const { return columns_.size(); }
+
+    // True if every value fits the kind of its column (integers are also
+    // accepted by real columns); otherwise explains why in error
+    bool accepts(const Attributes& attributes, std::string& error) const {
+        for (const auto& [name, value] : attributes) {
+            if (name.empty()) {
+                error = "Attribute name cannot be empty";
+                return false;
+            }
+            auto it = columns_.find(name);
+            if (it == columns_.end() || it->second.kind == kindOf(value) ||
+                (it->second.kind == Kind::REAL && kindOf(value) == Kind::INTEGER)) {
+                continue;
+            }
+            error = "Attribute '" + name + "' holds " + kindName(it->second.kind) + " values, got " +
+                    kindName(kindOf(value));
+            return false;
+        }
+        return true;
+    }
+
+    // Set the given attributes of a row, keeping its others (accepts() must hold)
+    void set(size_t row, const Attributes& attributes) {
+        for (const auto& [name, value] : attributes) {
+            auto it = columns_.find(name);
+            if (it == columns_.end()) {
+                it = columns_.emplace(name, Column()).first;
+                it->second.kind = kindOf(value);
+            }
+            Column& column = it->second;
+            if (column.rows() <= row) {
+                column.resize(row + 1);
+            }
+            column.present[row] = 1;
+            switch (column.kind) {
+                case Kind::INTEGER:
+                    column.integers[row] = std::get<int64_t>(value);
+                    break;
+                case Kind::REAL:
+                    column.reals[row] = kindOf(value) == Kind::INTEGER ? static_cast<double>(std::get<int64_t>(value))
+                                                                       : std::get<double>(value);
+                    break;
+                case Kind::STRING:
+                    column.codes[row] = column.codeOf(std::get<std::string>(value));
+                    break;
+            }
+        }
+    }
+
+    Attributes get(size_t row) const {
+        Attributes attributes;
+        for (const auto& [name, column] : columns_) {
+            if (row >= column.rows() || !column.present[row]) {
+                continue;
+            }
+            switch (column.kind) {
+                case Kind::INTEGER: attributes.emplace(name, column.integers[row]); break;
+                case Kind::REAL: attributes.emplace(name, column.reals[row]); break;
+                case Kind::STRING: attributes.emplace(name, column.dictionary[column.codes[row]]); break;
+            }
+        }
+        return attributes;
+    }
+
+    bool hasAny(size_t row) const {
+        for (const auto& entry : columns_) {
+            if (row < entry.second.rows() && entry.second.present[row]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Mirror VectorStorage removal: the last row moves into row
+    void removeRow(size_t row, size_t last) {
+        for (auto& entry : columns_) {
+            Column& column = entry.second;
+            if (last < column.rows()) {
+                column.copyRow(last, row);
+            } else if (row < column.rows()) {
+                column.present[row] = 0;
+            }
+            if (column.rows() > last) {
+                column.resize(last);
+            }
+        }
+    }
+
+    void clear() { columns_.clear(); }
+
+    // Rows of [0, rows) matching a filter
+    RowBitmap evaluate(const Filter& filter, size_t rows) const {
+        switch (filter.op()) {
+            case Filter::Op::AND:
+            case Filter::Op::OR: {
+                RowBitmap matches = evaluate(filter.operands()[0], rows);
+                for (size_t i = 1; i < filter.operands().size(); ++i) {
+                    if (filter.op() == Filter::Op::AND) {
+                        matches &= evaluate(filter.operands()[i], rows);
+                    } else {
+                        matches |= evaluate(filter.operands()[i], rows);
+                    }
+                }
+                return matches;
+            }
+            case Filter::Op::NOT: {
+                RowBitmap matches = evaluate(filter.operands()[0], rows);
+                matches.flip();
+                return matches;
+            }
+            case Filter::Op::EXISTS: {
+                RowBitmap matches(rows);
+                auto it = columns_.find(filter.attribute());
+                if (it != columns_.end()) {
+                    for (size_t row = 0; row < std::min(rows, it->second.rows()); ++row) {
+                        if (it->second.present[row]) {
+                            matches.set(row);
+                        }
+                    }
+                }
+                return matches;
+            }
+            default:
+                return compareColumn(filter, rows);
+        }
+    }
+
+    size_t memoryBytes() const {
+        size_t bytes = 0;
+        for (const auto& entry : columns_) {
+            const Column& column = entry.second;
+            bytes += column.present.capacity() + column.integers.capacity() * sizeof(int64_t) +
+                     column.reals.capacity() * sizeof(double) + column.codes.capacity() * sizeof(uint32_t);
+            for (const std::string& value : column.dictionary) {
+                bytes += 2 * (sizeof(std::string) + value.capacity());
+            }
+        }
+        return bytes;
+    }
+
+    // Column encoding used by database files: u32 column count, then per
+    // column its name (u32 length + bytes), kind (u8), row count (u64), one
+    // presence byte per row and the values: an i64 or f64 per row, or for
+    // strings the dictionary (u32 count, then each entry as a name is)
+    // followed by a u32 code per row
+    void serialize(std::vector<char>& out, const std::vector<size_t>* rows = nullptr) const {
+        put(out, static_cast<uint32_t>(columns_.size()));
+        for (const auto& [name, column] : columns_) {
+            putString(out, name);
+            put(out, static_cast<uint8_t>(column.kind));
+            put(out, static_cast<uint64_t>(rows ? rows->size() : column.rows()));
+            // With rows given, output row i is table row (*rows)[i]
+            auto put_array = [&out, rows](const auto& values) {
+                using Value = typename std::decay_t<decltype(values)>::value_type;
+                if (!rows) {
+                    const char* bytes = reinterpret_cast<const char*>(values.data());
+                    out.insert(out.end(), bytes, bytes + values.size() * sizeof(Value));
+                    return;
+                }
+                for (size_t row : *rows) {
+                    put(out, row < values.size() ? values[row] : Value());
+                }
+            };
+            put_array(column.present);
+            switch (column.kind) {
+                case Kind::INTEGER: put_array(column.integers); break;
+                case Kind::REAL: put_array(column.reals); break;
+                case Kind::STRING:
+                    put(out, static_cast<uint32_t>(column.dictionary.size()));
+                    for (const std::string& value : column.dictionary) {
+                        putString(out, value);
+                    }
+                    put_array(column.codes);
+                    break;
+            }
+        }
+    }
+
+    // Rebuild a table from serialize() output; false if it is malformed
+    static bool deserialize(const char* data, size_t bytes, AttributeTable& table) {
+        table.clear();
+        if (bytes == 0) {
+            return true;
+        }
+        Reader reader{data, bytes};
+        uint32_t column_count;
+        if (!reader.get(column_count)) {
+            return false;
+        }
+        for (uint32_t c = 0; c < column_count; ++c) {
+            std::string name;
+            uint8_t kind;
+            uint64_t rows;
+            if (!reader.getString(name) || !reader.get(kind) || kind > 2 || !reader.get(rows) ||
+                rows > reader.remaining) {
+                return false;
+            }
+            Column column;
+            column.kind = static_cast<Kind>(kind);
+            column.resize(static_cast<size_t>(rows));
+            std::memcpy(column.present.data(), reader.data, column.present.size());
+            reader.data += rows;
+            reader.remaining -= rows;
+            auto get_array = [&reader](auto& values) {
+                size_t length = values.size() * sizeof(values[0]);
+                if (reader.remaining < length) {
+                    return false;
+                }
+                std::memcpy(values.data(), reader.data, length);
+                reader.data += length;
+                reader.remaining -= length;
+                return true;
+            };
+            bool ok = true;
+            switch (column.kind) {
+                case Kind::INTEGER: ok = get_array(column.integers); break;
+                case Kind::REAL: ok = get_array(column.reals); break;
+                case Kind::STRING: {
+                    uint32_t entries;
+                    ok = reader.get(entries) && entries <= reader.remaining;
+                    for (uint32_t i = 0; ok && i < entries; ++i) {
+                        std::string value;
+                        ok = reader.getString(value);
+                        if (ok) column.codeOf(value);
+                    }
+                    ok = ok && column.dictionary.size() == entries && get_array(column.codes);
+                    for (size_t row = 0; ok && row < column.rows(); ++row) {
+                        ok = column.codes[row] < entries;
+                    }
+                    break;
+                }
+            }
+            if (!ok || name.empty() || !table.columns_.emplace(std::move(name), std::move(column)).second) {
+                return false;
+            }
+        }
+        return reader.remaining == 0;
+    }
+
+    // Row encoding used by the write-ahead log: u32 count, then per
+    // attribute its name, kind (u8) and value (i64, f64, or a string)
+    static void encode(const Attributes& attributes, std::vector<char>& out) {
+        put(out, static_cast<uint32_t>(attributes.size()));
+        for (const auto& [name, value] : attributes) {
+            putString(out, name);
+            put(out, static_cast<uint8_t>(kindOf(value)));
+            switch (kindOf(value)) {
+                case Kind::INTEGER: put(out, std::get<int64_t>(value)); break;
+                case Kind::REAL: put(out, std::get<double>(value)); break;
+                case Kind::STRING: putString(out, std::get<std::string>(value)); break;
+            }
+        }
+    }
+
+    static bool decode(const char* data, size_t bytes, Attributes& attributes) {
+        attributes.clear();
+        Reader reader{data, bytes};
+        uint32_t count;
+        if (!reader.get(count)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            std::string name;
+            uint8_t kind;
+            if (!reader.getString(name) || !reader.get(kind)) {
+                return false;
+            }
+            bool ok = false;
+            if (kind == static_cast<uint8_t>(Kind::INTEGER)) {
+                int64_t value = 0;
+                ok = reader.get(value);
+                attributes[name] = value;
+            } else if (kind == static_cast<uint8_t>(Kind::REAL)) {
+                double value = 0.0;
+                ok = reader.get(value);
+                attributes[name] = value;
+            } else if (kind == static_cast<uint8_t>(Kind::STRING)) {
+                std::string value;
+                ok = reader.getString(value);
+                attributes[name] = std::move(value);
+            }
+            if (!ok) {
+                return false;
+            }
+        }
+        return reader.remaining == 0;
+    }
+};
+
+class VectorStorage;
+
+// Read-only memory mapping of a whole file. Pages are loaded on first touch
+// and shared through the page cache with every other process mapping it.
+class MappedFile {
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#if defined(_WIN32)
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#endif
+
+public:
+    explicit MappedFile(const std::string& path) {
+#if defined(_WIN32)
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+            return;
+        }
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_ == nullptr) {
+            return;
+        }
+        const void* view = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        if (view != nullptr) {
+            data_ = static_cast<const char*>(view);
+            size_ = static_cast<size_t>(size.QuadPart);
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* view = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (view != MAP_FAILED) {
+                data_ = static_cast<const char*>(view);
+                size_ = static_cast<size_t>(info.st_size);
+            }
+        }
+        // The mapping keeps the file referenced on its own
+        ::close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#if defined(_WIN32)
+        if (data_ != nullptr) {
+            UnmapViewOfFile(data_);
+        }
+        if (mapping_ != nullptr) {
+            CloseHandle(mapping_);
+        }
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+        }
+#else
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool good() const { return data_ != nullptr; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+};
+
+// Header occupying the first page of a database file. All integers have fixed
+// widths and are stored in the byte order of the writing host, recorded by
+// byte_order so that a file from a host of the other endianness is rejected.
+struct DatabaseFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+    uint32_t byte_order;
+    uint32_t distance_metric;
+    uint64_t dimension;
+    uint64_t stride;             // floats per row, including zero padding
+    uint64_t count;
+    uint64_t vectors_offset;     // count * stride floats, page aligned
+    uint64_t norms_offset;       // count floats
+    uint64_t id_offsets_offset;  // count + 1 uint64 offsets into the string table
+    uint64_t id_slots_offset;    // id_slot_count uint64 slots: row + 1, or 0 if empty
+    uint64_t id_slot_count;      // power of two
+    uint64_t strings_offset;
+    uint64_t strings_bytes;
+    uint64_t file_bytes;
+    // Version 2: AttributeTable::serialize() output (0 bytes = no attributes)
+    uint64_t attributes_offset;
+    uint64_t attributes_bytes;
+};
+
+// Versioned on-disk format that is searched in place through a memory map:
+//
+//   page 0     DatabaseFileHeader
+//   page 1..   vector block, one padded row per vector (the VectorStorage
+//              slab layout, so rows are used by the kernels without copying)
+//   then       cached norms, ID offset table, ID hash table, ID string table,
+//              attribute columns (version 2)
+//
+// Sections after the vector block start on 64-byte boundaries. The ID hash
+// table is open addressing with linear probing over FNV-1a hashes, so lookups
+// by ID need no in-memory map either. Opening a file only validates the header;
+// pages are faulted in as searches touch them.
+class DatabaseFile {
+public:
+    static constexpr char kMagic[8] = {'V', 'E', 'C', 'T', 'O', 'R', 'D', 'B'};
+    static constexpr uint32_t kVersion = 2;
+    static constexpr uint32_t kByteOrder = 0x01020304u;
+    static constexpr size_t kPageBytes = 4096;
+    static constexpr size_t kSectionAlignment = 64;
+
+private:
+    std::unique_ptr<MappedFile> map_;
+    const DatabaseFileHeader* header_ = nullptr;
+    AttributeTable attributes_;
+
+    template <typename T>
+    const T* section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(map_->data() + offset);
+    }
+
+public:
+    static uint64_t hashId(const char* data, size_t length) {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < length; ++i) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // True if the file starts with the format magic (older files do not)
+    static bool hasMagic(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        char magic[sizeof(kMagic)] = {};
+        file.read(magic, sizeof(magic));
+        return file.good() && std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+    }
+
+    // Map a file and validate its header and section bounds; nullptr on error
+    static std::shared_ptr<const DatabaseFile> open(const std::string& path) {
+        auto file = std::make_shared<DatabaseFile>();
+        file->map_ = std::make_unique<MappedFile>(path);
+        if (!file->map_->good()) {
+            std::cerr << "Error: Cannot map database file: " << path << std::endl;
+            return nullptr;
+        }
+        if (file->map_->size() < kPageBytes) {
+            std::cerr << "Error: Database file is truncated: " << path << std::endl;
+            return nullptr;
+        }
+
+        const DatabaseFileHeader* header = file->section<DatabaseFileHeader>(0);
+        if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0) {
+            std::cerr << "Error: Not a vector database file: " << path << std::endl;
+            return nullptr;
+        }
+        if (header->byte_order != kByteOrder) {
+            std::cerr << "Error: Database file was written on a host with a different byte order: "
+                      << path << std::endl;
+            return nullptr;
+        }
+        // Version 1 headers end before the attribute section fields
+        const size_t header_bytes = header->version >= 2 ? sizeof(DatabaseFileHeader)
+                                                         : offsetof(DatabaseFileHeader, attributes_offset);
+        if (header->version > kVersion || header->header_bytes < header_bytes) {
+            std::cerr << "Error: Unsupported database file version " << header->version
+                      << " (this build reads up to " << kVersion << "): " << path << std::endl;
+            return nullptr;
+        }
+
+        const uint64_t count = header->count;
+        const uint64_t slots = header->id_slot_count;
+        bool valid = header->file_bytes <= file->map_->size() && header->stride >= header->dimension &&
+                     header->vectors_offset % kPageBytes == 0 && (slots & (slots - 1)) == 0 && slots > count;
+        // Element counts are divided into the space left rather than
+        // multiplied out, so hostile counts cannot wrap past the check
+        auto fits = [&](uint64_t offset, uint64_t elements, uint64_t element_bytes) {
+            return offset % sizeof(uint64_t) == 0 && offset <= header->file_bytes &&
+                   elements <= (header->file_bytes - offset) / element_bytes;
+        };
+        // count is bounded by the file size first, so count * stride and
+        // count + 1 below cannot overflow
+        valid = valid && header->stride > 0 && count <= header->file_bytes / sizeof(float) / header->stride &&
+                fits(header->vectors_offset, count * header->stride, sizeof(float)) &&
+                fits(header->norms_offset, count, sizeof(float)) &&
+                fits(header->id_offsets_offset, count + 1, sizeof(uint64_t)) &&
+                fits(header->id_slots_offset, slots, sizeof(uint64_t)) &&
+                header->strings_offset <= header->file_bytes &&
+                header->strings_bytes <= header->file_bytes - header->strings_offset;
+        if (header->version >= 2 && header->attributes_bytes > 0) {
+            valid = valid && header->attributes_offset <= header->file_bytes &&
+                    header->attributes_bytes <= header->file_bytes - header->attributes_offset;
+        }
+        if (!valid) {
+            std::cerr << "Error: Corrupt database file header: " << path << std::endl;
+            return nullptr;
+        }
+        if (header->version >= 2 &&
+            !AttributeTable::deserialize(file->section<char>(header->attributes_offset),
+                                         static_cast<size_t>(header->attributes_bytes), file->attributes_)) {
+            std::cerr << "Error: Corrupt attribute section in database file: " << path << std::endl;
+            return nullptr;
+        }
+
+        file->header_ = header;
+        return file;
+    }
+
+    // Write a storage in this format (defined after VectorStorage)
+    static bool write(const std::string& path, const VectorStorage& storage, DistanceMetric metric);
+
+    const DatabaseFileHeader& header() const { return *header_; }
+    size_t size() const { return static_cast<size_t>(header_->count); }
+    size_t mappedBytes() const { return map_->size(); }
+
+    const float* rows() const { return section<float>(header_->vectors_offset); }
+    const float* norms() const { return section<float>(header_->norms_offset); }
+    // Decoded when the file is opened (attributes are small next to the vectors)
+    const AttributeTable& attributes() const { return attributes_; }
+
+    std::string_view id(size_t row) const {
+        const uint64_t* offsets = section<uint64_t>(header_->id_offsets_offset);
+        // Clamp so a damaged offset table cannot read outside the string table
+        uint64_t begin = std::min(offsets[row], header_->strings_bytes);
+        uint64_t end = std::min(std::max(offsets[row + 1], begin), header_->strings_bytes);
+        return std::string_view(section<char>(header_->strings_offset) + begin, static_cast<size_t>(end - begin));
+    }
+
+    // Row holding an ID, or npos
+    size_t find(std::string_view id, size_t npos) const {
+        const uint64_t* slots = section<uint64_t>(header_->id_slots_offset);
+        const uint64_t mask = header_->id_slot_count - 1;
+        for (uint64_t slot = hashId(id.data(), id.size()) & mask, probes = 0; probes <= mask;
+             slot = (slot + 1) & mask, ++probes) {
+            uint64_t entry = slots[slot];
+            if (entry == 0 || entry > header_->count) {
+                return npos;
+            }
+            if (this->id(static_cast<size_t>(entry - 1)) == id) {
+                return static_cast<size_t>(entry - 1);
+            }
+        }
+        return npos;
+    }
+};
+
+// Row <-> ID mapping for a VectorStorage. String IDs are interned once into a
+// byte arena (rows refer to them by offset and length) and found through an
+// open-addressing hash table of row numbers, so an ID costs no allocation of
+// its own and is only materialized as a std::string when results are returned.
+// Numeric tables (VectorDatabaseConfig::integer_ids) keep unsigned 64-bit keys
+// instead and skip the strings entirely; string IDs given to them must be the
+// canonical decimal form of a key, and string tables store integer IDs in
+// that form.
+// Rows are dense; removal moves the last row into the freed slot. A row can
+// also be unlinked: it keeps its place but its ID is no longer found, which
+// is how VectorStorage tombstones a row until it is compacted away.
+class IdTable {
+private:
+    struct Entry {
+        uint64_t key;             // arena offset, or the numeric ID
+        uint32_t length : 31;     // string length (0 for numeric tables)
+        uint32_t unlinked : 1;    // not in the hash table
+        uint32_t hash;
+    };
+
+    // Hash slot: row + 1 (0 = empty) and the row's hash, so probing and
+    // resizing never rehash the IDs themselves
+    struct Slot {
+        uint32_t row_plus_one;
+        uint32_t hash;
+    };
+
+    bool numeric_;
+    std::vector<Entry> entries_;
+    std::vector<char> arena_;
+    size_t dead_bytes_ = 0;
+    std::vector<Slot> slots_;
+
+    static uint32_t hashString(std::string_view id) {
+        uint64_t hash = std::hash<std::string_view>()(id);
+        return static_cast<uint32_t>(hash ^ (hash >> 32));
+    }
+
+    static uint32_t hashNumber(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        return static_cast<uint32_t>(key);
+    }
+
+    std::string_view text(const Entry& entry) const {
+        return std::string_view(arena_.data() + entry.key, entry.length);
+    }
+
+    size_t mask() const { return slots_.size() - 1; }
+
+    // Slot holding row, found by probing from its hash
+    size_t slotOf(size_t row) const {
+        size_t slot = entries_[row].hash & mask();
+        while (slots_[slot].row_plus_one != row + 1) {
+            slot = (slot + 1) & mask();
+        }
+        return slot;
+    }
+
+    template <typename Matches>
+    size_t lookup(uint32_t hash, Matches&& matches) const {
+        if (slots_.empty()) {
+            return npos;
+        }
+        for (size_t slot = hash & mask();; slot = (slot + 1) & mask()) {
+            const Slot& candidate = slots_[slot];
+            if (candidate.row_plus_one == 0) {
+                return npos;
+            }
+            if (candidate.hash == hash && matches(entries_[candidate.row_plus_one - 1])) {
+                return candidate.row_plus_one - 1;
+            }
+        }
+    }
+
+    void insertSlot(size_t row) {
+        size_t slot = entries_[row].hash & mask();
+        while (slots_[slot].row_plus_one != 0) {
+            slot = (slot + 1) & mask();
+        }
+        slots_[slot] = {static_cast<uint32_t>(row + 1), entries_[row].hash};
+    }
+
+    // Keep the table at most half full
+    void growSlots(size_t rows) {
+        size_t wanted = 16;
+        while (wanted < rows * 2) {
+            wanted *= 2;
+        }
+        if (wanted <= slots_.size()) {
+            return;
+        }
+        slots_.assign(wanted, Slot{0, 0});
+        for (size_t row = 0; row < entries_.size(); ++row) {
+            if (!entries_[row].unlinked) {
+                insertSlot(row);
+            }
+        }
+    }
+
+    // Empty a slot, shifting later entries of its probe run back into it
+    void eraseSlot(size_t slot) {
+        size_t hole = slot;
+        for (size_t next = (slot + 1) & mask(); slots_[next].row_plus_one != 0; next = (next + 1) & mask()) {
+            size_t home = slots_[next].hash & mask();
+            // Move next into the hole unless its home lies cyclically in (hole, next]
+            bool stays = hole <= next ? (home > hole && home <= next) : (home > hole || home <= next);
+            if (!stays) {
+                slots_[hole] = slots_[next];
+                hole = next;
+            }
+        }
+        slots_[hole] = Slot{0, 0};
+    }
+
+    // Rewrite the arena without the bytes of removed IDs
+    void compactArena() {
+        std::vector<char> arena;
+        arena.reserve(arena_.size() - dead_bytes_);
+        for (Entry& entry : entries_) {
+            uint64_t offset = arena.size();
+            arena.insert(arena.end(), arena_.begin() + entry.key, arena_.begin() + entry.key + entry.length);
+            entry.key = offset;
+        }
+        arena_.swap(arena);
+        dead_bytes_ = 0;
+    }
+
+    void push(const Entry& entry) {
+        if (entries_.size() >= std::numeric_limits<uint32_t>::max() - 1) {
+            throw std::length_error("IdTable holds at most 2^32 - 2 rows");
+        }
+        entries_.push_back(entry);
+        growSlots(entries_.size());
+        insertSlot(entries_.size() - 1);
+    }
+
+public:
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+    explicit IdTable(bool numeric = false) : numeric_(numeric) {}
+
+    // Canonical decimal form of an unsigned 64-bit integer ("0", no sign,
+    // no leading zeros), so that string and numeric IDs round-trip
+    static bool parseNumber(std::string_view text, uint64_t& out) {
+        if (text.empty() || text.size() > 20 || (text.size() > 1 && text[0] == '0')) {
+            return false;
+        }
+        uint64_t value = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            uint64_t digit = static_cast<uint64_t>(c - '0');
+            if (value > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+                return false;
+            }
+            value = value * 10 + digit;
+        }
+        out = value;
+        return true;
+    }
+
+    bool numeric() const { return numeric_; }
+    size_t size() const { return entries_.size(); }
+
+    // True if id can be stored (non-empty; a decimal key for numeric tables)
+    bool accepts(std::string_view id) const {
+        uint64_t key;
+        return !id.empty() && (!numeric_ || parseNumber(id, key));
+    }
+
+    size_t find(std::string_view id) const {
+        if (numeric_) {
+            uint64_t key;
+            return parseNumber(id, key) ? find(key) : npos;
+        }
+        return lookup(hashString(id), [&](const Entry& entry) { return text(entry) == id; });
+    }
+
+    size_t find(uint64_t key) const {
+        if (!numeric_) {
+            return find(std::string_view(std::to_string(key)));
+        }
+        return lookup(hashNumber(key), [&](const Entry& entry) { return entry.key == key; });
+    }
+
+    std::string id(size_t row) const {
+        return numeric_ ? std::to_string(entries_[row].key) : std::string(text(entries_[row]));
+    }
+
+    // Numeric tables only
+    uint64_t number(size_t row) const { return entries_[row].key; }
+
+    // Append a row for an ID not in the table (accepts(id) must hold)
+    void push(std::string_view id) {
+        if (numeric_) {
+            uint64_t key = 0;
+            if (!parseNumber(id, key)) {
+                throw std::invalid_argument("Not an integer ID: " + std::string(id));
+            }
+            push(key);
+            return;
+        }
+        if (id.size() >= (size_t(1) << 31)) {
+            throw std::length_error("IdTable IDs are shorter than 2^31 bytes");
+        }
+        uint64_t offset = arena_.size();
+        arena_.insert(arena_.end(), id.begin(), id.end());
+        push(Entry{offset, static_cast<uint32_t>(id.size()), 0, hashString(id)});
+    }
+
+    // String tables store the key's decimal form
+    void push(uint64_t key) {
+        if (!numeric_) {
+            push(std::string_view(std::to_string(key)));
+            return;
+        }
+        push(Entry{key, 0, 0, hashNumber(key)});
+    }
+
+    // Drop a row's ID from the hash table, keeping the row itself
+    void unlink(size_t row) {
+        eraseSlot(slotOf(row));
+        entries_[row].unlinked = 1;
+    }
+
+    // Remove a row, moving the last row into its place
+    void remove(size_t row) {
+        const size_t last = entries_.size() - 1;
+        if (!entries_[row].unlinked) {
+            eraseSlot(slotOf(row));
+        }
+        dead_bytes_ += entries_[row].length;
+        if (row != last) {
+            if (!entries_[last].unlinked) {
+                slots_[slotOf(last)].row_plus_one = static_cast<uint32_t>(row + 1);
+            }
+            entries_[row] = entries_[last];
+        }
+        entries_.pop_back();
+        if (dead_bytes_ > 4096 && dead_bytes_ * 2 > arena_.size()) {
+            compactArena();
+        }
+    }
+
+    void reserve(size_t rows) {
+        entries_.reserve(rows);
+        growSlots(rows);
+    }
+
+    void clear() {
+        entries_.clear();
+        arena_.clear();
+        slots_.clear();
+        dead_bytes_ = 0;
+    }
+
+    size_t memoryBytes() const {
+        return entries_.capacity() * sizeof(Entry) + arena_.capacity() + slots_.capacity() * sizeof(Slot);
+    }
+};
+
+// Contiguous row-major storage for all vectors of a database.
+// Every vector lives in one aligned float slab, addressed by a dense row id;
+// IDs are interned in an IdTable (ID -> row, row -> ID) and attributes kept
+// in a row-aligned AttributeTable. Rows are padded
+// to a multiple of 8 floats so each row starts on a 32-byte boundary, and the
+// padding is kept zeroed. Removal moves the last row into the freed slot so the
+// slab never has holes and scans stay a single sequential pass. The L2 norm of
+// every row is cached at write time so cosine and decomposed Euclidean scans
+// only need one dot product per candidate.
+//
+// With a compressed encoding the slab holds fixed-size codes instead. Vectors
+// are kept as floats until the codec has seen enough of them to train on, then
+// all rows are encoded and the float slab is released; quantized() tells which
+// form is live. Optionally a FullPrecisionFile keeps exact copies on disk.
+//
+// A storage can also be a read-only view of a mapped DatabaseFile, whose
+// vector block has the same padded layout. The first write copies the mapped
+// data into memory and drops the mapping (copy-on-write).
+//
+// Rows can be tombstoned instead of removed: the row stays in place (so
+// indexes keep their structure) but its ID is no longer found and liveRows()
+// excludes it from searches. compact() later removes all tombstoned rows.
+class VectorStorage {
+private:
+    size_t dimension_;
+    size_t stride_;
+    std::vector<float, AlignedAllocator<float>> data_;
+    std::vector<float> norms_;
+    IdTable ids_;
+    AttributeTable attributes_;
+    std::unique_ptr<VectorCodec> codec_;
+    std::vector<uint8_t> codes_;
+    size_t code_size_ = 0;
+    bool quantized_ = false;
+    std::unique_ptr<FullPrecisionFile> full_precision_;
+    std::shared_ptr<const DatabaseFile> file_;
+    // Rows not tombstoned; only kept while deleted_ > 0
+    RowBitmap live_;
+    size_t deleted_ = 0;
+
+    static size_t computeStride(size_t dimension) {
+        return dimension < 8 ? dimension : (dimension + 7) / 8 * 8;
+    }
+
+    // Train the codec on the collected float rows and switch to codes
+    void quantize() {
+        codec_->train(data_.data(), ids_.size(), stride_);
+        codes_.resize(ids_.size() * code_size_);
+        for (size_t index = 0; index < ids_.size(); ++index) {
+            codec_->encode(row(index), code(index));
+        }
+        std::vector<float, AlignedAllocator<float>>().swap(data_);
+        quantized_ = true;
+    }
+
+    // Copy a mapped file into memory so the storage can be modified
+    void detach() {
+        if (!file_) {
+            return;
+        }
+        std::shared_ptr<const DatabaseFile> file = std::move(file_);
+        const size_t count = file->size();
+        data_.assign(file->rows(), file->rows() + count * stride_);
+        norms_.assign(file->norms(), file->norms() + count);
+        ids_.reserve(count);
+        for (size_t index = 0; index < count; ++index) {
+            ids_.push(file->id(index));
+        }
+    }
+
+    // Write values into a row and keep its norm (and exact copy) current
+    size_t store(size_t index, const float* values) {
+        if (quantized_) {
+            codec_->encode(values, code(index));
+        } else {
+            std::copy(values, values + dimension_, row(index));
+        }
+        norms_[index] = std::sqrt(DistanceKernels::active().dot(values, values, dimension_));
+        if (full_precision_) {
+            full_precision_->write(index, values);
+        }
+
+        if (codec_ && !quantized_ && ids_.size() >= std::max<size_t>(1, codec_->trainRows())) {
+            quantize();
+        }
+        return index;
+    }
+
+    // Append a zeroed row; the caller pushes its ID
+    size_t appendRow() {
+        size_t index = ids_.size();
+        if (quantized_) {
+            codes_.resize(codes_.size() + code_size_, 0);
+        } else {
+            data_.resize(data_.size() + stride_, 0.0f);
+        }
+        norms_.push_back(0.0f);
+        if (deleted_ > 0) {
+            live_.resize(index + 1, true);
+        }
+        return index;
+    }
+
+    // Fill a removed row with the last one and shrink by one row
+    void removeRow(size_t index) {
+        size_t last = ids_.size() - 1;
+        if (index != last) {
+            if (quantized_) {
+                std::copy(code(last), code(last) + code_size_, code(index));
+            } else {
+                std::copy(row(last), row(last) + stride_, row(index));
+            }
+            if (full_precision_) {
+                full_precision_->move(last, index);
+            }
+            norms_[index] = norms_[last];
+        }
+        if (deleted_ > 0) {
+            if (!live_.test(index)) {
+                --deleted_;
+            }
+            if (live_.test(last)) {
+                live_.set(index);
+            } else {
+                live_.reset(index);
+            }
+            live_.resize(last);
+            if (deleted_ == 0) {
+                live_ = RowBitmap();
+            }
+        }
+
+        ids_.remove(index);
+        attributes_.removeRow(index, last);
+        norms_.pop_back();
+        if (quantized_) {
+            codes_.resize(last * code_size_);
+        } else {
+            data_.resize(last * stride_);
+        }
+    }
+
+public:
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+    // numeric_ids selects unsigned integer IDs (see IdTable)
+    explicit VectorStorage(size_t dimension, bool numeric_ids = false)
+        : dimension_(dimension), stride_(computeStride(dimension)), ids_(numeric_ids) {}
+
+    // Storage with a compressed encoding; full_precision_path, when set, names
+    // the file that keeps exact copies of the vectors
+    VectorStorage(size_t dimension, VectorEncoding encoding, size_t pq_subspaces,
+                  const std::string& full_precision_path, bool numeric_ids = false)
+        : VectorStorage(dimension, numeric_ids) {
+        if (encoding != VectorEncoding::FLOAT32) {
+            codec_ = std::make_unique<VectorCodec>(encoding, dimension, pq_subspaces);
+            code_size_ = codec_->codeSize();
+            if (!full_precision_path.empty()) {
+                full_precision_ = std::make_unique<FullPrecisionFile>(full_precision_path, dimension);
+                if (!full_precision_->good()) {
+                    full_precision_.reset();
+                }
+            }
+        }
+    }
+
+    // View of a mapped database file; the file's stride must match
+    VectorStorage(size_t dimension, std::shared_ptr<const DatabaseFile> file, bool numeric_ids = false)
+        : VectorStorage(dimension, numeric_ids) {
+        if (file->header().dimension != dimension || file->header().stride != stride_) {
+            throw std::invalid_argument("Database file layout does not match the storage dimension");
+        }
+        attributes_ = file->attributes();
+        file_ = std::move(file);
+    }
+
+    size_t dimension() const { return dimension_; }
+    size_t stride() const { return stride_; }
+    // Rows, including tombstoned ones
+    size_t size() const { return file_ ? file_->size() : ids_.size(); }
+    bool empty() const { return size() == 0; }
+    size_t liveSize() const { return size() - deleted_; }
+    size_t deletedCount() const { return deleted_; }
+    bool live(size_t index) const { return deleted_ == 0 || live_.test(index); }
+    // Rows searches may return, or null when no row is tombstoned
+    const RowBitmap* liveRows() const { return deleted_ > 0 ? &live_ : nullptr; }
+
+    // Float rows are only available while !quantized()
+    const float* row(size_t index) const { return (file_ ? file_->rows() : data_.data()) + index * stride_; }
+    float* row(size_t index) { return data_.data() + index * stride_; }  // owned storage only
+    std::string id(size_t index) const { return file_ ? std::string(file_->id(index)) : ids_.id(index); }
+    float norm(size_t index) const { return file_ ? file_->norms()[index] : norms_[index]; }
+    const float* norms() const { return file_ ? file_->norms() : norms_.data(); }
+
+    // Integer ID of a row (numeric storage only)
+    uint64_t numericId(size_t index) const {
+        uint64_t key = 0;
+        if (file_) {
+            IdTable::parseNumber(file_->id(index), key);
+            return key;
+        }
+        return ids_.number(index);
+    }
+
+    bool numericIds() const { return ids_.numeric(); }
+    bool acceptsId(std::string_view id) const { return ids_.accepts(id); }
+
+    std::vector<std::string> ids() const {
+        std::vector<std::string> ids;
+        ids.reserve(liveSize());
+        for (size_t index = 0; index < size(); ++index) {
+            if (live(index)) {
+                ids.emplace_back(id(index));
+            }
+        }
+        return ids;
+    }
+
+    bool mapped() const { return file_ != nullptr; }
+
+    // Attributes live in memory in both modes, so changing them never detaches
+    const AttributeTable& attributes() const { return attributes_; }
+    AttributeTable& attributes() { return attributes_; }
+
+    bool quantized() const { return quantized_; }
+    const VectorCodec* codec() const { return codec_.get(); }
+    const uint8_t* code(size_t index) const { return codes_.data() + index * code_size_; }
+    uint8_t* code(size_t index) { return codes_.data() + index * code_size_; }
+    bool hasFullPrecision() const { return full_precision_ != nullptr; }
+    FullPrecisionFile* fullPrecisionFile() { return full_precision_.get(); }
+
+    // Row values: the float row itself, or the row decoded into scratch
+    const float* vector(size_t index, float* scratch) const {
+        if (!quantized_) {
+            return row(index);
+        }
+        codec_->decode(code(index), scratch);
+        return scratch;
+    }
+
+    // Exact values from memory or the full-precision file; false if only an
+    // approximation was available (the decoded code is written instead)
+    bool copyVector(size_t index, float* out) const {
+        if (!quantized_) {
+            std::copy(row(index), row(index) + dimension_, out);
+            return true;
+        }
+        if (full_precision_ && full_precision_->read(index, out)) {
+            return true;
+        }
+        codec_->decode(code(index), out);
+        return false;
+    }
+
+    size_t find(std::string_view id) const {
+        if (file_) {
+            return ids_.accepts(id) ? file_->find(id, npos) : npos;
+        }
+        return ids_.find(id);
+    }
+
+    // Integer IDs; string storage looks up their decimal form
+    size_t find(uint64_t id) const {
+        if (file_) {
+            return file_->find(std::to_string(id), npos);
+        }
+        return ids_.find(id);
+    }
+
+    void reserve(size_t count) {
+        detach();
+        if (quantized_) {
+            codes_.reserve(count * code_size_);
+        } else {
+            data_.reserve(count * stride_);
+        }
+        norms_.reserve(count);
+        ids_.reserve(count);
+    }
+
+    // Append zeroed rows for new IDs and return the first index; bulk loaders
+    // then fill the values through row() and setNorm(), possibly from several
+    // threads. Uncompressed storage only; Id is std::string or uint64_t.
+    template <typename Id>
+    size_t appendRows(const std::vector<Id>& ids) {
+        detach();
+        size_t first = ids_.size();
+        data_.resize(data_.size() + ids.size() * stride_, 0.0f);
+        norms_.resize(norms_.size() + ids.size(), 0.0f);
+        for (const Id& id : ids) {
+            ids_.push(id);
+        }
+        if (deleted_ > 0) {
+            live_.resize(ids_.size(), true);
+        }
+        return first;
+    }
+
+    void setNorm(size_t index, float norm) { norms_[index] = norm; }
+
+    // Insert or overwrite the vector stored under an ID, returning its row
+    // (acceptsId(id) must hold)
+    size_t put(std::string_view id, const float* values) {
+        detach();
+        size_t index = find(id);
+        if (index == npos) {
+            index = appendRow();
+            ids_.push(id);
+        }
+        return store(index, values);
+    }
+
+    size_t put(uint64_t id, const float* values) {
+        detach();
+        size_t index = find(id);
+        if (index == npos) {
+            index = appendRow();
+            ids_.push(id);
+        }
+        return store(index, values);
+    }
+
+    // Remove an ID, filling its slot with the last row
+    bool remove(std::string_view id) {
+        size_t index = find(id);
+        if (index == npos) {
+            return false;
+        }
+        detach();
+        removeRow(index);
+        return true;
+    }
+
+    bool remove(uint64_t id) {
+        size_t index = find(id);
+        if (index == npos) {
+            return false;
+        }
+        detach();
+        removeRow(index);
+        return true;
+    }
+
+    // Delete a live row in place; its ID can be put again at once (as a new row)
+    void tombstone(size_t index) {
+        detach();
+        if (deleted_ == 0) {
+            live_ = RowBitmap(size(), true);
+        }
+        live_.reset(index);
+        ids_.unlink(index);
+        ++deleted_;
+    }
+
+    // Remove every tombstoned row, calling before_remove(row) ahead of each
+    // removal. Rows are visited from the back, so the last row moved into a
+    // freed slot is always live. Returns the number of rows removed.
+    template <typename BeforeRemove>
+    size_t compact(BeforeRemove&& before_remove) {
+        size_t removed = 0;
+        for (size_t index = size(); deleted_ > 0 && index-- > 0; ) {
+            if (!live_.test(index)) {
+                before_remove(index);
+                removeRow(index);
+                ++removed;
+            }
+        }
+        return removed;
+    }
+
+    void clear() {
+        file_.reset();
+        live_ = RowBitmap();
+        deleted_ = 0;
+        data_.clear();
+        codes_.clear();
+        norms_.clear();
+        ids_.clear();
+        attributes_.clear();
+        if (full_precision_) {
+            full_precision_->clear();
+        }
+    }
+
+    // Bytes held in memory by the vectors (slab or codes, codec parameters)
+    // and cached norms, excluding ID tables
+    size_t vectorBytes() const {
+        return data_.size() * sizeof(float) + codes_.size() + norms_.size() * sizeof(float) +
+               (codec_ ? codec_->memoryBytes() : 0);
+    }
+
+    // Bytes held by the in-memory ID table (none while mapped)
+    size_t idBytes() const { return ids_.memoryBytes(); }
+
+    // Bytes of the mapped file backing a read-only storage (in the page cache,
+    // not the process heap)
+    size_t mappedBytes() const { return file_ ? file_->mappedBytes() : 0; }
+};
+
+// The file is written beside the target and renamed over it once complete, so
+// a crash never leaves a torn file and a mapping of the old file stays valid
+inline bool DatabaseFile::write(const std::string& path, const VectorStorage& storage, DistanceMetric metric) {
+    auto align = [](uint64_t offset, uint64_t alignment) { return (offset + alignment - 1) / alignment * alignment; };
+    const uint64_t stride = storage.stride();
+
+    // Only live rows are written; tombstoned ones are dropped on the way out
+    std::vector<size_t> live_rows;
+    if (const RowBitmap* live = storage.liveRows()) {
+        live_rows.reserve(storage.liveSize());
+        live->forEach(0, storage.size(), [&](size_t row) { live_rows.push_back(row); });
+    }
+    const bool compacting = storage.liveRows() != nullptr;
+    const uint64_t count = compacting ? live_rows.size() : storage.size();
+    auto source_row = [&](size_t row) { return compacting ? live_rows[row] : row; };
+
+    DatabaseFileHeader header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.header_bytes = sizeof(DatabaseFileHeader);
+    header.byte_order = kByteOrder;
+    header.distance_metric = static_cast<uint32_t>(metric);
+    header.dimension = storage.dimension();
+    header.stride = stride;
+    header.count = count;
+    header.id_slot_count = 1;
+    while (header.id_slot_count < count * 2) {
+        header.id_slot_count *= 2;
+    }
+
+    std::vector<uint64_t> id_offsets(count + 1, 0);
+    std::vector<uint64_t> id_slots(header.id_slot_count, 0);
+    const uint64_t mask = header.id_slot_count - 1;
+    for (size_t row = 0; row < count; ++row) {
+        const std::string id = storage.id(source_row(row));
+        id_offsets[row + 1] = id_offsets[row] + id.size();
+        uint64_t slot = hashId(id.data(), id.size()) & mask;
+        while (id_slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        id_slots[slot] = row + 1;
+    }
+
+    header.vectors_offset = kPageBytes;
+    header.norms_offset = align(header.vectors_offset + count * stride * sizeof(float), kSectionAlignment);
+    header.id_offsets_offset = align(header.norms_offset + count * sizeof(float), kSectionAlignment);
+    header.id_slots_offset = align(header.id_offsets_offset + id_offsets.size() * sizeof(uint64_t), kSectionAlignment);
+    header.strings_offset = align(header.id_slots_offset + id_slots.size() * sizeof(uint64_t), kSectionAlignment);
+    header.strings_bytes = id_offsets[count];
+    std::vector<char> attributes;
+    if (!storage.attributes().empty()) {
+        storage.attributes().serialize(attributes, compacting ? &live_rows : nullptr);
+    }
+    header.attributes_offset = align(header.strings_offset + header.strings_bytes, kSectionAlignment);
+    header.attributes_bytes = attributes.size();
+    header.file_bytes = header.attributes_offset + header.attributes_bytes;
+
+    const std::string temp_path = path + ".tmp";
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Error: Cannot open file for writing: " << temp_path << std::endl;
+        return false;
+    }
+
+    auto pad_to = [&](uint64_t offset) {
+        static const char zeros[kPageBytes] = {};
+        while (file.good() && static_cast<uint64_t>(file.tellp()) < offset) {
+            uint64_t gap = offset - static_cast<uint64_t>(file.tellp());
+            file.write(zeros, static_cast<std::streamsize>(std::min<uint64_t>(gap, sizeof(zeros))));
+        }
+    };
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    pad_to(header.vectors_offset);
+
+    // Rows go out in their padded layout (decoded to floats if quantized)
+    std::vector<float> row_buffer(stride, 0.0f);
+    for (size_t row = 0; row < count && file.good(); ++row) {
+        const float* values = storage.row(source_row(row));
+        if (storage.quantized()) {
+            storage.copyVector(source_row(row), row_buffer.data());
+            values = row_buffer.data();
+        }
+        file.write(reinterpret_cast<const char*>(values), static_cast<std::streamsize>(stride * sizeof(float)));
+    }
+    pad_to(header.norms_offset);
+    if (compacting) {
+        std::vector<float> norms(count);
+        for (size_t row = 0; row < count; ++row) {
+            norms[row] = storage.norm(source_row(row));
+        }
+        file.write(reinterpret_cast<const char*>(norms.data()), static_cast<std::streamsize>(count * sizeof(float)));
+    } else {
+        file.write(reinterpret_cast<const char*>(storage.norms()), static_cast<std::streamsize>(count * sizeof(float)));
+    }
+    pad_to(header.id_offsets_offset);
+    file.write(reinterpret_cast<const char*>(id_offsets.data()),
+               static_cast<std::streamsize>(id_offsets.size() * sizeof(uint64_t)));
+    pad_to(header.id_slots_offset);
+    file.write(reinterpret_cast<const char*>(id_slots.data()),
+               static_cast<std::streamsize>(id_slots.size() * sizeof(uint64_t)));
+    pad_to(header.strings_offset);
+    for (size_t row = 0; row < count && file.good(); ++row) {
+        const std::string id = storage.id(source_row(row));
+        file.write(id.data(), static_cast<std::streamsize>(id.size()));
+    }
+    pad_to(header.attributes_offset);
+    file.write(attributes.data(), static_cast<std::streamsize>(attributes.size()));
+    file.close();
+
+    if (!file) {
+        std::cerr << "Error: Failed to write database file: " << temp_path << std::endl;
+        std::remove(temp_path.c_str());
+        return false;
+    }
+#if defined(_WIN32)
+    // std::rename does not replace an existing file on Windows
+    bool replaced = MoveFileExA(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool replaced = std::rename(temp_path.c_str(), path.c_str()) == 0;
+#endif
+    if (!replaced) {
+        std::cerr << "Error: Cannot replace database file: " << path << std::endl;
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Append-only log of database writes. A file starts with a header (magic,
+// version, byte order, dimension) followed by records of
+//   [u32 payload bytes][u32 CRC-32 of payload][payload]
+// where the payload is an op byte, then for PUT, REMOVE and ATTRIBUTES the
+// u32 ID length and ID bytes, then for PUT the vector's floats and for
+// ATTRIBUTES (version 2) the AttributeTable::encode() form of the values set.
+// Replay stops at the first short or corrupt record, which is the tail of a
+// write torn by a crash.
+//
+// Writers encode records into a buffer under a short mutex; commit() hands
+// the buffer to the file. While one caller writes and fsyncs, others queue
+// their records and then share a single write for all of them (group commit).
+class WriteAheadLog {
+public:
+    enum class Op : uint8_t { PUT = 1, REMOVE = 2, CLEAR = 3, ATTRIBUTES = 4 };
+    
+    static constexpr char kMagic[8] = {'V', 'E', 'C', 'T', 'O', 'W', 'A', 'L'};
+    static constexpr uint32_t kVersion = 2;
+    static constexpr size_t kHeaderBytes = sizeof(kMagic) + 2 * sizeof(uint32_t) + sizeof(uint64_t);
+    // Longest record payload replay accepts besides the vector; a longer
+    // length field can only come from a torn or corrupt record
+    static constexpr uint64_t kMaxRecordBytes = uint64_t(64) << 20;
+    
+private:
+    std::string path_;
+    size_t dimension_;
+    std::FILE* file_ = nullptr;
+    std::mutex mutex_;
+    std::condition_variable committed_;
+    std::vector<char> buffer_;   // records not yet written to the file
+    uint64_t next_lsn_ = 1;      // sequence number of the next record
+    uint64_t written_lsn_ = 0;   // records handed to the OS
+    uint64_t durable_lsn_ = 0;   // records forced to stable storage
+    bool committing_ = false;    // a caller is writing outside the mutex
+    bool failed_ = false;
+    uint64_t bytes_ = 0;         // file size including buffered records
+    
+    static uint32_t crc32(const char* data, size_t length) {
+        static const auto table = [] {
+            std::array<uint32_t, 256> entries{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int bit = 0; bit < 8; ++bit) {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                entries[i] = c;
+            }
+            return entries;
+        }();
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < length; ++i) {
+            crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+    
+    template <typename T>
+    static void put(std::vector<char>& out, const T& value) {
+        const char* bytes = reinterpret_cast<const char*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+    
+    bool openFile(uint64_t valid_bytes) {
+        if (valid_bytes >= kHeaderBytes) {
+            // Drop a torn tail so new records follow the last intact one
+            std::error_code error;
+            std::filesystem::resize_file(path_, valid_bytes, error);
+            file_ = error ? nullptr : std::fopen(path_.c_str(), "ab");
+            bytes_ = valid_bytes;
+            return file_ != nullptr;
+        }
+        file_ = std::fopen(path_.c_str(), "wb");
+        if (file_ == nullptr) {
+            return false;
+        }
+        std::vector<char> header(kMagic, kMagic + sizeof(kMagic));
+        put(header, kVersion);
+        put(header, DatabaseFile::kByteOrder);
+        put(header, static_cast<uint64_t>(dimension_));
+        bytes_ = header.size();
+        return std::fwrite(header.data(), 1, header.size(), file_) == header.size() && std::fflush(file_) == 0;
+    }
+    
+    bool syncFile() {
+        if (std::fflush(file_) != 0) {
+            return false;
+        }
+#if defined(_WIN32)
+        return _commit(_fileno(file_)) == 0;
+#else
+        return ::fsync(::fileno(file_)) == 0;
+#endif
+    }
+    
+    uint64_t append(Op op, const std::string_view* id, const float* values,
+                    const Attributes* attributes = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t start = buffer_.size();
+        buffer_.resize(start + 2 * sizeof(uint32_t));
+        buffer_.push_back(static_cast<char>(op));
+        if (id != nullptr) {
+            put(buffer_, static_cast<uint32_t>(id->size()));
+            buffer_.insert(buffer_.end(), id->begin(), id->end());
+        }
+        if (values != nullptr) {
+            const char* bytes = reinterpret_cast<const char*>(values);
+            buffer_.insert(buffer_.end(), bytes, bytes + dimension_ * sizeof(float));
+        }
+        if (attributes != nullptr) {
+            AttributeTable::encode(*attributes, buffer_);
+        }
+        uint32_t payload_bytes = static_cast<uint32_t>(buffer_.size() - start - 2 * sizeof(uint32_t));
+        uint32_t checksum = crc32(buffer_.data() + start + 2 * sizeof(uint32_t), payload_bytes);
+        std::memcpy(buffer_.data() + start, &payload_bytes, sizeof(payload_bytes));
+        std::memcpy(buffer_.data() + start + sizeof(payload_bytes), &checksum, sizeof(checksum));
+        bytes_ += buffer_.size() - start;
+        return next_lsn_++;
+    }
+    
+public:
+    // Open for appending after the first valid_bytes of an existing log (as
+    // reported by replay()), or start a new log when valid_bytes is 0
+    WriteAheadLog(const std::string& path, size_t dimension, uint64_t valid_bytes = 0)
+        : path_(path), dimension_(dimension) {
+        if (!openFile(valid_bytes)) {
+            throw std::runtime_error("Cannot open write-ahead log: " + path);
+        }
+    }
+    
+    ~WriteAheadLog() {
+        commit(std::numeric_limits<uint64_t>::max(), true);
+        std::fclose(file_);
+    }
+    
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+    
+    // Record a write and return its sequence number; nothing is written to
+    // the file until commit()
+    uint64_t appendPut(std::string_view id, const float* values) { return append(Op::PUT, &id, values); }
+    uint64_t appendRemove(std::string_view id) { return append(Op::REMOVE, &id, nullptr); }
+    uint64_t appendAttributes(std::string_view id, const Attributes& attributes) {
+        return append(Op::ATTRIBUTES, &id, nullptr, &attributes);
+    }
+    uint64_t appendClear() { return append(Op::CLEAR, nullptr, nullptr); }
+    
+    // Make records up to lsn reach the file, and stable storage if sync is
+    // set. Returns false if the log could not be written.
+    bool commit(uint64_t lsn, bool sync) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        lsn = std::min(lsn, next_lsn_ - 1);
+        while ((sync ? durable_lsn_ : written_lsn_) < lsn && !failed_) {
+            if (committing_) {
+                committed_.wait(lock);
+                continue;
+            }
+            
+            committing_ = true;
+            std::vector<char> pending;
+            pending.swap(buffer_);
+            uint64_t target = next_lsn_ - 1;
+            lock.unlock();
+            
+            bool ok = pending.empty() || std::fwrite(pending.data(), 1, pending.size(), file_) == pending.size();
+            ok = ok && (sync ? syncFile() : std::fflush(file_) == 0);
+            
+            lock.lock();
+            committing_ = false;
+            if (ok) {
+                written_lsn_ = target;
+                if (sync) {
+                    durable_lsn_ = target;
+                }
+            } else {
+                std::cerr << "Error: Failed to write write-ahead log: " << path_ << std::endl;
+                failed_ = true;
+            }
+            committed_.notify_all();
+        }
+        return !failed_;
+    }
+    
+    bool commitAll(bool sync) { return commit(std::numeric_limits<uint64_t>::max(), sync); }
+    
+    // Seal the log under frozen_path and continue in a fresh file at path()
+    bool rotate(const std::string& frozen_path) {
+        if (!commitAll(true)) {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        committed_.wait(lock, [this] { return !committing_; });
+        // Records appended since the commit above go to the old file
+        bool ok = buffer_.empty() || std::fwrite(buffer_.data(), 1, buffer_.size(), file_) == buffer_.size();
+        ok = syncFile() && ok;
+        buffer_.clear();
+        std::fclose(file_);
+        file_ = nullptr;
+        std::error_code error;
+        std::filesystem::rename(path_, frozen_path, error);
+        if (!ok || error || !openFile(0)) {
+            std::cerr << "Error: Cannot rotate write-ahead log: " << path_ << std::endl;
+            if (file_ == nullptr) {
+                file_ = std::fopen(path_.c_str(), "ab");
+            }
+            failed_ = failed_ || file_ == nullptr;
+            return false;
+        }
+        written_lsn_ = durable_lsn_ = next_lsn_ - 1;
+        return true;
+    }
+    
+    const std::string& path() const { return path_; }
+    
+    uint64_t bytes() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bytes_;
+    }
+    
+    // Apply every intact record of the log at path, in order. A missing file
+    // replays nothing. valid_bytes receives the length of the intact prefix.
+    // Returns false if the file is not a log for this dimension.
+    static bool replay(const std::string& path, size_t dimension,
+                       const std::function<void(Op, const std::string&, const float*, const Attributes&)>& apply,
+                       uint64_t* valid_bytes = nullptr) {
+        if (valid_bytes != nullptr) {
+            *valid_bytes = 0;
+        }
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return true;
+        }
+        
+        char header[kHeaderBytes];
+        if (!file.read(header, sizeof(header))) {
+            // A crash while creating the log leaves a partial header
+            return true;
+        }
+        uint32_t version, byte_order;
+        uint64_t file_dimension;
+        std::memcpy(&version, header + sizeof(kMagic), sizeof(version));
+        std::memcpy(&byte_order, header + sizeof(kMagic) + sizeof(version), sizeof(byte_order));
+        std::memcpy(&file_dimension, header + sizeof(kMagic) + 2 * sizeof(uint32_t), sizeof(file_dimension));
+        if (std::memcmp(header, kMagic, sizeof(kMagic)) != 0 || version > kVersion ||
+            byte_order != DatabaseFile::kByteOrder || file_dimension != dimension) {
+            std::cerr << "Error: Not a write-ahead log for " << dimension << "-dimensional vectors: " << path
+                      << std::endl;
+            return false;
+        }
+        
+        std::error_code error;
+        const uint64_t file_bytes = std::filesystem::file_size(path, error);
+        if (error) {
+            std::cerr << "Error: Cannot read write-ahead log: " << path << std::endl;
+            return false;
+        }
+        
+        uint64_t offset = kHeaderBytes;
+        std::vector<char> payload;
+        std::string id;
+        std::vector<float> values(dimension);
+        Attributes attributes;
+        const size_t vector_bytes = dimension * sizeof(float);
+        for (;;) {
+            uint32_t frame[2];
+            if (!file.read(reinterpret_cast<char*>(frame), sizeof(frame))) {
+                break;
+            }
+            // Check the length before allocating for it: a torn length can
+            // claim up to 4 GB, more than the file or any record holds
+            const uint64_t left = file_bytes - std::min(file_bytes, offset + sizeof(frame));
+            if (frame[0] == 0 || frame[0] > left || frame[0] > kMaxRecordBytes + vector_bytes) {
+                break;
+            }
+            payload.resize(frame[0]);
+            if (!file.read(payload.data(), frame[0]) || crc32(payload.data(), frame[0]) != frame[1]) {
+                break;
+            }
+            
+            Op op = static_cast<Op>(payload[0]);
+            uint32_t id_length = 0;
+            bool valid = op == Op::CLEAR ? frame[0] == 1 : frame[0] >= 1 + sizeof(id_length);
+            if (valid && op != Op::CLEAR) {
+                std::memcpy(&id_length, payload.data() + 1, sizeof(id_length));
+                size_t header_bytes = 1 + sizeof(id_length) + id_length;
+                if (op == Op::ATTRIBUTES) {
+                    valid = frame[0] >= header_bytes &&
+                            AttributeTable::decode(payload.data() + header_bytes, frame[0] - header_bytes, attributes);
+                } else {
+                    size_t expected = header_bytes + (op == Op::PUT ? vector_bytes : 0);
+                    valid = (op == Op::PUT || op == Op::REMOVE) && frame[0] == expected;
+                }
+            }
+            if (!valid) {
+                break;
+            }
+            if (op != Op::CLEAR) {
+                id.assign(payload.data() + 1 + sizeof(id_length), id_length);
+            }
+            if (op == Op::PUT) {
+                std::memcpy(values.data(), payload.data() + 1 + sizeof(id_length) + id_length, vector_bytes);
+            }
+            apply(op, id, values.data(), attributes);
+            offset += sizeof(frame) + frame[0];
+        }
+        
+        if (valid_bytes != nullptr) {
+            *valid_bytes = offset;
+        }
+        return true;
+    }
+};
+
+// Sequential reader for bulk import files of little-endian float32 (or NPY
+// float16) vectors (see ImportFormat). It hands out chunks of whole records; parse() checks
+// and converts one record and is safe to call from several threads at once.
+class VectorFileReader {
+private:
+    std::ifstream file_;
+    ImportFormat format_ = ImportFormat::FBIN;
+    size_t dimension_ = 0;
+    size_t count_ = 0;
+    size_t prefix_bytes_ = 0;  // FVECS: the per-record dimension
+    size_t element_bytes_ = sizeof(float);  // NPY float16: 2
+    size_t record_bytes_ = 0;
+    size_t rows_read_ = 0;
+    
+    bool fail(const std::string& path, const std::string& reason) {
+        std::cerr << "Error: Cannot import " << path << ": " << reason << std::endl;
+        return false;
+    }
+    
+    // Value text following 'key': in a .npy header dictionary
+    static std::string npyField(const std::string& header, const std::string& key) {
+        size_t at = header.find("'" + key + "'");
+        if (at == std::string::npos || (at = header.find(':', at)) == std::string::npos) {
+            return {};
+        }
+        size_t begin = header.find_first_not_of(' ', at + 1);
+        if (begin == std::string::npos) {
+            return {};
+        }
+        size_t end = header[begin] == '(' ? header.find(')', begin) + 1 : header.find_first_of(",}", begin);
+        return end == std::string::npos || end == 0 ? std::string() : header.substr(begin, end - begin);
+    }
+    
+    bool readNpyHeader(const std::string& path) {
+        char preamble[8];
+        if (!file_.read(preamble, sizeof(preamble)) || std::memcmp(preamble, "\x93NUMPY", 6) != 0) {
+            return fail(path, "not a .npy file");
+        }
+        uint32_t header_bytes = 0;
+        if (preamble[6] == 1) {
+            uint16_t length = 0;
+            file_.read(reinterpret_cast<char*>(&length), sizeof(length));
+            header_bytes = length;
+        } else {
+            file_.read(reinterpret_cast<char*>(&header_bytes), sizeof(header_bytes));
+        }
+        std::string header(header_bytes, '\0');
+        if (!file_.read(&header[0], header_bytes)) {
+            return fail(path, "truncated .npy header");
+        }
+        
+        std::string descr = npyField(header, "descr");
+        if (descr == "'<f2'" || descr == "'|f2'") {
+            element_bytes_ = sizeof(uint16_t);
+        } else if (descr != "'<f4'" && descr != "'|f4'") {
+            return fail(path, "only float32 and float16 .npy arrays are supported (descr " + descr + ")");
+        }
+        if (npyField(header, "fortran_order") != "False") {
+            return fail(path, "Fortran-order .npy arrays are not supported");
+        }
+        unsigned long long rows = 0, columns = 0;
+        if (std::sscanf(npyField(header, "shape").c_str(), "(%llu, %llu)", &rows, &columns) != 2) {
+            return fail(path, "expected a two-dimensional .npy array");
+        }
+        count_ = static_cast<size_t>(rows);
+        dimension_ = static_cast<size_t>(columns);
+        return true;
+    }
+    
+public:
+    bool open(const std::string& path, ImportFormat format) {
+        uint32_t probe = 1;
+        if (*reinterpret_cast<unsigned char*>(&probe) != 1) {
+            return fail(path, "import files are little-endian and this host is not");
+        }
+        if (format == ImportFormat::AUTO) {
+            auto ends_with = [&](const char* suffix) {
+                size_t length = std::strlen(suffix);
+                return path.size() >= length && path.compare(path.size() - length, length, suffix) == 0;
+            };
+            format = ends_with(".fvecs") ? ImportFormat::FVECS
+                     : ends_with(".npy") ? ImportFormat::NPY
+                                         : ImportFormat::FBIN;
+        }
+        format_ = format;
+        
+        file_.open(path, std::ios::binary);
+        if (!file_.is_open()) {
+            return fail(path, "cannot open file");
+        }
+        file_.seekg(0, std::ios::end);
+        const uint64_t file_bytes = static_cast<uint64_t>(file_.tellg());
+        file_.seekg(0);
+        
+        if (format_ == ImportFormat::FBIN) {
+            uint32_t header[2];
+            if (!file_.read(reinterpret_cast<char*>(header), sizeof(header))) {
+                return fail(path, "truncated header");
+            }
+            count_ = header[0];
+            dimension_ = header[1];
+        } else if (format_ == ImportFormat::FVECS) {
+            int32_t dimension = 0;
+            if (file_bytes > 0 && (!file_.read(reinterpret_cast<char*>(&dimension), sizeof(dimension)) || dimension <= 0)) {
+                return fail(path, "bad fvecs record header");
+            }
+            file_.seekg(0);
+            dimension_ = static_cast<size_t>(dimension);
+            prefix_bytes_ = sizeof(int32_t);
+        } else if (!readNpyHeader(path)) {
+            return false;
+        }
+        
+        record_bytes_ = prefix_bytes_ + dimension_ * element_bytes_;
+        const uint64_t data_bytes = file_bytes - static_cast<uint64_t>(file_.tellg());
+        if (format_ == ImportFormat::FVECS) {
+            if (record_bytes_ > 0 && data_bytes % record_bytes_ != 0) {
+                return fail(path, "size is not a whole number of fvecs records");
+            }
+            count_ = record_bytes_ > 0 ? static_cast<size_t>(data_bytes / record_bytes_) : 0;
+        } else if (dimension_ == 0 || data_bytes / record_bytes_ < count_) {
+            return fail(path, "file is shorter than its header declares");
+        }
+        return true;
+    }
+    
+    size_t dimension() const { return dimension_; }
+    size_t size() const { return count_; }
+    size_t recordBytes() const { return record_bytes_; }
+    
+    // Read the next records, at most rows, into buffer (resized to fit)
+    bool read(std::vector<char>& buffer, size_t rows) {
+        rows = std::min(rows, count_ - rows_read_);
+        buffer.resize(rows * record_bytes_);
+        file_.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        rows_read_ += rows;
+        return static_cast<bool>(file_);
+    }
+    
+    // Copy a record's floats to out; false if the record is malformed (FVECS
+    // dimension header) or holds NaN or infinity
+    bool parse(const char* record, float* out) const {
+        if (prefix_bytes_ != 0) {
+            int32_t dimension;
+            std::memcpy(&dimension, record, sizeof(dimension));
+            if (static_cast<size_t>(dimension) != dimension_) {
+                return false;
+            }
+        }
+        if (element_bytes_ == sizeof(uint16_t)) {
+            DistanceKernels::active().half_to_float(reinterpret_cast<const uint8_t*>(record), out, dimension_);
+        } else {
+            std::memcpy(out, record + prefix_bytes_, dimension_ * sizeof(float));
+        }
+        for (size_t d = 0; d < dimension_; ++d) {
+            if (!std::isfinite(out[d])) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Per-query distance evaluator for a metric fixed at compile time. The
+// kernel and the query norm are resolved once; cosine uses the cached row
+// norms so each candidate costs a single dot product.
+template <DistanceMetric Metric>
+struct RowDistance {
+    DistanceKernels::Kernel kernel;
+    DistanceKernels::BoundedKernel bounded_kernel;
+    const float* query;
+    size_t dimension;
+    const float* norms;
+    float query_norm;
+    
+    RowDistance(const DistanceKernels& kernels, const VectorStorage& storage, const float* query_vector)
+        : RowDistance(kernels, storage, query_vector, -1.0f) {}
+    
+    // Query norm supplied by the caller when already known (negative = compute)
+    RowDistance(const DistanceKernels& kernels, const VectorStorage& storage, const float* query_vector, float known_norm)
+        : bounded_kernel(nullptr), query(query_vector), dimension(storage.dimension()), norms(storage.norms()),
+          query_norm(0.0f) {
+        switch (Metric) {
+            case DistanceMetric::COSINE:
+            case DistanceMetric::DOT_PRODUCT:
+                kernel = kernels.dot;
+                break;
+            case DistanceMetric::MANHATTAN:
+                kernel = kernels.l1;
+                bounded_kernel = kernels.l1_bounded;
+                break;
+            default:
+                kernel = kernels.l2_squared;
+                bounded_kernel = kernels.l2_squared_bounded;
+                break;
+        }
+        if (Metric == DistanceMetric::COSINE) {
+            query_norm = known_norm >= 0.0f ? known_norm : std::sqrt(kernels.dot(query, query, dimension));
+        }
+    }
+    
+    float operator()(size_t row, const float* candidate) const {
+        return withNorm(candidate, Metric == DistanceMetric::COSINE ? norms[row] : 0.0f);
+    }
+    
+    // Distance for a caller that discards anything beyond bound (a top-k
+    // threshold or search radius). Euclidean and Manhattan stop summing once
+    // the bound is exceeded and return infinity; values within it are exact.
+    float bounded(size_t row, const float* candidate, float bound) const {
+        return boundedWithNorm(candidate, Metric == DistanceMetric::COSINE ? norms[row] : 0.0f, bound);
+    }
+    
+    float boundedWithNorm(const float* candidate, float candidate_norm, float bound) const {
+        if (!bounded_kernel || !(bound < std::numeric_limits<float>::infinity())) {
+            return withNorm(candidate, candidate_norm);
+        }
+        if (Metric == DistanceMetric::MANHATTAN) {
+            float sum = bounded_kernel(query, candidate, dimension, bound);
+            return sum > bound ? std::numeric_limits<float>::infinity() : sum;
+        }
+        // Compared in squared space; the slack of a few ulps keeps rounding in
+        // the square and the root from rejecting a row the exact path keeps
+        const float squared_bound = bound * bound * (1.0f + 4.0f * std::numeric_limits<float>::epsilon());
+        float sum = bounded_kernel(query, candidate, dimension, squared_bound);
+        return sum > squared_bound ? std::numeric_limits<float>::infinity() : std::sqrt(sum);
+    }
+    
+    // Distance to a vector outside the storage slab, given its L2 norm
+    float withNorm(const float* candidate, float candidate_norm) const {
+        switch (Metric) {
+            case DistanceMetric::EUCLIDEAN:
+                return std::sqrt(kernel(query, candidate, dimension));
+            case DistanceMetric::COSINE: {
+                float denominator = query_norm * candidate_norm;
+                if (denominator == 0.0f) return 1.0f;
+                return 1.0f - kernel(query, candidate, dimension) / denominator;
+            }
+            case DistanceMetric::DOT_PRODUCT:
+                return -kernel(query, candidate, dimension);
+            default:
+                return kernel(query, candidate, dimension);
+        }
+    }
+};
+
+// Per-query distance to encoded rows of a quantized storage. PQ rows are
+// scored from the asymmetric distance table built once per query; FP16, BF16
+// and INT8 rows are decoded into a scratch buffer and measured with the exact
+// kernels. Distances are approximate.
+template <DistanceMetric Metric>
+class CodeDistance {
+private:
+    const VectorStorage& storage_;
+    const VectorCodec& codec_;
+    RowDistance<Metric> decoded_;
+    std::vector<float> table_;
+    mutable std::vector<float> scratch_;
+    float query_norm_;
+
+public:
+    CodeDistance(const DistanceKernels& kernels, const VectorStorage& storage, const float* query)
+        : storage_(storage), codec_(*storage.codec()), decoded_(kernels, storage, query),
+          query_norm_(std::sqrt(kernels.dot(query, query, storage.dimension()))) {
+        if (codec_.encoding() == VectorEncoding::PQ) {
+            table_.resize(codec_.tableSize());
+            codec_.buildTable(Metric, query, table_.data());
+        } else {
+            scratch_.resize(storage.dimension());
+        }
+    }
+
+    // bound as for RowDistance::bounded; PQ table sums ignore it
+    float operator()(size_t row, float bound = std::numeric_limits<float>::infinity()) const {
+        if (table_.empty()) {
+            codec_.decode(storage_.code(row), scratch_.data());
+            return decoded_.boundedWithNorm(scratch_.data(), storage_.norm(row), bound);
+        }
+
+        float sum = codec_.tableSum(table_.data(), storage_.code(row));
+        switch (Metric) {
+            case DistanceMetric::EUCLIDEAN:
+                return std::sqrt(std::max(0.0f, sum));
+            case DistanceMetric::COSINE: {
+                // Normalize by the reconstruction rather than the exact norm:
+                // the angle to the reconstruction errs far less than the dot
+                float denominator = query_norm_ * codec_.reconstructedNorm(storage_.code(row));
+                return denominator == 0.0f ? 1.0f : 1.0f - sum / denominator;
+            }
+            case DistanceMetric::DOT_PRODUCT:
+                return -sum;
+            default:
+                return sum;
+        }
+    }
+};
+
+// Invoke fn with a (row[, bound]) -> distance callable for the storage's live
+// form, resolving float vs encoded rows once per query instead of once per row
+template <DistanceMetric Metric, typename Fn>
+decltype(auto) withRowDistance(const DistanceKernels& kernels, const VectorStorage& storage,
+                               const float* query, Fn&& fn) {
+    if (storage.quantized()) {
+        const CodeDistance<Metric> distance_to(kernels, storage, query);
+        return fn(distance_to);
+    }
+    const RowDistance<Metric> exact(kernels, storage, query);
+    return fn([&](size_t row, float bound = std::numeric_limits<float>::infinity()) {
+        return exact.bounded(row, storage.row(row), bound);
+    });
+}
+
+// Distance from a precomputed dot product and norms. EUCLIDEAN returns the
+// squared distance ||q||^2 + ||b||^2 - 2q.b, which preserves ranking.
+template <DistanceMetric Metric>
+float distanceFromDot(float dot, float query_norm, float row_norm) {
+    switch (Metric) {
+        case DistanceMetric::COSINE: {
+            float denominator = query_norm * row_norm;
+            return denominator == 0.0f ? 1.0f : 1.0f - dot / denominator;
+        }
+        case DistanceMetric::DOT_PRODUCT:
+            return -dot;
+        default:
+            return std::max(0.0f, query_norm * query_norm + row_norm * row_norm - 2.0f * dot);
+    }
+}
+
+// Invoke fn with a runtime metric as a compile-time constant
+template <typename Fn>
+decltype(auto) dispatchMetric(DistanceMetric metric, Fn&& fn) {
+    switch (metric) {
+        case DistanceMetric::COSINE:
+            return fn(std::integral_constant<DistanceMetric, DistanceMetric::COSINE>());
+        case DistanceMetric::MANHATTAN:
+            return fn(std::integral_constant<DistanceMetric, DistanceMetric::MANHATTAN>());
+        case DistanceMetric::DOT_PRODUCT:
+            return fn(std::integral_constant<DistanceMetric, DistanceMetric::DOT_PRODUCT>());
+        default:
+            return fn(std::integral_constant<DistanceMetric, DistanceMetric::EUCLIDEAN>());
+    }
+}
+
+// Work done by searches on the current thread: distance evaluations, and
+// index nodes visited (KD-tree nodes, HNSW nodes expanded, IVF lists or LSH
+// buckets probed). Plain thread-local counters, so counting costs one
+// increment; the database folds in the counts of its worker threads and
+// records them per search.
+struct SearchWork {
+    uint64_t distances = 0;
+    uint64_t nodes = 0;
+    
+    static SearchWork& local() {
+        thread_local SearchWork work;
+        return work;
+    }
+    
+    SearchWork& operator+=(const SearchWork& other) {
+        distances += other.distances;
+        nodes += other.nodes;
+        return *this;
+    }
+    
+    // Run fn and return the work it did on this thread, leaving the thread's
+    // own counters as they were
+    template <typename Fn>
+    static SearchWork measure(Fn&& fn) {
+        SearchWork saved = local();
+        local() = SearchWork();
+        fn();
+        SearchWork done = local();
+        local() = saved;
+        return done;
+    }
+};
+
+// Internal candidate: storage row and distance, cheap to copy while scanning
+struct RowHit {
+    size_t row;
+    float distance;
+    
+    // Ascending distance order, for sorting and partial selection
+    bool operator<(const RowHit& other) const {
+        return distance < other.distance;
+    }
+};
+
+inline void sortHits(std::vector<RowHit>& hits) {
+    std::sort(hits.begin(), hits.end(),
+              [](const RowHit& a, const RowHit& b) {
+                  return a.distance < b.distance;
+              });
+}
+
+// Bounded selection of the k closest candidates of a scan. The distance a
+// candidate must beat is cached in threshold(), so most rows of a scan are
+// rejected with one compare; callers with a lower bound on a distance (such
+// as the KD-tree) can prune against it too. Up to kSortedMaxK the kept hits
+// are a sorted buffer maintained by insertion. Larger k appends accepted
+// candidates to a buffer of 2k and partially selects the best k whenever it
+// fills, instead of sifting a heap for every accepted candidate.
+class TopKCollector {
+private:
+    static constexpr size_t kSortedMaxK = 32;
+
+    size_t k_ = 0;
+    float threshold_ = std::numeric_limits<float>::infinity();
+    std::vector<RowHit> hits_;
+
+    bool sorted() const { return k_ <= kSortedMaxK; }
+
+    // Keep the k closest of the buffer; the k-th becomes the threshold
+    void select() {
+        std::nth_element(hits_.begin(), hits_.begin() + (k_ - 1), hits_.end());
+        hits_.resize(k_);
+        threshold_ = hits_.back().distance;
+    }
+
+public:
+    // expected_rows, if known, bounds the memory reserved up front
+    explicit TopKCollector(size_t k, size_t expected_rows = std::numeric_limits<size_t>::max()) { reset(k, expected_rows); }
+
+    // Start a new selection, keeping the buffer for reuse
+    void reset(size_t k, size_t expected_rows = std::numeric_limits<size_t>::max()) {
+        k_ = k;
+        threshold_ = k == 0 ? -std::numeric_limits<float>::infinity() : std::numeric_limits<float>::infinity();
+        hits_.clear();
+        hits_.reserve(std::min(sorted() ? k : 2 * k, expected_rows));
+    }
+
+    size_t k() const { return k_; }
+
+    // Candidates at or beyond this distance cannot enter the result
+    float threshold() const { return threshold_; }
+
+    void push(size_t row, float distance) {
+        if (!(distance < threshold_)) {
+            return;
+        }
+        if (!sorted()) {
+            hits_.push_back({row, distance});
+            if (hits_.size() == 2 * k_) {
+                select();
+            }
+            return;
+        }
+        if (hits_.size() == k_) {
+            hits_.pop_back();
+        }
+        // Equal distances keep their arrival order, as a heap would not
+        auto at = std::upper_bound(hits_.begin(), hits_.end(), distance,
+                                   [](float value, const RowHit& hit) { return value < hit.distance; });
+        hits_.insert(at, {row, distance});
+        if (hits_.size() == k_) {
+            threshold_ = hits_.back().distance;
+        }
+    }
+
+    void push(const RowHit& hit) { push(hit.row, hit.distance); }
+
+    // The kept hits sorted by distance; the collector is left empty
+    std::vector<RowHit> take() {
+        if (!sorted()) {
+            if (hits_.size() > k_) {
+                select();
+            }
+            std::sort(hits_.begin(), hits_.end());
+        }
+        std::vector<RowHit> hits = std::move(hits_);
+        reset(k_, 0);
+        return hits;
+    }
+};
+
+// Keep the k closest hits of several partial results, sorted by distance
+inline std::vector<RowHit> mergeTopK(const std::vector<std::vector<RowHit>>& partial, size_t k) {
+    size_t total = 0;
+    for (const auto& hits : partial) {
+        total += hits.size();
+    }
+    TopKCollector top(k, total);
+    for (const auto& hits : partial) {
+        for (const RowHit& hit : hits) {
+            top.push(hit);
+        }
+    }
+    return top.take();
+}
+
+// ---------------------------------------------------------------------------
+// Indexes
+// ---------------------------------------------------------------------------
+// An index accelerates k-NN and radius queries over the rows of a
+// VectorStorage. It refers to vectors by storage row only and never copies
+// them; the database reports every change to the storage so the index can
+// follow rows as they are written, overwritten and moved by swap-with-last
+// removal. All calls are made with the database lock held (search under the
+// shared lock, everything else under the exclusive lock), so searches must
+// not mutate the index. Searches may be restricted to the rows of a filter
+// bitmap, which the index consults while it traverses.
+class VectorIndex {
+public:
+    virtual ~VectorIndex() = default;
+
+    virtual const char* name() const = 0;
+
+    // Discard the current contents and index every row of storage
+    virtual void build(const VectorStorage& storage) = 0;
+
+    // A new row was appended to storage
+    virtual void add(const VectorStorage& storage, size_t row) = 0;
+
+    // An existing row was overwritten with a new vector
+    virtual void update(const VectorStorage& storage, size_t row) = 0;
+
+    // Called before VectorStorage::remove() vacates row; the index must then
+    // mirror the storage and treat the current last row as living at row
+    virtual void remove(const VectorStorage& storage, size_t row) = 0;
+
+    // Closest k rows sorted by distance, only rows set in filter if non-null
+    virtual std::vector<RowHit> search(const VectorStorage& storage, const float* query, size_t k,
+                                       const SearchParams& params, const RowBitmap* filter) const = 0;
+
+    // Rows within radius, sorted by distance, only rows set in filter if non-null
+    virtual std::vector<RowHit> searchRadius(const VectorStorage& storage, const float* query, float radius,
+                                             const SearchParams& params, const RowBitmap* filter) const = 0;
+
+    // Estimated distance evaluations of an unfiltered top-k search; a filter
+    // passing a fraction s of the rows makes it about 1/s times as costly
+    virtual double searchCost(const VectorStorage& storage, size_t k, const SearchParams& params) const = 0;
+
+    // Approximate bytes held by the index structure
+    virtual size_t memoryBytes() const = 0;
+};
+
+// KD-tree over the storage rows with bucketed leaves. The tree is bulk built
+// by median splits on the dimension of largest spread; inserts descend to a
+// leaf and split it locally once it holds twice the bucket size, removes drop
+// the row from its leaf. After enough churn, or when an insert path grows far
+// deeper than a balanced tree would be, the whole tree is rebuilt. Pruning by
+// the distance to the splitting plane is a valid lower bound for Euclidean and
+// Manhattan distance only, so the index is limited to those metrics. Results
+// are exact; the tree only pays off at low dimensionality (roughly < 20).
+class KDTreeIndex : public VectorIndex {
+private:
+    static constexpr size_t kNoNode = std::numeric_limits<size_t>::max();
+    // Changes tolerated since the last build before a rebuild, as a minimum
+    static constexpr size_t kMinRebuildChanges = 1024;
+    // Rows sampled per split when looking for the dimension of largest spread
+    static constexpr size_t kSplitSampleRows = 128;
+
+    struct Node {
+        size_t left = kNoNode;
+        size_t right = kNoNode;
+        size_t split_dim = 0;
+        float split_value = 0.0f;
+        std::vector<size_t> rows;  // bucket, leaves only
+
+        bool isLeaf() const { return left == kNoNode; }
+    };
+
+    DistanceMetric metric_;
+    DistanceKernels kernels_;
+    size_t leaf_size_;
+    std::vector<Node> nodes_;
+    std::vector<size_t> leaf_of_row_;
+    size_t leaf_count_ = 0;
+    size_t built_rows_ = 0;
+    size_t changes_since_build_ = 0;
+
+    // Pick the dimension of largest spread among rows and partition them at
+    // its median. Returns false when all sampled rows coincide.
+    bool partition(const VectorStorage& storage, size_t* rows, size_t count,
+                   size_t& split_dim, float& split_value, size_t& mid) const {
+        const size_t dimension = storage.dimension();
+        const size_t step = std::max<size_t>(1, count / kSplitSampleRows);
+
+        float best_spread = 0.0f;
+        for (size_t d = 0; d < dimension; ++d) {
+            float lo = std::numeric_limits<float>::max();
+            float hi = std::numeric_limits<float>::lowest();
+            for (size_t i = 0; i < count; i += step) {
+                float value = storage.row(rows[i])[d];
+                lo = std::min(lo, value);
+                hi = std::max(hi, value);
+            }
+            if (hi - lo > best_spread) {
+                best_spread = hi - lo;
+                split_dim = d;
+            }
+        }
+        if (best_spread <= 0.0f) {
+            return false;
+        }
+
+        mid = count / 2;
+        const size_t dim = split_dim;
+        std::nth_element(rows, rows + mid, rows + count, [&](size_t a, size_t b) {
+            return storage.row(a)[dim] < storage.row(b)[dim];
+        });
+        split_value = storage.row(rows[mid])[dim];
+        return true;
+    }
+
+    size_t makeLeaf(const size_t* rows, size_t count) {
+        size_t node = nodes_.size();
+        nodes_.emplace_back();
+        nodes_[node].rows.assign(rows, rows + count);
+        for (size_t i = 0; i < count; ++i) {
+            leaf_of_row_[rows[i]] = node;
+        }
+        ++leaf_count_;
+        return node;
+    }
+
+    size_t buildNode(const VectorStorage& storage, size_t* rows, size_t count) {
+        size_t split_dim = 0, mid = 0;
+        float split_value = 0.0f;
+        if (count <= leaf_size_ || !partition(storage, rows, count, split_dim, split_value, mid)) {
+            return makeLeaf(rows, count);
+        }
+
+        size_t node = nodes_.size();
+        nodes_.emplace_back();
+        nodes_[node].split_dim = split_dim;
+        nodes_[node].split_value = split_value;
+        size_t left = buildNode(storage, rows, mid);
+        size_t right = buildNode(storage, rows + mid, count - mid);
+        nodes_[node].left = left;
+        nodes_[node].right = right;
+        return node;
+    }
+
+    // Turn an overfull leaf into an internal node with two leaves
+    void splitLeaf(const VectorStorage& storage, size_t node) {
+        std::vector<size_t> rows = std::move(nodes_[node].rows);
+        size_t split_dim = 0, mid = 0;
+        float split_value = 0.0f;
+        if (!partition(storage, rows.data(), rows.size(), split_dim, split_value, mid)) {
+            nodes_[node].rows = std::move(rows);
+            return;
+        }
+
+        --leaf_count_;
+        size_t left = makeLeaf(rows.data(), mid);
+        size_t right = makeLeaf(rows.data() + mid, rows.size() - mid);
+        Node& split = nodes_[node];
+        split.rows = std::vector<size_t>();
+        split.split_dim = split_dim;
+        split.split_value = split_value;
+        split.left = left;
+        split.right = right;
+    }
+
+    // Insert a row into the leaf it descends to; returns the path length
+    size_t insertRow(const VectorStorage& storage, size_t row) {
+        const float* vector = storage.row(row);
+        size_t node = 0;
+        size_t depth = 0;
+        while (!nodes_[node].isLeaf()) {
+            const Node& current = nodes_[node];
+            node = vector[current.split_dim] < current.split_value ? current.left : current.right;
+            ++depth;
+        }
+
+        nodes_[node].rows.push_back(row);
+        leaf_of_row_[row] = node;
+        if (nodes_[node].rows.size() > 2 * leaf_size_) {
+            splitLeaf(storage, node);
+        }
+        return depth;
+    }
+
+    void eraseRow(size_t row) {
+        std::vector<size_t>& bucket = nodes_[leaf_of_row_[row]].rows;
+        auto it = std::find(bucket.begin(), bucket.end(), row);
+        if (it != bucket.end()) {
+            *it = bucket.back();
+            bucket.pop_back();
+        }
+        leaf_of_row_[row] = kNoNode;
+    }
+
+    // Rebuild once the changes since the last build rival its size, or when
+    // inserts have produced a path much deeper than a balanced tree
+    void maybeRebuild(const VectorStorage& storage, size_t depth) {
+        ++changes_since_build_;
+        size_t balanced_depth = 1;
+        while ((size_t(1) << balanced_depth) < leaf_count_) {
+            ++balanced_depth;
+        }
+        if (changes_since_build_ > std::max(kMinRebuildChanges, built_rows_) ||
+            depth > 2 * balanced_depth + 8) {
+            build(storage);
+        }
+    }
+
+    template <DistanceMetric Metric>
+    std::vector<RowHit> searchTopK(const VectorStorage& storage, const float* query, size_t k,
+                                   const RowBitmap* filter) const {
+        const RowDistance<Metric> distance_to(kernels_, storage, query);
+        if (k == 0 || nodes_.empty()) {
+            return {};
+        }
+        TopKCollector top(k, storage.size());
+        SearchWork& work = SearchWork::local();
+
+        // Depth-first, nearer child first; each entry carries a lower bound
+        // on the distance from the query to anything below it
+        std::vector<std::pair<size_t, float>> stack;
+        stack.push_back({0, 0.0f});
+        while (!stack.empty()) {
+            auto [node, bound] = stack.back();
+            stack.pop_back();
+            if (bound >= top.threshold()) {
+                continue;
+            }
+
+            const Node& current = nodes_[node];
+            ++work.nodes;
+            if (current.isLeaf()) {
+                for (size_t row : current.rows) {
+                    if (!filter || filter->test(row)) {
+                        ++work.distances;
+                        top.push(row, distance_to.bounded(row, storage.row(row), top.threshold()));
+                    }
+                }
+                continue;
+            }
+
+            float diff = query[current.split_dim] - current.split_value;
+            size_t near_child = diff < 0.0f ? current.left : current.right;
+            size_t far_child = diff < 0.0f ? current.right : current.left;
+            stack.push_back({far_child, std::max(bound, std::abs(diff))});
+            stack.push_back({near_child, bound});
+        }
+
+        return top.take();
+    }
+
+    template <DistanceMetric Metric>
+    std::vector<RowHit> searchWithin(const VectorStorage& storage, const float* query, float radius,
+                                     const RowBitmap* filter) const {
+        const RowDistance<Metric> distance_to(kernels_, storage, query);
+        std::vector<RowHit> hits;
+        if (nodes_.empty()) {
+            return hits;
+        }
+
+        SearchWork& work = SearchWork::local();
+        std::vector<size_t> stack;
+        stack.push_back(0);
+        while (!stack.empty()) {
+            const Node& current = nodes_[stack.back()];
+            stack.pop_back();
+            ++work.nodes;
+
+            if (current.isLeaf()) {
+                for (size_t row : current.rows) {
+                    if (filter && !filter->test(row)) {
+                        continue;
+                    }
+                    ++work.distances;
+                    float distance = distance_to.bounded(row, storage.row(row), radius);
+                    if (distance <= radius) {
+                        hits.push_back({row, distance});
+                    }
+                }
+                continue;
+            }
+
+            float diff = query[current.split_dim] - current.split_value;
+            if (diff < 0.0f || diff <= radius) {
+                stack.push_back(current.left);
+            }
+            if (diff >= 0.0f || -diff <= radius) {
+                stack.push_back(current.right);
+            }
+        }
+
+        sortHits(hits);
+        return hits;
+    }
+
+public:
+    KDTreeIndex(DistanceMetric metric, const DistanceKernels& kernels, size_t leaf_size)
+        : metric_(metric), kernels_(kernels), leaf_size_(std::max<size_t>(1, leaf_size)) {}
+
+    static bool supports(DistanceMetric metric) {
+        return metric == DistanceMetric::EUCLIDEAN || metric == DistanceMetric::MANHATTAN;
+    }
+
+    const char* name() const override { return "KD-Tree"; }
+
+    void build(const VectorStorage& storage) override {
+        nodes_.clear();
+        leaf_count_ = 0;
+        leaf_of_row_.assign(storage.size(), kNoNode);
+
+        std::vector<size_t> rows(storage.size());
+        for (size_t row = 0; row < rows.size(); ++row) {
+            rows[row] = row;
+        }
+        buildNode(storage, rows.data(), rows.size());
+
+        built_rows_ = storage.size();
+        changes_since_build_ = 0;
+    }
+
+    void add(const VectorStorage& storage, size_t row) override {
+        if (nodes_.empty()) {
+            build(storage);
+            return;
+        }
+        leaf_of_row_.resize(storage.size(), kNoNode);
+        maybeRebuild(storage, insertRow(storage, row));
+    }
+
+    void update(const VectorStorage& storage, size_t row) override {
+        eraseRow(row);
+        maybeRebuild(storage, insertRow(storage, row));
+    }
+
+    void remove(const VectorStorage& storage, size_t row) override {
+        size_t last = storage.size() - 1;
+        eraseRow(row);
+        if (row != last) {
+            size_t leaf = leaf_of_row_[last];
+            std::vector<size_t>& bucket = nodes_[leaf].rows;
+            *std::find(bucket.begin(), bucket.end(), last) = row;
+            leaf_of_row_[row] = leaf;
+        }
+        leaf_of_row_.pop_back();
+        ++changes_since_build_;
+    }
+
+    std::vector<RowHit> search(const VectorStorage& storage, const float* query, size_t k,
+                               const SearchParams&, const RowBitmap* filter) const override {
+        return dispatchMetric(metric_, [&](auto metric) {
+            return searchTopK<decltype(metric)::value>(storage, query, k, filter);
+        });
+    }
+
+    std::vector<RowHit> searchRadius(const VectorStorage& storage, const float* query, float radius,
+                                     const SearchParams&, const RowBitmap* filter) const override {
+        return dispatchMetric(metric_, [&](auto metric) {
+            return searchWithin<decltype(metric)::value>(storage, query, radius, filter);
+        });
+    }
+
+    double searchCost(const VectorStorage& storage, size_t k, const SearchParams&) const override {
+        // A few leaves around the query plus one per further neighbour
+        double leaves = std::max(1.0, std::log2(static_cast<double>(std::max<size_t>(leaf_count_, 1))));
+        return std::min(static_cast<double>(storage.size()), static_cast<double>(leaf_size_) * (leaves + k));
+    }
+
+    size_t memoryBytes() const override {
+        // Node array, row -> leaf table and the leaf buckets (one entry per row)
+        return nodes_.capacity() * sizeof(Node) + 2 * leaf_of_row_.size() * sizeof(size_t);
+    }
+};
+// Locality-sensitive hashing over the storage rows. Every table hashes a
+// vector with hash_bits random projections:
+//  - COSINE / DOT_PRODUCT: random-hyperplane LSH, one sign bit per Gaussian
+//    hyperplane through the origin;
+//  - EUCLIDEAN / MANHATTAN: p-stable LSH, floor((a.v + b) / w) per projection
+//    with Gaussian (2-stable) or Cauchy (1-stable) a and b uniform in [0, w).
+// A query probes its own bucket in every table plus the `probes` neighbouring
+// buckets it is closest to falling into (the bits or slots whose boundary is
+// nearest), then re-ranks the union of candidates with the exact metric.
+// Results are approximate. With an automatic bucket width the p-stable
+// variant needs data to calibrate on, so it answers small collections by
+// exact scan until kTrainRows vectors have been inserted.
+class LSHIndex : public VectorIndex {
+private:
+    static constexpr size_t kTrainRows = 1024;
+    static constexpr size_t kCalibrationPairs = 512;
+    static constexpr uint32_t kSeed = 0x5eed1234u;
+
+    using Bucket = std::vector<size_t>;
+
+    DistanceMetric metric_;
+    DistanceKernels kernels_;
+    size_t dimension_;
+    size_t table_count_;
+    size_t hash_bits_;
+    size_t probes_;
+    bool hyperplane_;
+    float configured_width_;
+    float width_ = 0.0f;
+    bool trained_ = false;
+
+    std::vector<float> projections_;  // table_count_ * hash_bits_ rows of dimension_ floats
+    std::vector<float> offsets_;      // per projection, as a fraction of width_
+    std::vector<std::unordered_map<uint64_t, Bucket>> tables_;
+    std::vector<uint64_t> row_keys_;  // table_count_ keys per storage row
+
+    static uint64_t mixSlot(uint64_t key, int64_t slot) {
+        key ^= static_cast<uint64_t>(slot) + 0x9e3779b97f4a7c15ull + (key << 6) + (key >> 2);
+        return key;
+    }
+
+    const float* projection(size_t table, size_t bit) const {
+        return projections_.data() + (table * hash_bits_ + bit) * dimension_;
+    }
+
+    // Projection values for one table: raw dot products (hyperplane) or
+    // positions in units of bucket width (p-stable)
+    void project(const float* vector, size_t table, float* out) const {
+        for (size_t bit = 0; bit < hash_bits_; ++bit) {
+            float value = kernels_.dot(projection(table, bit), vector, dimension_);
+            out[bit] = hyperplane_ ? value : value / width_ + offsets_[table * hash_bits_ + bit];
+        }
+    }
+
+    uint64_t keyOf(const float* values) const {
+        uint64_t key = 0;
+        for (size_t bit = 0; bit < hash_bits_; ++bit) {
+            if (hyperplane_) {
+                key |= uint64_t(values[bit] >= 0.0f) << bit;
+            } else {
+                key = mixSlot(key, static_cast<int64_t>(std::floor(values[bit])));
+            }
+        }
+        return key;
+    }
+
+    // Key of the bucket reached by crossing the nearest boundary of one
+    // projection (direction -1/+1 for p-stable slots, ignored for bits)
+    uint64_t probeKey(const float* values, uint64_t key, size_t bit, int direction) const {
+        if (hyperplane_) {
+            return key ^ (uint64_t(1) << bit);
+        }
+        uint64_t probe = 0;
+        for (size_t b = 0; b < hash_bits_; ++b) {
+            int64_t slot = static_cast<int64_t>(std::floor(values[b]));
+            probe = mixSlot(probe, b == bit ? slot + direction : slot);
+        }
+        return probe;
+    }
+
+    void insertRow(const VectorStorage& storage, size_t row) {
+        std::vector<float> values(hash_bits_);
+        for (size_t table = 0; table < table_count_; ++table) {
+            project(storage.row(row), table, values.data());
+            uint64_t key = keyOf(values.data());
+            tables_[table][key].push_back(row);
+            row_keys_[row * table_count_ + table] = key;
+        }
+    }
+
+    void eraseRow(size_t row) {
+        for (size_t table = 0; table < table_count_; ++table) {
+            auto it = tables_[table].find(row_keys_[row * table_count_ + table]);
+            Bucket& bucket = it->second;
+            *std::find(bucket.begin(), bucket.end(), row) = bucket.back();
+            bucket.pop_back();
+            if (bucket.empty()) {
+                tables_[table].erase(it);
+            }
+        }
+    }
+
+    // Bucket width from the mean distance between random pairs of rows
+    float estimateWidth(const VectorStorage& storage) const {
+        std::mt19937 rng(kSeed);
+        std::uniform_int_distribution<size_t> pick(0, storage.size() - 1);
+        double total = 0.0;
+        for (size_t i = 0; i < kCalibrationPairs; ++i) {
+            const float* a = storage.row(pick(rng));
+            const float* b = storage.row(pick(rng));
+            total += metric_ == DistanceMetric::MANHATTAN ? kernels_.l1(a, b, dimension_)
+                                                         : std::sqrt(kernels_.l2_squared(a, b, dimension_));
+        }
+        // Cauchy projections are heavy-tailed, so 1-stable buckets get twice the width
+        float width = static_cast<float>(total / kCalibrationPairs);
+        if (metric_ == DistanceMetric::MANHATTAN) {
+            width *= 2.0f;
+        }
+        return width > 0.0f ? width : 1.0f;
+    }
+
+    // Distinct candidate rows from the probed buckets of every table
+    std::vector<size_t> candidates(const float* query) const {
+        std::vector<size_t> rows;
+        std::vector<float> values(hash_bits_);
+        std::vector<std::pair<float, std::pair<size_t, int>>> boundaries;
+
+        SearchWork& work = SearchWork::local();
+        auto collect = [&](size_t table, uint64_t key) {
+            ++work.nodes;
+            auto it = tables_[table].find(key);
+            if (it != tables_[table].end()) {
+                rows.insert(rows.end(), it->second.begin(), it->second.end());
+            }
+        };
+
+        for (size_t table = 0; table < table_count_; ++table) {
+            project(query, table, values.data());
+            uint64_t key = keyOf(values.data());
+            collect(table, key);
+            if (probes_ == 0) {
+                continue;
+            }
+
+            // Rank the neighbouring buckets by how close the query is to them
+            boundaries.clear();
+            for (size_t bit = 0; bit < hash_bits_; ++bit) {
+                if (hyperplane_) {
+                    boundaries.push_back({std::abs(values[bit]), {bit, 0}});
+                } else {
+                    float fraction = values[bit] - std::floor(values[bit]);
+                    boundaries.push_back({fraction, {bit, -1}});
+                    boundaries.push_back({1.0f - fraction, {bit, 1}});
+                }
+            }
+            size_t probes = std::min(probes_, boundaries.size());
+            std::partial_sort(boundaries.begin(), boundaries.begin() + probes, boundaries.end());
+            for (size_t p = 0; p < probes; ++p) {
+                const auto& crossing = boundaries[p].second;
+                collect(table, probeKey(values.data(), key, crossing.first, crossing.second));
+            }
+        }
+
+        std::sort(rows.begin(), rows.end());
+        rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+        return rows;
+    }
+
+    // Untrained indexes answer with an exact pass over all rows
+    std::vector<size_t> allRows(const VectorStorage& storage) const {
+        std::vector<size_t> rows(storage.size());
+        for (size_t row = 0; row < rows.size(); ++row) {
+            rows[row] = row;
+        }
+        return rows;
+    }
+
+    template <DistanceMetric Metric>
+    std::vector<RowHit> rerankTopK(const VectorStorage& storage, const float* query, size_t k,
+                                   const RowBitmap* filter) const {
+        const RowDistance<Metric> distance_to(kernels_, storage, query);
+        if (k == 0) {
+            return {};
+        }
+        const std::vector<size_t> rows = trained_ ? candidates(query) : allRows(storage);
+        TopKCollector top(k, rows.size());
+        SearchWork& work = SearchWork::local();
+        for (size_t row : rows) {
+            if (!filter || filter->test(row)) {
+                ++work.distances;
+                top.push(row, distance_to.bounded(row, storage.row(row), top.threshold()));
+            }
+        }
+        return top.take();
+    }
+
+    template <DistanceMetric Metric>
+    std::vector<RowHit> rerankRadius(const VectorStorage& storage, const float* query, float radius,
+                                     const RowBitmap* filter) const {
+        const RowDistance<Metric> distance_to(kernels_, storage, query);
+        std::vector<RowHit> hits;
+        SearchWork& work = SearchWork::local();
+        for (size_t row : trained_ ? candidates(query) : allRows(storage)) {
+            if (filter && !filter->test(row)) {
+                continue;
+            }
+            ++work.distances;
+            float distance = distance_to.bounded(row, storage.row(row), radius);
+            if (distance <= radius) {
+                hits.push_back({row, distance});
+            }
+        }
+        sortHits(hits);
+        return hits;
+    }
+
+public:
+    LSHIndex(DistanceMetric metric, const DistanceKernels& kernels, size_t dimension,
+             size_t tables, size_t hash_bits, size_t probes, float bucket_width)
+        : metric_(metric), kernels_(kernels), dimension_(dimension),
+          table_count_(std::max<size_t>(1, tables)),
+          hash_bits_(std::min<size_t>(64, std::max<size_t>(1, hash_bits))),
+          probes_(probes),
+          hyperplane_(metric == DistanceMetric::COSINE || metric == DistanceMetric::DOT_PRODUCT),
+          configured_width_(bucket_width) {
+        std::mt19937 rng(kSeed);
+        std::normal_distribution<float> gaussian(0.0f, 1.0f);
+        std::cauchy_distribution<float> cauchy(0.0f, 1.0f);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+        const size_t functions = table_count_ * hash_bits_;
+        projections_.resize(functions * dimension_);
+        for (float& value : projections_) {
+            value = metric == DistanceMetric::MANHATTAN ? cauchy(rng) : gaussian(rng);
+        }
+        offsets_.resize(functions);
+        for (float& offset : offsets_) {
+            offset = uniform(rng);
+        }
+    }
+
+    const char* name() const override { return "LSH"; }
+
+    void build(const VectorStorage& storage) override {
+        tables_.assign(table_count_, {});
+        row_keys_.clear();
+
+        if (!hyperplane_) {
+            if (configured_width_ > 0.0f) {
+                width_ = configured_width_;
+            } else if (storage.size() >= kTrainRows) {
+                width_ = estimateWidth(storage);
+            } else {
+                trained_ = false;
+                return;
+            }
+        }
+
+        trained_ = true;
+        row_keys_.resize(storage.size() * table_count_);
+        for (size_t row = 0; row < storage.size(); ++row) {
+            insertRow(storage, row);
+        }
+    }
+
+    void add(const VectorStorage& storage, size_t row) override {
+        if (!trained_) {
+            if (storage.size() >= kTrainRows) {
+                build(storage);
+            }
+            return;
+        }
+        row_keys_.resize(storage.size() * table_count_);
+        insertRow(storage, row);
+    }
+
+    void update(const VectorStorage& storage, size_t row) override {
+        if (trained_) {
+            eraseRow(row);
+            insertRow(storage, row);
+        }
+    }
+
+    void remove(const VectorStorage& storage, size_t row) override {
+        if (!trained_) {
+            return;
+        }
+        size_t last = storage.size() - 1;
+        eraseRow(row);
+        if (row != last) {
+            for (size_t table = 0; table < table_count_; ++table) {
+                uint64_t key = row_keys_[last * table_count_ + table];
+                Bucket& bucket = tables_[table][key];
+                *std::find(bucket.begin(), bucket.end(), last) = row;
+                row_keys_[row * table_count_ + table] = key;
+            }
+        }
+        row_keys_.resize(last * table_count_);
+    }
+
+    std::vector<RowHit> search(const VectorStorage& storage, const float* query, size_t k,
+                               const SearchParams&, const RowBitmap* filter) const override {
+        return dispatchMetric(metric_, [&](auto metric) {
+            return rerankTopK<decltype(metric)::value>(storage, query, k, filter);
+        });
+    }
+
+    std::vector<RowHit> searchRadius(const VectorStorage& storage, const float* query, float radius,
+                                     const SearchParams&, const RowBitmap* filter) const override {
+        return dispatchMetric(metric_, [&](auto metric) {
+            return rerankRadius<decltype(metric)::value>(storage, query, radius, filter);
+        });
+    }
+
+    double searchCost(const VectorStorage& storage, size_t, const SearchParams&) const override {
+        // Expected bucket occupancy over every probed bucket, plus hashing
+        double rows = static_cast<double>(storage.size());
+        if (!trained_) {
+            return rows;
+        }
+        double buckets = static_cast<double>(table_count_ * (probes_ + 1));
+        return std::min(rows, buckets * rows / std::ldexp(1.0, static_cast<int>(hash_bits_))) +
+               static_cast<double>(table_count_ * hash_bits_);
+    }
+
+    size_t memoryBytes() const override {
+        size_t bytes = (projections_.size() + offsets_.size()) * sizeof(float) +
+                       row_keys_.size() * sizeof(uint64_t);
+        for (const auto& table : tables_) {
+            // Bucket entries plus map node overhead
+            bytes += table.size() * (sizeof(uint64_t) + sizeof(Bucket) + 2 * sizeof(void*));
+        }
+        return bytes + row_keys_.size() * sizeof(size_t);
+    }
+};
+
+// Hierarchical navigable small world graph (Malkov & Yashunin). Every vector
+// is a graph node with up to M links per layer (2M on layer 0) on a random
+// number of layers; a search descends greedily from the top layer and runs a
+// best-first search with an ef-sized candidate list on layer 0. Graph nodes
+// are separate from storage rows so they survive swap-with-last removal:
+// remove() turns a node into a tombstone that keeps routing searches (with a
+// private copy of its vector) but is never returned, and the graph is rebuilt
+// once tombstones outnumber live vectors. Overwriting a vector relinks its
+// node in place. Results are approximate; all metrics are supported.
+class HNSWIndex : public VectorIndex {
+private:
+    static constexpr uint32_t kNoNode = std::numeric_limits<uint32_t>::max();
+    static constexpr int kMaxLevel = 16;
+    static constexpr size_t kMinRebuildTombstones = 1024;
+    static constexpr uint32_t kSeed = 0x5eed1234u;
+
+    struct Tombstone {
+        std::vector<float> vector;
+        float norm;
+    };
+
+    // (distance, node); std::pair ordering gives heaps by distance
+    using Candidate = std::pair<float, uint32_t>;
+
+    // Per-thread visit marks, so concurrent searches share no scratch state
+    class VisitedSet {
+    private:
+        std::vector<uint32_t> marks_;
+        uint32_t epoch_ = 0;
+
+    public:
+        void reset(size_t nodes) {
+            if (marks_.size() < nodes) {
+                marks_.resize(nodes, 0);
+            }
+            if (++epoch_ == 0) {
+                std::fill(marks_.begin(), marks_.end(), 0);
+                epoch_ = 1;
+            }
+        }
+
+        // True if node had not been visited yet
+        bool insert(uint32_t node) {
+            if (marks_[node] == epoch_) {
+                return false;
+            }
+            marks_[node] = epoch_;
+            return true;
+        }
+    };
+
+    DistanceMetric metric_;
+    DistanceKernels kernels_;
+    size_t dimension_;
+    size_t max_links_;   // M, layers above 0
+    size_t max_links0_;  // 2M, layer 0
+    size_t ef_construction_;
+    size_t ef_search_;
+    double level_scale_;
+    std::mt19937 level_rng_;
+
+    std::vector<uint32_t> links0_;                    // per node: count, then max_links0_ slots
+    std::vector<std::vector<uint32_t>> upper_links_;  // per node: count + max_links_ slots per layer above 0
+    std::vector<int> node_levels_;
+    std::vector<size_t> row_of_node_;                 // VectorStorage::npos for tombstones
+    std::vector<uint32_t> node_of_row_;
+    std::unordered_map<uint32_t, Tombstone> tombstones_;
+    uint32_t entry_ = kNoNode;
+    int max_level_ = -1;
+
+    static VisitedSet& visitedSet() {
+        static thread_local VisitedSet visited;
+        return visited;
+    }
+
+    uint32_t* links(uint32_t node, int level) {
+        if (level == 0) {
+            return links0_.data() + size_t(node) * (max_links0_ + 1);
+        }
+        return upper_links_[node].data() + size_t(level - 1) * (max_links_ + 1);
+    }
+
+    const uint32_t* links(uint32_t node, int level) const {
+        return const_cast<HNSWIndex*>(this)->links(node, level);
+    }
+
+    size_t maxLinks(int level) const {
+        return level == 0 ? max_links0_ : max_links_;
+    }
+
+    bool isLive(uint32_t node) const {
+        return row_of_node_[node] != VectorStorage::npos;
+    }
+
+    const float* vectorOf(const VectorStorage& storage, uint32_t node) const {
+        size_t row = row_of_node_[node];
+        return row != VectorStorage::npos ? storage.row(row) : tombstones_.find(node)->second.vector.data();
+    }
+
+    float normOf(const VectorStorage& storage, uint32_t node) const {
+        size_t row = row_of_node_[node];
+        return row != VectorStorage::npos ? storage.norm(row) : tombstones_.find(node)->second.norm;
+    }
+
+    template <DistanceMetric Metric>
+    RowDistance<Metric> distanceFrom(const VectorStorage& storage, uint32_t node) const {
+        return RowDistance<Metric>(kernels_, storage, vectorOf(storage, node), normOf(storage, node));
+    }
+
+    template <DistanceMetric Metric>
+    float distanceTo(const RowDistance<Metric>& from, const VectorStorage& storage, uint32_t node) const {
+        ++SearchWork::local().distances;
+        size_t row = row_of_node_[node];
+        if (row != VectorStorage::npos) {
+            return from(row, storage.row(row));
+        }
+        const Tombstone& tombstone = tombstones_.find(node)->second;
+        return from.withNorm(tombstone.vector.data(), tombstone.norm);
+    }
+
+    int randomLevel() {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        double level = -std::log(1.0 - uniform(level_rng_)) * level_scale_;
+        return static_cast<int>(std::min<double>(level, kMaxLevel));
+    }
+
+    // Move greedily towards the query on layers (bottom, top]
+    template <DistanceMetric Metric>
+    Candidate greedyDescent(const RowDistance<Metric>& from, const VectorStorage& storage,
+                            Candidate current, int top, int bottom) const {
+        for (int level = top; level > bottom; --level) {
+            bool improved = true;
+            while (improved) {
+                improved = false;
+                ++SearchWork::local().nodes;
+                const uint32_t* list = links(current.second, level);
+                for (uint32_t i = 1; i <= list[0]; ++i) {
+                    float distance = distanceTo(from, storage, list[i]);
+                    if (distance < current.first) {
+                        current = {distance, list[i]};
+                        improved = true;
+                    }
+                }
+            }
+        }
+        return current;
+    }
+
+    // Best-first search of one layer keeping the ef closest nodes, sorted by
+    // distance. live_only keeps tombstones out of the result while still
+    // expanding through them.
+    template <DistanceMetric Metric>
+    std::vector<Candidate> searchLayer(const RowDistance<Metric>& from, const VectorStorage& storage,
+                                       const std::vector<Candidate>& entry_points, size_t ef, int level,
+                                       bool live_only, const RowBitmap* filter = nullptr) const {
+        // Tombstoned and filtered-out nodes still route the search but are not kept
+        auto keeps = [&](uint32_t node) {
+            return !live_only || (isLive(node) && (!filter || filter->test(row_of_node_[node])));
+        };
+        VisitedSet& visited = visitedSet();
+        visited.reset(row_of_node_.size());
+
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> frontier;
+        std::priority_queue<Candidate> nearest;  // worst kept node on top
+
+        for (const Candidate& entry : entry_points) {
+            visited.insert(entry.second);
+            frontier.push(entry);
+            if (keeps(entry.second)) {
+                nearest.push(entry);
+            }
+        }
+        while (nearest.size() > ef) {
+            nearest.pop();
+        }
+
+        while (!frontier.empty()) {
+            Candidate current = frontier.top();
+            if (nearest.size() >= ef && current.first > nearest.top().first) {
+                break;
+            }
+            frontier.pop();
+            ++SearchWork::local().nodes;
+
+            const uint32_t* list = links(current.second, level);
+            for (uint32_t i = 1; i <= list[0]; ++i) {
+                uint32_t neighbor = list[i];
+                if (!visited.insert(neighbor)) {
+                    continue;
+                }
+                float distance = distanceTo(from, storage, neighbor);
+                if (nearest.size() < ef || distance < nearest.top().first) {
+                    frontier.push({distance, neighbor});
+                    if (keeps(neighbor)) {
+                        nearest.push({distance, neighbor});
+                        if (nearest.size() > ef) {
+                            nearest.pop();
+                        }
+                    }
+                }
+            }
+        }
+
+        std::vector<Candidate> result(nearest.size());
+        for (size_t i = result.size(); i-- > 0; nearest.pop()) {
+            result[i] = nearest.top();
+        }
+        return result;
+    }
+
+    // Neighbour selection heuristic: walk candidates from closest and keep one
+    // only if it is closer to the base node than to every neighbour kept so
+    // far, which favours links in diverse directions
+    template <DistanceMetric Metric>
+    std::vector<Candidate> selectNeighbors(const VectorStorage& storage, const std::vector<Candidate>& candidates,
+                                           size_t max_count) const {
+        if (candidates.size() <= max_count) {
+            return candidates;
+        }
+
+        std::vector<Candidate> selected;
+        selected.reserve(max_count);
+        for (const Candidate& candidate : candidates) {
+            if (selected.size() >= max_count) {
+                break;
+            }
+            const RowDistance<Metric> from_candidate = distanceFrom<Metric>(storage, candidate.second);
+            bool diverse = true;
+            for (const Candidate& kept : selected) {
+                if (distanceTo(from_candidate, storage, kept.second) < candidate.first) {
+                    diverse = false;
+                    break;
+                }
+            }
+            if (diverse) {
+                selected.push_back(candidate);
+            }
+        }
+        return selected;
+    }
+
+    // Add the link node -> target on a layer, pruning node's list when full
+    template <DistanceMetric Metric>
+    void addLink(const VectorStorage& storage, uint32_t node, uint32_t target, float distance, int level) {
+        uint32_t* list = links(node, level);
+        for (uint32_t i = 1; i <= list[0]; ++i) {
+            if (list[i] == target) {
+                return;
+            }
+        }
+
+        const size_t limit = maxLinks(level);
+        if (list[0] < limit) {
+            list[++list[0]] = target;
+            return;
+        }
+
+        const RowDistance<Metric> from_node = distanceFrom<Metric>(storage, node);
+        std::vector<Candidate> candidates;
+        candidates.reserve(limit + 1);
+        candidates.push_back({distance, target});
+        for (uint32_t i = 1; i <= list[0]; ++i) {
+            candidates.push_back({distanceTo(from_node, storage, list[i]), list[i]});
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        std::vector<Candidate> kept = selectNeighbors<Metric>(storage, candidates, limit);
+        list[0] = static_cast<uint32_t>(kept.size());
+        for (size_t i = 0; i < kept.size(); ++i) {
+            list[i + 1] = kept[i].second;
+        }
+    }
+
+    // Link a node into every layer up to its level; also used to relink a
+    // node whose vector was overwritten
+    template <DistanceMetric Metric>
+    void connectNode(const VectorStorage& storage, uint32_t node) {
+        const int level = node_levels_[node];
+        if (entry_ == kNoNode) {
+            entry_ = node;
+            max_level_ = level;
+            return;
+        }
+
+        const RowDistance<Metric> from = distanceFrom<Metric>(storage, node);
+        Candidate current{distanceTo(from, storage, entry_), entry_};
+        current = greedyDescent(from, storage, current, max_level_, level);
+
+        std::vector<Candidate> entry_points{current};
+        for (int layer = std::min(level, max_level_); layer >= 0; --layer) {
+            std::vector<Candidate> found = searchLayer(from, storage, entry_points, ef_construction_, layer, false);
+            found.erase(std::remove_if(found.begin(), found.end(),
+                                       [node](const Candidate& c) { return c.second == node; }),
+                        found.end());
+
+            std::vector<Candidate> neighbors = selectNeighbors<Metric>(storage, found, max_links_);
+            uint32_t* list = links(node, layer);
+            list[0] = static_cast<uint32_t>(neighbors.size());
+            for (size_t i = 0; i < neighbors.size(); ++i) {
+                list[i + 1] = neighbors[i].second;
+            }
+            for (const Candidate& neighbor : neighbors) {
+                addLink<Metric>(storage, neighbor.second, node, neighbor.first, layer);
+            }
+
+            if (!found.empty()) {
+                entry_points = std::move(found);
+            }
+        }
+
+        if (level > max_level_) {
+            max_level_ = level;
+            entry_ = node;
+        }
+    }
+
+    void addNode(const VectorStorage& storage, size_t row) {
+        uint32_t node = static_cast<uint32_t>(row_of_node_.size());
+        int level = randomLevel();
+
+        row_of_node_.push_back(row);
+        node_levels_.push_back(level);
+        links0_.resize(links0_.size() + max_links0_ + 1, 0);
+        upper_links_.emplace_back(size_t(level) * (max_links_ + 1), 0);
+        node_of_row_.resize(storage.size(), kNoNode);
+        node_of_row_[row] = node;
+
+        dispatchMetric(metric_, [&](auto metric) {
+            connectNode<decltype(metric)::value>(storage, node);
+        });
+    }
+
+    // Rebuild without tombstones once they outnumber the live vectors
+    void maybeRebuild(const VectorStorage& storage) {
+        if (tombstones_.size() > std::max(kMinRebuildTombstones, storage.size())) {
+            build(storage);
+        }
+    }
+
+    template <DistanceMetric Metric>
+    std::vector<RowHit> searchTopK(const VectorStorage& storage, const float* query, size_t k, size_t ef,
+                                   const RowBitmap* filter) const {
+        std::vector<RowHit> hits;
+        if (entry_ == kNoNode || k == 0) {
+            return hits;
+        }
+
+        const RowDistance<Metric> from(kernels_, storage, query);
+        Candidate current{distanceTo(from, storage, entry_), entry_};
+        current = greedyDescent(from, storage, current, max_level_, 0);
+
+        std::vector<Candidate> found = searchLayer(from, storage, {current}, std::max(ef, k), 0, true, filter);
+        size_t count = std::min(k, found.size());
+        hits.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            hits.push_back({row_of_node_[found[i].second], found[i].first});
+        }
+        return hits;
+    }
+
+    // Radius queries widen ef until the candidate list reaches past the radius
+    template <DistanceMetric Metric>
+    std::vector<RowHit> searchWithin(const VectorStorage& storage, const float* query, float radius, size_t ef,
+                                     const RowBitmap* filter) const {
+        ef = std::max<size_t>(ef, 16);
+        while (true) {
+            std::vector<RowHit> hits = searchTopK<Metric>(storage, query, ef, ef, filter);
+            if (hits.size() < ef || hits.back().distance > radius || ef >= storage.size()) {
+                hits.erase(std::find_if(hits.begin(), hits.end(),
+                                        [radius](const RowHit& hit) { return hit.distance > radius; }),
+                           hits.end());
+                return hits;
+            }
+            ef *= 2;
+        }
+    }
+
+    size_t efFor(const SearchParams& params) const {
+        return params.ef_search != 0 ? params.ef_search : ef_search_;
+    }
+
+public:
+    HNSWIndex(DistanceMetric metric, const DistanceKernels& kernels, size_t dimension,
+              size_t m, size_t ef_construction, size_t ef_search)
+        : metric_(metric), kernels_(kernels), dimension_(dimension),
+          max_links_(std::max<size_t>(2, m)), max_links0_(2 * std::max<size_t>(2, m)),
+          ef_construction_(std::max<size_t>(1, ef_construction)), ef_search_(std::max<size_t>(1, ef_search)),
+          level_scale_(1.0 / std::log(static_cast<double>(std::max<size_t>(2, m)))), level_rng_(kSeed) {}
+
+    const char* name() const override { return "HNSW"; }
+
+    void build(const VectorStorage& storage) override {
+        links0_.clear();
+        upper_links_.clear();
+        node_levels_.clear();
+        row_of_node_.clear();
+        node_of_row_.clear();
+        tombstones_.clear();
+        entry_ = kNoNode;
+        max_level_ = -1;
+        level_rng_.seed(kSeed);
+
+        links0_.reserve(storage.size() * (max_links0_ + 1));
+        upper_links_.reserve(storage.size());
+        node_levels_.reserve(storage.size());
+        row_of_node_.reserve(storage.size());
+        for (size_t row = 0; row < storage.size(); ++row) {
+            addNode(storage, row);
+        }
+    }
+
+    void add(const VectorStorage& storage, size_t row) override {
+        addNode(storage, row);
+        maybeRebuild(storage);
+    }
+
+    void update(const VectorStorage& storage, size_t row) override {
+        uint32_t node = node_of_row_[row];
+        dispatchMetric(metric_, [&](auto metric) {
+            connectNode<decltype(metric)::value>(storage, node);
+        });
+    }
+
+    void remove(const VectorStorage& storage, size_t row) override {
+        uint32_t node = node_of_row_[row];
+        Tombstone tombstone;
+        tombstone.vector.assign(storage.row(row), storage.row(row) + dimension_);
+        tombstone.norm = storage.norm(row);
+        tombstones_.emplace(node, std::move(tombstone));
+        row_of_node_[node] = VectorStorage::npos;
+
+        size_t last = storage.size() - 1;
+        if (row != last) {
+            uint32_t moved = node_of_row_[last];
+            node_of_row_[row] = moved;
+            row_of_node_[moved] = row;
+        }
+        node_of_row_.pop_back();
+    }
+
+    std::vector<RowHit> search(const VectorStorage& storage, const float* query, size_t k,
+                               const SearchParams& params, const RowBitmap* filter) const override {
+        return dispatchMetric(metric_, [&](auto metric) {
+            return searchTopK<decltype(metric)::value>(storage, query, k, efFor(params), filter);
+        });
+    }
+
+    std::vector<RowHit> searchRadius(const VectorStorage& storage, const float* query, float radius,
+                                     const SearchParams& params, const RowBitmap* filter) const override {
+        return dispatchMetric(metric_, [&](auto metric) {
+            return searchWithin<decltype(metric)::value>(storage, query, radius, efFor(params), filter);
+        });
+    }
+
+    double searchCost(const VectorStorage& storage, size_t k, const SearchParams& params) const override {
+        // Every expanded candidate scores its bottom-layer links
+        double ef = static_cast<double>(std::max(efFor(params), k));
+        return std::min(static_cast<double>(storage.size()), ef * static_cast<double>(max_links0_)) +
+               static_cast<double>(std::max(max_level_, 0)) * static_cast<double>(max_links_);
+    }
+
+    size_t memoryBytes() const override {
+        size_t bytes = links0_.capacity() * sizeof(uint32_t) + node_levels_.capacity() * sizeof(int) +
+                       row_of_node_.capacity() * sizeof(size_t) + node_of_row_.capacity() * sizeof(uint32_t);
+        for (const auto& layers : upper_links_) {
+            bytes += sizeof(layers) + layers.capacity() * sizeof(uint32_t);
+        }
+        bytes += tombstones_.size() * (sizeof(Tombstone) + dimension_ * sizeof(float));
+        return bytes;
+    }
+};
+
+// Inverted file index: a k-means coarse quantizer splits the rows into lists
+// around centroids, and a query scans only the nprobe lists whose centroids
+// are closest, ranking candidates with the exact metric. Centroids are trained
+// on a sample of the rows (spherical k-means for COSINE; DOT_PRODUCT trains
+// under L2, since inner-product assignment collapses onto the largest
+// centroid) and rows and queries are then assigned by the configured metric.
+// Over a compressed storage the lists hold codes and candidates are ranked by
+// the approximate code distance (IVF-PQ with the PQ encoding; codes are of the
+// vectors themselves, not of residuals to the centroid).
+// Training and bulk assignment run on the database worker pool. The index
+// answers by exact scan until enough rows exist to train on, and retrains
+// once the collection has grown well past the size it was trained at.
+class IVFIndex : public VectorIndex {
+private:
+    static constexpr size_t kMinTrainRows = 1024;
+    static constexpr size_t kMinRowsPerList = 4;
+    static constexpr size_t kTrainIterations = 10;
+    static constexpr size_t kRetrainGrowth = 8;
+    static constexpr size_t kAssignChunkRows = 1024;
+    static constexpr uint32_t kSeed = 0x5eed1234u;
+
+    DistanceMetric metric_;
+    DistanceKernels kernels_;
+    size_t dimension_;
+    size_t configured_lists_;
+    size_t nprobe_;
+    size_t train_sample_;
+    ThreadPool* pool_;
+
+    bool trained_ = false;
+    size_t trained_rows_ = 0;
+    std::vector<float> centroids_;  // lists_.size() rows of dimension_ floats
+    std::vector<float> centroid_norms_;
+    std::vector<std::vector<size_t>> lists_;
+    std::vector<uint32_t> row_list_;
+    std::vector<uint32_t> row_slot_;  // position of each row inside its list
+
+    size_t listCount() const { return lists_.size(); }
+    const float* centroid(size_t list) const { return centroids_.data() + list * dimension_; }
+
+    size_t minTrainRows() const {
+        return configured_lists_ != 0 ? std::max(configured_lists_ * kMinRowsPerList, kMinRowsPerList)
+                                      : kMinTrainRows;
+    }
+
+    // Run fn(begin, end) over chunks of [0, count) on the worker pool
+    template <typename Fn>
+    void parallelChunks(size_t count, Fn&& fn) const {
+        const size_t chunks = (count + kAssignChunkRows - 1) / kAssignChunkRows;
+        auto run = [&](size_t chunk) {
+            fn(chunk * kAssignChunkRows, std::min(count, (chunk + 1) * kAssignChunkRows));
+        };
+        if (pool_ && chunks > 1) {
+            pool_->parallelFor(chunks, run);
+        } else {
+            for (size_t chunk = 0; chunk < chunks; ++chunk) {
+                run(chunk);
+            }
+        }
+    }
+
+    // Distance from a vector to every centroid under Metric (Euclidean squared),
+    // four centroids per pass for the dot-product based metrics
+    template <DistanceMetric Metric>
+    void centroidDistances(const float* vector, float norm, float* out) const {
+        const size_t lists = listCount();
+        size_t list = 0;
+        if (Metric != DistanceMetric::MANHATTAN) {
+            float dots[4];
+            for (; list + 4 <= lists; list += 4) {
+                const float* group[4] = {centroid(list), centroid(list + 1), centroid(list + 2), centroid(list + 3)};
+                kernels_.dot4(vector, group, dimension_, dots);
+                for (size_t j = 0; j < 4; ++j) {
+                    out[list + j] = distanceFromDot<Metric>(dots[j], norm, centroid_norms_[list + j]);
+                }
+            }
+        }
+        for (; list < lists; ++list) {
+            out[list] = Metric == DistanceMetric::MANHATTAN
+                            ? kernels_.l1(vector, centroid(list), dimension_)
+                            : distanceFromDot<Metric>(kernels_.dot(vector, centroid(list), dimension_),
+                                                      norm, centroid_norms_[list]);
+        }
+    }
+
+    template <DistanceMetric Metric>
+    uint32_t nearestList(const float* vector, float norm, std::vector<float>& scratch) const {
+        scratch.resize(listCount());
+        centroidDistances<Metric>(vector, norm, scratch.data());
+        return static_cast<uint32_t>(std::min_element(scratch.begin(), scratch.end()) - scratch.begin());
+    }
+
+    // Nearest list of every row in rows[0, count), computed in parallel
+    template <DistanceMetric Metric>
+    void assignRows(const VectorStorage& storage, const size_t* rows, size_t count, uint32_t* out) const {
+        parallelChunks(count, [&](size_t begin, size_t end) {
+            std::vector<float> scratch;
+            std::vector<float> decoded(dimension_);
+            for (size_t i = begin; i < end; ++i) {
+                out[i] = nearestList<Metric>(storage.vector(rows[i], decoded.data()), storage.norm(rows[i]), scratch);
+            }
+        });
+    }
+
+    void updateNorms() {
+        centroid_norms_.resize(listCount());
+        for (size_t list = 0; list < listCount(); ++list) {
+            centroid_norms_[list] = std::sqrt(kernels_.dot(centroid(list), centroid(list), dimension_));
+        }
+    }
+
+    // Lloyd iterations on a random sample of the rows
+    template <DistanceMetric TrainMetric>
+    void train(const VectorStorage& storage, size_t lists) {
+        std::mt19937 rng(kSeed);
+        std::vector<size_t> sample(storage.size());
+        for (size_t row = 0; row < sample.size(); ++row) {
+            sample[row] = row;
+        }
+        const size_t sample_size = std::min(sample.size(), std::max(train_sample_, lists));
+        for (size_t i = 0; i < sample_size; ++i) {
+            std::uniform_int_distribution<size_t> pick(i, sample.size() - 1);
+            std::swap(sample[i], sample[pick(rng)]);
+        }
+        sample.resize(sample_size);
+
+        // Seed with the first sampled rows (already in random order)
+        std::vector<float> decoded(dimension_);
+        lists_.assign(lists, {});
+        centroids_.resize(lists * dimension_);
+        for (size_t list = 0; list < lists; ++list) {
+            const float* vector = storage.vector(sample[list], decoded.data());
+            std::copy(vector, vector + dimension_, centroids_.data() + list * dimension_);
+        }
+        updateNorms();
+
+        std::vector<uint32_t> assignment(sample_size);
+        std::vector<double> sums(lists * dimension_);
+        std::vector<size_t> counts(lists);
+        for (size_t iteration = 0; iteration < kTrainIterations; ++iteration) {
+            assignRows<TrainMetric>(storage, sample.data(), sample_size, assignment.data());
+
+            std::fill(sums.begin(), sums.end(), 0.0);
+            std::fill(counts.begin(), counts.end(), 0);
+            for (size_t i = 0; i < sample_size; ++i) {
+                const float* vector = storage.vector(sample[i], decoded.data());
+                double* sum = sums.data() + assignment[i] * dimension_;
+                for (size_t d = 0; d < dimension_; ++d) {
+                    sum[d] += vector[d];
+                }
+                ++counts[assignment[i]];
+            }
+
+            std::uniform_int_distribution<size_t> pick(0, sample_size - 1);
+            for (size_t list = 0; list < lists; ++list) {
+                float* target = centroids_.data() + list * dimension_;
+                if (counts[list] == 0) {
+                    // Reseed an empty list from a random sampled row
+                    const float* vector = storage.vector(sample[pick(rng)], decoded.data());
+                    std::copy(vector, vector + dimension_, target);
+                    continue;
+                }
+                for (size_t d = 0; d < dimension_; ++d) {
+                    target[d] = static_cast<float>(sums[list * dimension_ + d] / counts[list]);
+                }
+            }
+
+            if (metric_ == DistanceMetric::COSINE) {
+                for (size_t list = 0; list < lists; ++list) {
+                    float* target = centroids_.data() + list * dimension_;
+                    float norm = std::sqrt(kernels_.dot(target, target, dimension_));
+                    if (norm > 0.0f) {
+                        for (size_t d = 0; d < dimension_; ++d) {
+                            target[d] /= norm;
+                        }
+                    }
+                }
+            }
+            updateNorms();
+        }
+    }
+
+    void insertRow(size_t row, uint32_t list) {
+        row_list_[row] = list;
+        row_slot_[row] = static_cast<uint32_t>(lists_[list].size());
+        lists_[list].push_back(row);
+    }
+
+    void insertRow(const VectorStorage& storage, size_t row) {
+        std::vector<float> scratch;
+        std::vector<float> decoded(dimension_);
+        const float* vector = storage.vector(row, decoded.data());
+        uint32_t list = dispatchMetric(metric_, [&](auto metric) {
+            return nearestList<decltype(metric)::value>(vector, storage.norm(row), scratch);
+        });
+        insertRow(row, list);
+    }
+
+    void eraseRow(size_t row) {
+        std::vector<size_t>& list = lists_[row_list_[row]];
+        size_t moved = list.back();
+        list[row_slot_[row]] = moved;
+        row_slot_[moved] = row_slot_[row];
+        list.pop_back();
+    }
+
+    // Rows to scan for a query: all rows until trained, else the nprobe closest
+    // lists. A filter passing a fraction s of the rows widens nprobe by 1/s so
+    // about as many matching rows are scanned as without it.
+    template <DistanceMetric Metric, typename Visit>
+    void forEachCandidate(const VectorStorage& storage, const float* query, float query_norm,
+                          const SearchParams& params, const RowBitmap* filter, Visit&& visit) const {
+        SearchWork& work = SearchWork::local();
+        if (!trained_) {
+            if (filter) {
+                work.distances += filter->count();
+                filter->forEach(0, storage.size(), visit);
+                return;
+            }
+            work.distances += storage.size();
+            for (size_t row = 0; row < storage.size(); ++row) {
+                visit(row);
+            }
+            return;
+        }
+
+        work.distances += listCount();
+        std::vector<float> distances(listCount());
+        centroidDistances<Metric>(query, query_norm, distances.data());
+        std::vector<std::pair<float, uint32_t>> ranked(listCount());
+        for (size_t list = 0; list < listCount(); ++list) {
+            ranked[list] = {distances[list], static_cast<uint32_t>(list)};
+        }
+        size_t nprobe = nprobeFor(params);
+        if (filter) {
+            size_t matches = std::max<size_t>(1, filter->count());
+            nprobe = (nprobe * storage.size() + matches - 1) / matches;
+        }
+        nprobe = std::min(listCount(), nprobe);
+        std::partial_sort(ranked.begin(), ranked.begin() + nprobe, ranked.end());
+
+        work.nodes += nprobe;
+        for (size_t probe = 0; probe < nprobe; ++probe) {
+            for (size_t row : lists_[ranked[probe].second]) {
+                if (filter && !filter->test(row)) {
+                    continue;
+                }
+                ++work.distances;
+                visit(row);
+            }
+        }
+    }
+
+    size_t nprobeFor(const SearchParams& params) const {
+        return std::max<size_t>(1, params.nprobe != 0 ? params.nprobe : nprobe_);
+    }
+
+    template <DistanceMetric Metric>
+    std::vector<RowHit> searchTopK(const VectorStorage& storage, const float* query, size_t k,
+                                   const SearchParams& params, const RowBitmap* filter) const {
+        if (k == 0) {
+            return {};
+        }
+        TopKCollector top(k, storage.size());
+        float query_norm = std::sqrt(kernels_.dot(query, query, dimension_));
+        withRowDistance<Metric>(kernels_, storage, query, [&](const auto& distance_to) {
+            forEachCandidate<Metric>(storage, query, query_norm, params, filter, [&](size_t row) {
+                top.push(row, distance_to(row, top.threshold()));
+            });
+        });
+        return top.take();
+    }
+
+    template <DistanceMetric Metric>
+    std::vector<RowHit> searchWithin(const VectorStorage& storage, const float* query, float radius,
+                                     const SearchParams& params, const RowBitmap* filter) const {
+        std::vector<RowHit> hits;
+        float query_norm = std::sqrt(kernels_.dot(query, query, dimension_));
+        withRowDistance<Metric>(kernels_, storage, query, [&](const auto& distance_to) {
+            forEachCandidate<Metric>(storage, query, query_norm, params, filter, [&](size_t row) {
+                float distance = distance_to(row, radius);
+                if (distance <= radius) {
+                    hits.push_back({row, distance});
+                }
+            });
+        });
+        sortHits(hits);
+        return hits;
+    }
+
+public:
+    IVFIndex(DistanceMetric metric, const DistanceKernels& kernels, size_t dimension,
+             size_t lists, size_t nprobe, size_t train_sample, ThreadPool* pool)
+        : metric_(metric), kernels_(kernels), dimension_(dimension), configured_lists_(lists),
+          nprobe_(nprobe), train_sample_(std::max<size_t>(1, train_sample)), pool_(pool) {}
+
+    const char* name() const override { return "IVF"; }
+
+    void build(const VectorStorage& storage) override {
+        lists_.clear();
+        centroids_.clear();
+        centroid_norms_.clear();
+        row_list_.clear();
+        row_slot_.clear();
+
+        const size_t rows = storage.size();
+        if (rows < minTrainRows()) {
+            trained_ = false;
+            return;
+        }
+
+        size_t lists = configured_lists_ != 0
+                           ? configured_lists_
+                           : static_cast<size_t>(std::sqrt(static_cast<double>(rows)));
+        lists = std::max<size_t>(1, std::min(lists, rows));
+        DistanceMetric train_metric = metric_ == DistanceMetric::DOT_PRODUCT ? DistanceMetric::EUCLIDEAN : metric_;
+        dispatchMetric(train_metric, [&](auto metric) {
+            train<decltype(metric)::value>(storage, lists);
+        });
+
+        std::vector<size_t> all(rows);
+        for (size_t row = 0; row < rows; ++row) {
+            all[row] = row;
+        }
+        std::vector<uint32_t> assignment(rows);
+        dispatchMetric(metric_, [&](auto metric) {
+            assignRows<decltype(metric)::value>(storage, all.data(), rows, assignment.data());
+        });
+
+        row_list_.resize(rows);
+        row_slot_.resize(rows);
+        for (size_t row = 0; row < rows; ++row) {
+            insertRow(row, assignment[row]);
+        }
+        trained_ = true;
+        trained_rows_ = rows;
+    }
+
+    void add(const VectorStorage& storage, size_t row) override {
+        if (!trained_ ? storage.size() >= minTrainRows() : storage.size() > kRetrainGrowth * trained_rows_) {
+            build(storage);
+            return;
+        }
+        if (trained_) {
+            row_list_.resize(storage.size());
+            row_slot_.resize(storage.size());
+            insertRow(storage, row);
+        }
+    }
+
+    void update(const VectorStorage& storage, size_t row) override {
+        if (trained_) {
+            eraseRow(row);
+            insertRow(storage, row);
+        }
+    }
+
+    void remove(const VectorStorage& storage, size_t row) override {
+        if (!trained_) {
+            return;
+        }
+        size_t last = storage.size() - 1;
+        eraseRow(row);
+        if (row != last) {
+            lists_[row_list_[last]][row_slot_[last]] = row;
+            row_list_[row] = row_list_[last];
+            row_slot_[row] = row_slot_[last];
+        }
+        row_list_.pop_back();
+        row_slot_.pop_back();
+    }
+
+    std::vector<RowHit> search(const VectorStorage& storage, const float* query, size_t k,
+                               const SearchParams& params, const RowBitmap* filter) const override {
+        return dispatchMetric(metric_, [&](auto metric) {
+            return searchTopK<decltype(metric)::value>(storage, query, k, params, filter);
+        });
+    }
+
+    std::vector<RowHit> searchRadius(const VectorStorage& storage, const float* query, float radius,
+                                     const SearchParams& params, const RowBitmap* filter) const override {
+        return dispatchMetric(metric_, [&](auto metric) {
+            return searchWithin<decltype(metric)::value>(storage, query, radius, params, filter);
+        });
+    }
+
+    double searchCost(const VectorStorage& storage, size_t, const SearchParams& params) const override {
+        // Centroid ranking plus the rows of the probed lists
+        double rows = static_cast<double>(storage.size());
+        if (!trained_) {
+            return rows;
+        }
+        double lists = static_cast<double>(listCount());
+        return lists + std::min(rows, static_cast<double>(nprobeFor(params)) * rows / lists);
+    }
+
+    size_t memoryBytes() const override {
+        size_t bytes = (centroids_.capacity() + centroid_norms_.capacity()) * sizeof(float) +
+                       (row_list_.capacity() + row_slot_.capacity()) * sizeof(uint32_t);
+        for (const auto& list : lists_) {
+            bytes += sizeof(list) + list.capacity() * sizeof(size_t);
+        }
+        return bytes;
+    }
+};
+
+// LRU cache of search results, keyed by the query (its components rounded
+// to a grid when quantization > 0) and the search arguments. Entries belong
+// to a database generation: looking up or storing under a newer generation
+// drops everything cached before, so writers only bump a counter. Row hits
+// are cached rather than public results, which keeps entries small; rows
+// stay valid because every write changes the generation.
+class QueryCache {
+public:
+    enum class Kind : uint32_t { TOP_K, RADIUS };
+    using Key = std::vector<uint32_t>;
+    
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            uint64_t hash = 1469598103934665603ull;
+            for (uint32_t word : key) {
+                hash = (hash ^ word) * 1099511628211ull;
+            }
+            return static_cast<size_t>(hash ^ (hash >> 32));
+        }
+    };
+    
+    struct Entry {
+        std::vector<RowHit> hits;
+        std::list<const Key*>::iterator position;
+    };
+    
+    // Map and list node overhead charged to every entry
+    static constexpr size_t kEntryOverhead = 96;
+    
+    size_t capacity_;
+    float quantization_;
+    mutable std::mutex mutex_;
+    std::unordered_map<Key, Entry, KeyHash> entries_;
+    std::list<const Key*> lru_;  // most recently used first
+    uint64_t generation_ = 0;
+    size_t bytes_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    
+    static size_t entryBytes(const Key& key, const Entry& entry) {
+        return key.size() * sizeof(uint32_t) + entry.hits.size() * sizeof(RowHit) + kEntryOverhead;
+    }
+    
+    // Drop entries of older generations (caller holds mutex_); false if
+    // generation is itself older than the cache
+    bool advance(uint64_t generation) {
+        if (generation < generation_) {
+            return false;
+        }
+        if (generation > generation_) {
+            entries_.clear();
+            lru_.clear();
+            bytes_ = 0;
+            generation_ = generation;
+        }
+        return true;
+    }
+    
+    void erase(std::unordered_map<Key, Entry, KeyHash>::iterator it) {
+        bytes_ -= entryBytes(it->first, it->second);
+        lru_.erase(it->second.position);
+        entries_.erase(it);
+    }
+
+public:
+    QueryCache(size_t capacity, float quantization)
+        : capacity_(capacity), quantization_(quantization) {}
+    
+    // Key of a query: kind, k or the radius bits, the search knobs, then the
+    // query components (float bits, or grid cells when quantized)
+    Key key(Kind kind, uint64_t argument, const SearchParams& params, const std::vector<float>& query) const {
+        Key key;
+        key.reserve(7 + query.size());
+        key.push_back(static_cast<uint32_t>(kind));
+        for (uint64_t value : {argument, static_cast<uint64_t>(params.ef_search), static_cast<uint64_t>(params.nprobe)}) {
+            key.push_back(static_cast<uint32_t>(value));
+            key.push_back(static_cast<uint32_t>(value >> 32));
+        }
+        for (float value : query) {
+            if (quantization_ > 0.0f) {
+                key.push_back(static_cast<uint32_t>(static_cast<int32_t>(std::lround(value / quantization_))));
+            } else {
+                uint32_t bits;
+                value += 0.0f;  // -0 and +0 share a key
+                std::memcpy(&bits, &value, sizeof(bits));
+                key.push_back(bits);
+            }
+        }
+        return key;
+    }
+    
+    bool lookup(const Key& key, uint64_t generation, std::vector<RowHit>& hits) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = advance(generation) ? entries_.find(key) : entries_.end();
+        if (it == entries_.end()) {
+            ++misses_;
+            return false;
+        }
+        ++hits_;
+        lru_.splice(lru_.begin(), lru_, it->second.position);
+        hits = it->second.hits;
+        return true;
+    }
+    
+    void insert(Key key, uint64_t generation, const std::vector<RowHit>& hits) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!advance(generation)) {
+            return;
+        }
+        auto existing = entries_.find(key);
+        if (existing != entries_.end()) {
+            erase(existing);
+        }
+        
+        auto it = entries_.emplace(std::move(key), Entry{hits, {}}).first;
+        lru_.push_front(&it->first);
+        it->second.position = lru_.begin();
+        bytes_ += entryBytes(it->first, it->second);
+        
+        while (entries_.size() > capacity_) {
+            erase(entries_.find(*lru_.back()));
+        }
+    }
+    
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats;
+        stats.hits = hits_;
+        stats.misses = misses_;
+        stats.entries = entries_.size();
+        stats.bytes = bytes_;
+        return stats;
+    }
+};
+
+// Operations timed by DatabaseMetrics. INSERT_BATCH covers insert_batch and
+// upsert_batch, LOAD covers load and import_file.
+enum class DatabaseOperation {
+    INSERT,
+    INSERT_BATCH,
+    UPSERT,
+    REMOVE,
+    SEARCH,
+    SEARCH_RADIUS,
+    SEARCH_BATCH,
+    LOAD,
+    SAVE
+};
+
+constexpr size_t kDatabaseOperations = 9;
+
+inline const char* operationName(DatabaseOperation operation) {
+    static const char* const names[kDatabaseOperations] = {
+        "insert", "insert_batch", "upsert", "remove", "search", "search_radius", "search_batch", "load", "save"};
+    return names[static_cast<size_t>(operation)];
+}
+
+// Call count, total time and latency histogram of one operation. Bucket i
+// counts calls that took less than 2^i microseconds; the last bucket holds
+// everything slower.
+struct OperationStats {
+    static constexpr size_t kBuckets = 28;
+    
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    std::array<uint64_t, kBuckets> buckets{};
+    
+    // Upper bound of a bucket in microseconds (infinity for the last)
+    static double bucketBoundMicros(size_t bucket) {
+        return bucket + 1 < kBuckets ? std::ldexp(1.0, static_cast<int>(bucket))
+                                     : std::numeric_limits<double>::infinity();
+    }
+    
+    static size_t bucketOf(uint64_t nanoseconds) {
+        size_t bucket = 0;
+        while (bucket + 1 < kBuckets && (uint64_t(1000) << bucket) <= nanoseconds) {
+            ++bucket;
+        }
+        return bucket;
+    }
+    
+    double meanMicros() const {
+        return count ? static_cast<double>(total_ns) / 1000.0 / static_cast<double>(count) : 0.0;
+    }
+    
+    // Upper bound of the bucket holding the given quantile (0..1), in microseconds
+    double percentileMicros(double quantile) const {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(quantile * static_cast<double>(count)));
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < kBuckets; ++bucket) {
+            seen += buckets[bucket];
+            if (seen >= std::max<uint64_t>(1, rank)) {
+                return bucketBoundMicros(bucket);
+            }
+        }
+        return 0.0;
+    }
+    
+    OperationStats& operator+=(const OperationStats& other) {
+        count += other.count;
+        total_ns += other.total_ns;
+        for (size_t bucket = 0; bucket < kBuckets; ++bucket) {
+            buckets[bucket] += other.buckets[bucket];
+        }
+        return *this;
+    }
+};
+
+// Point-in-time statistics of a database, returned by stats(). Counters are
+// totals since the database was created; prometheus() renders them in the
+// Prometheus text exposition format.
+struct DatabaseStats {
+    size_t vectors = 0;
+    size_t deleted = 0;  // tombstoned rows awaiting compaction
+    size_t capacity = 0;
+    size_t dimension = 0;
+    size_t memory_bytes = 0;  // vectors, IDs, attributes, index and query cache
+    size_t mapped_bytes = 0;  // memory-mapped vectors, not in memory_bytes
+    std::array<OperationStats, kDatabaseOperations> operations{};
+    uint64_t queries = 0;  // queries searched, counting each query of a batch
+    uint64_t distance_evaluations = 0;
+    uint64_t index_nodes_visited = 0;
+    ReadWriteMutex::WaitStats lock_waits;
+    QueryCache::Stats query_cache;
+    BatchScheduler<SearchResult>::Stats async;
+    
+    const OperationStats& operation(DatabaseOperation op) const { return operations[static_cast<size_t>(op)]; }
+    
+    double distancesPerQuery() const {
+        return queries ? static_cast<double>(distance_evaluations) / static_cast<double>(queries) : 0.0;
+    }
+    
+    double nodesPerQuery() const {
+        return queries ? static_cast<double>(index_nodes_visited) / static_cast<double>(queries) : 0.0;
+    }
+    
+    double cacheHitRate() const {
+        uint64_t lookups = query_cache.hits + query_cache.misses;
+        return lookups ? static_cast<double>(query_cache.hits) / static_cast<double>(lookups) : 0.0;
+    }
+    
+    // Sum of two databases' statistics (e.g. the shards of one collection)
+    DatabaseStats& operator+=(const DatabaseStats& other) {
+        vectors += other.vectors;
+        deleted += other.deleted;
+        capacity += other.capacity;
+        memory_bytes += other.memory_bytes;
+        mapped_bytes += other.mapped_bytes;
+        for (size_t op = 0; op < kDatabaseOperations; ++op) {
+            operations[op] += other.operations[op];
+        }
+        queries += other.queries;
+        distance_evaluations += other.distance_evaluations;
+        index_nodes_visited += other.index_nodes_visited;
+        lock_waits.read_waits += other.lock_waits.read_waits;
+        lock_waits.read_wait_ns += other.lock_waits.read_wait_ns;
+        lock_waits.write_waits += other.lock_waits.write_waits;
+        lock_waits.write_wait_ns += other.lock_waits.write_wait_ns;
+        query_cache.hits += other.query_cache.hits;
+        query_cache.misses += other.query_cache.misses;
+        query_cache.entries += other.query_cache.entries;
+        query_cache.bytes += other.query_cache.bytes;
+        async.requests += other.async.requests;
+        async.batches += other.async.batches;
+        return *this;
+    }
+    
+    // Operation latencies, search work per query and lock waits, as lines of
+    // print_stats(); nothing for a database that has not been used yet
+    void printActivity(std::ostream& out) const {
+        const std::ios::fmtflags flags = out.flags();
+        const std::streamsize precision = out.precision();
+        out << std::fixed << std::setprecision(1);
+        auto bound = [](double micros) {
+            return std::isinf(micros) ? std::string("inf") : std::to_string(static_cast<uint64_t>(micros));
+        };
+        
+        bool any = false;
+        for (size_t op = 0; op < kDatabaseOperations; ++op) {
+            const OperationStats& stats = operations[op];
+            if (stats.count == 0) {
+                continue;
+            }
+            if (!any) {
+                out << "Operations (latency in us, percentiles as bucket bounds):" << std::endl;
+                any = true;
+            }
+            out << "  " << operationName(static_cast<DatabaseOperation>(op)) << ": " << stats.count
+                << " calls, mean " << stats.meanMicros() << ", p50 <= " << bound(stats.percentileMicros(0.5))
+                << ", p99 <= " << bound(stats.percentileMicros(0.99)) << std::endl;
+        }
+        if (queries > 0) {
+            out << "Search Work: " << distancesPerQuery() << " distances and " << nodesPerQuery()
+                << " index nodes per query" << std::endl;
+        }
+        if (lock_waits.read_waits + lock_waits.write_waits > 0) {
+            out << "Lock Waits: " << lock_waits.read_waits << " read (" << lock_waits.read_wait_ns / 1000000
+                << " ms), " << lock_waits.write_waits << " write (" << lock_waits.write_wait_ns / 1000000
+                << " ms)" << std::endl;
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+    
+    // Metrics named <prefix>_..., with HELP and TYPE lines, for a scrape endpoint
+    std::string prometheus(const std::string& prefix = "vectordb") const {
+        std::ostringstream out;
+        out << std::setprecision(10);
+        auto header = [&](const std::string& name, const char* type, const char* help) {
+            out << "# HELP " << prefix << "_" << name << " " << help << "\n";
+            out << "# TYPE " << prefix << "_" << name << " " << type << "\n";
+        };
+        auto metric = [&](const std::string& name, const char* type, const char* help, double value) {
+            header(name, type, help);
+            out << prefix << "_" << name << " " << value << "\n";
+        };
+        
+        header("operation_duration_seconds", "histogram", "Latency of database operations.");
+        for (size_t op = 0; op < kDatabaseOperations; ++op) {
+            const OperationStats& stats = operations[op];
+            const std::string label = std::string("operation=\"") + operationName(static_cast<DatabaseOperation>(op)) + "\"";
+            uint64_t cumulative = 0;
+            for (size_t bucket = 0; bucket < OperationStats::kBuckets; ++bucket) {
+                cumulative += stats.buckets[bucket];
+                out << prefix << "_operation_duration_seconds_bucket{" << label << ",le=\"";
+                if (bucket + 1 < OperationStats::kBuckets) {
+                    out << OperationStats::bucketBoundMicros(bucket) / 1e6;
+                } else {
+                    out << "+Inf";
+                }
+                out << "\"} " << cumulative << "\n";
+            }
+            out << prefix << "_operation_duration_seconds_sum{" << label << "} " << stats.total_ns / 1e9 << "\n";
+            out << prefix << "_operation_duration_seconds_count{" << label << "} " << stats.count << "\n";
+        }
+        
+        metric("vectors", "gauge", "Live vectors stored.", static_cast<double>(vectors));
+        metric("deleted_vectors", "gauge", "Deleted vectors awaiting compaction.", static_cast<double>(deleted));
+        metric("memory_bytes", "gauge", "Approximate bytes held in memory.", static_cast<double>(memory_bytes));
+        metric("mapped_bytes", "gauge", "Bytes of memory-mapped vectors.", static_cast<double>(mapped_bytes));
+        metric("search_queries_total", "counter", "Queries searched, each query of a batch counted.",
+               static_cast<double>(queries));
+        metric("distance_evaluations_total", "counter", "Distances computed by searches.",
+               static_cast<double>(distance_evaluations));
+        metric("index_nodes_visited_total", "counter", "Index nodes, lists or buckets visited by searches.",
+               static_cast<double>(index_nodes_visited));
+        
+        header("lock_waits_total", "counter", "Lock acquisitions that had to wait.");
+        out << prefix << "_lock_waits_total{mode=\"read\"} " << lock_waits.read_waits << "\n";
+        out << prefix << "_lock_waits_total{mode=\"write\"} " << lock_waits.write_waits << "\n";
+        header("lock_wait_seconds_total", "counter", "Time spent waiting for the database lock.");
+        out << prefix << "_lock_wait_seconds_total{mode=\"read\"} " << lock_waits.read_wait_ns / 1e9 << "\n";
+        out << prefix << "_lock_wait_seconds_total{mode=\"write\"} " << lock_waits.write_wait_ns / 1e9 << "\n";
+        
+        metric("query_cache_hits_total", "counter", "Query cache hits.", static_cast<double>(query_cache.hits));
+        metric("query_cache_misses_total", "counter", "Query cache misses.", static_cast<double>(query_cache.misses));
+        metric("query_cache_entries", "gauge", "Entries in the query cache.", static_cast<double>(query_cache.entries));
+        metric("async_requests_total", "counter", "Queries submitted through search_async.",
+               static_cast<double>(async.requests));
+        metric("async_batches_total", "counter", "Batch passes that answered async queries.",
+               static_cast<double>(async.batches));
+        return out.str();
+    }
+};
+
+// Operation counters and latency histograms of one database. Writers add to
+// one of kStripes cache-line sized stripes picked per thread, so concurrent
+// operations do not contend on a counter; stats() sums the stripes on read.
+class DatabaseMetrics {
+private:
+    static constexpr size_t kStripes = 8;
+    
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> counts[kDatabaseOperations];
+        std::atomic<uint64_t> total_ns[kDatabaseOperations];
+        std::atomic<uint64_t> buckets[kDatabaseOperations][OperationStats::kBuckets];
+        std::atomic<uint64_t> queries;
+        std::atomic<uint64_t> distances;
+        std::atomic<uint64_t> nodes;
+    };
+    
+    Stripe stripes_[kStripes]{};
+    
+    static size_t stripeIndex() {
+        static std::atomic<size_t> next_thread{0};
+        thread_local size_t index = next_thread.fetch_add(1, std::memory_order_relaxed) % kStripes;
+        return index;
+    }
+    
+    void record(DatabaseOperation operation, uint64_t nanoseconds, uint64_t queries, const SearchWork& work) {
+        Stripe& stripe = stripes_[stripeIndex()];
+        size_t op = static_cast<size_t>(operation);
+        stripe.counts[op].fetch_add(1, std::memory_order_relaxed);
+        stripe.total_ns[op].fetch_add(nanoseconds, std::memory_order_relaxed);
+        stripe.buckets[op][OperationStats::bucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        if (queries > 0) {
+            stripe.queries.fetch_add(queries, std::memory_order_relaxed);
+            stripe.distances.fetch_add(work.distances, std::memory_order_relaxed);
+            stripe.nodes.fetch_add(work.nodes, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    // Times one operation from construction to destruction. For searches
+    // (queries > 0) the search work done on the calling thread in between
+    // is recorded too; work of other operations, such as the distances an
+    // HNSW insert computes, is not.
+    class Timer {
+    private:
+        DatabaseMetrics& metrics_;
+        DatabaseOperation operation_;
+        uint64_t queries_;
+        SearchWork saved_;
+        std::chrono::steady_clock::time_point start_;
+    
+    public:
+        Timer(DatabaseMetrics& metrics, DatabaseOperation operation, uint64_t queries)
+            : metrics_(metrics), operation_(operation), queries_(queries), saved_(SearchWork::local()),
+              start_(std::chrono::steady_clock::now()) {
+            SearchWork::local() = SearchWork();
+        }
+        
+        ~Timer() {
+            auto elapsed = std::chrono::steady_clock::now() - start_;
+            SearchWork work = SearchWork::local();
+            SearchWork::local() = saved_;
+            metrics_.record(operation_,
+                            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()),
+                            queries_, work);
+        }
+        
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+    };
+    
+    DatabaseMetrics() = default;
+    DatabaseMetrics(const DatabaseMetrics&) = delete;
+    DatabaseMetrics& operator=(const DatabaseMetrics&) = delete;
+    
+    Timer time(DatabaseOperation operation, uint64_t queries = 0) { return Timer(*this, operation, queries); }
+    
+    // Add the operation and search counters to stats
+    void collect(DatabaseStats& stats) const {
+        for (const Stripe& stripe : stripes_) {
+            for (size_t op = 0; op < kDatabaseOperations; ++op) {
+                OperationStats& operation = stats.operations[op];
+                operation.count += stripe.counts[op].load(std::memory_order_relaxed);
+                operation.total_ns += stripe.total_ns[op].load(std::memory_order_relaxed);
+                for (size_t bucket = 0; bucket < OperationStats::kBuckets; ++bucket) {
+                    operation.buckets[bucket] += stripe.buckets[op][bucket].load(std::memory_order_relaxed);
+                }
+            }
+            stats.queries += stripe.queries.load(std::memory_order_relaxed);
+            stats.distance_evaluations += stripe.distances.load(std::memory_order_relaxed);
+            stats.index_nodes_visited += stripe.nodes.load(std::memory_order_relaxed);
+        }
+    }
+};
+
+// Writes made while VectorDatabase::rebuild_index() builds a new storage
+// and index, in order, for replay on them before they are swapped in.
+// Writers record under the database write lock; the rebuild drains the
+// entries without it. Entries use the write-ahead log's operations. Once the
+// entries not yet drained exceed max_bytes the delta overflows: they are
+// dropped, nothing more is recorded and the rebuild fails, so writes that
+// outpace the rebuild cannot exhaust memory.
+class RebuildDelta {
+public:
+    struct Entry {
+        WriteAheadLog::Op op;
+        std::string id;
+        std::vector<float> values;
+        Attributes attributes;
+    };
+
+private:
+    std::mutex mutex_;
+    std::vector<Entry> entries_;
+    size_t max_bytes_;
+    size_t bytes_ = 0;
+    bool overflowed_ = false;
+    bool replaced_ = false;
+    
+    // Approximate memory held by an entry (attribute map nodes estimated)
+    static size_t entryBytes(const Entry& entry) {
+        size_t bytes = sizeof(Entry) + entry.id.size() + entry.values.size() * sizeof(float);
+        for (const auto& attribute : entry.attributes) {
+            bytes += 4 * sizeof(void*) + sizeof(attribute) + attribute.first.size();
+            if (const std::string* text = std::get_if<std::string>(&attribute.second)) {
+                bytes += text->size();
+            }
+        }
+        return bytes;
+    }
+
+public:
+    explicit RebuildDelta(size_t max_bytes) : max_bytes_(max_bytes) {}
+    
+    void record(WriteAheadLog::Op op, std::string id, const float* values = nullptr, size_t dimension = 0,
+                const Attributes& attributes = Attributes()) {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (overflowed_) {
+                return;
+            }
+        }
+        Entry entry{op, std::move(id), {}, attributes};
+        if (values) {
+            entry.values.assign(values, values + dimension);
+        }
+        const size_t bytes = entryBytes(entry);
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (overflowed_ || bytes_ + bytes > max_bytes_) {
+            overflowed_ = true;
+            std::vector<Entry>().swap(entries_);
+            bytes_ = 0;
+            return;
+        }
+        entries_.push_back(std::move(entry));
+        bytes_ += bytes;
+    }
+    
+    // Writes came in faster than the rebuild replayed them
+    bool overflowed() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return overflowed_;
+    }
+    
+    size_t size() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return entries_.size();
+    }
+
+    // load() or import_file() swapped in new data, so the copy is stale
+    void markReplaced() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        replaced_ = true;
+    }
+
+    bool replaced() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return replaced_;
+    }
+
+    // The entries recorded since the last call
+    std::vector<Entry> take() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        std::vector<Entry> entries;
+        entries.swap(entries_);
+        bytes_ = 0;
+        return entries;
+    }
+};
+
+class VectorDatabase {
+private:
+    using ReadLock = std::shared_lock<ReadWriteMutex>;
+    using WriteLock = std::unique_lock<ReadWriteMutex>;
+    
+    size_t dimension_;
+    VectorDatabaseConfig config_;
+    VectorStorage storage_;
+    DistanceKernels kernels_;
+    // Search structure for config_.index_type; null means linear scan
+    std::unique_ptr<VectorIndex> index_;
+    // Readers (search, get_vector, exists, ...) share the lock; writers hold it exclusively
+    mutable ReadWriteMutex database_mutex_;
+    mutable std::once_flag pool_once_;
+    mutable std::unique_ptr<ThreadPool> pool_;
+    // Durability (config_.durability_path): the log of writes since the last
+    // checkpoint and the background tasks that sync it and fold it into the
+    // snapshot. Checkpoints are serialized by checkpoint_mutex_.
+    std::unique_ptr<WriteAheadLog> wal_;
+    std::mutex checkpoint_mutex_;
+    std::unique_ptr<PeriodicTask> wal_sync_task_;
+    std::unique_ptr<PeriodicTask> checkpoint_task_;
+    // Started by the first tombstone, compacts once compaction_threshold is reached
+    std::unique_ptr<PeriodicTask> compaction_task_;
+    // Bumped under the write lock by every change to the rows, which
+    // invalidates the query cache (config_.query_cache_entries > 0)
+    uint64_t generation_ = 0;
+    std::unique_ptr<QueryCache> query_cache_;
+    // Micro-batching scheduler behind search_async(), started by its first call
+    mutable std::mutex async_mutex_;
+    mutable std::unique_ptr<BatchScheduler<SearchResult>> async_scheduler_;
+    // Operation latencies and search work, read through stats()
+    mutable DatabaseMetrics metrics_;
+    // Set while rebuild_index() runs (under the write lock); writes are then
+    // recorded into it, rows are tombstoned rather than moved, and compaction
+    // waits, so row numbers stay valid for the rebuild's chunked copy
+    std::unique_ptr<RebuildDelta> rebuild_delta_;
+    std::mutex rebuild_mutex_;
+    
+    // rebuild_index() copies this many rows per read lock, and swaps once a
+    // catch-up round replays no more writes than rebuild_swap_entries; it
+    // gives up if that has not happened after kRebuildCatchUpRounds
+    static constexpr size_t kRebuildCopyRows = 16384;
+    static constexpr size_t kRebuildCatchUpRounds = 8;
+    
+    // Scans smaller than this many floats are not worth splitting across threads
+    static constexpr size_t kParallelScanMinFloats = size_t(1) << 18;
+    static constexpr size_t kParallelScanMinRows = 1024;
+    
+    // Batched search scores blocks of roughly this many bytes against all queries
+    static constexpr size_t kBatchBlockBytes = size_t(256) * 1024;
+    
+    // Bulk imports read and parse files in chunks of about this many bytes
+    static constexpr size_t kImportChunkBytes = size_t(16) << 20;
+    
+    // Distance calculation functions (both operands hold dimension_ floats)
+    float calculateEuclideanDistance(const float* a, const float* b) const {
+        return std::sqrt(kernels_.l2_squared(a, b, dimension_));
+    }
+    
+    float calculateCosineDistance(const float* a, const float* b) const {
+        return kernels_.cosine(a, b, dimension_);  // 1 - cosine similarity
+    }
+    
+    float calculateManhattanDistance(const float* a, const float* b) const {
+        return kernels_.l1(a, b, dimension_);
+    }
+    
+    float calculateDotProductDistance(const float* a, const float* b) const {
+        return -kernels_.dot(a, b, dimension_);  // Negative because we want higher dot products to be "closer"
+    }
+    
+    float calculateDistance(const float* a, const float* b) const {
+        switch (config_.distance_metric) {
+            case DistanceMetric::EUCLIDEAN:
+                return calculateEuclideanDistance(a, b);
+            case DistanceMetric::COSINE:
+                return calculateCosineDistance(a, b);
+            case DistanceMetric::MANHATTAN:
+                return calculateManhattanDistance(a, b);
+            case DistanceMetric::DOT_PRODUCT:
+                return calculateDotProductDistance(a, b);
+            default:
+                return calculateEuclideanDistance(a, b);
+        }
+    }
+    
+    // Resolve the configured metric once and invoke fn with it as a compile-time constant
+    template <typename Fn>
+    decltype(auto) dispatchMetric(Fn&& fn) const {
+        return ::dispatchMetric(config_.distance_metric, std::forward<Fn>(fn));
+    }
+    
+    // Call fn(row) for rows [begin, end), only those set in filter if given
+    template <typename Fn>
+    static void forEachRow(size_t begin, size_t end, const RowBitmap* filter, Fn&& fn) {
+        if (filter) {
+            filter->forEach(begin, end, fn);
+            return;
+        }
+        for (size_t row = begin; row < end; ++row) {
+            fn(row);
+        }
+    }
+    
+    // Linear top-k scan over rows [begin, end) specialized per metric (caller holds database_mutex_)
+    template <DistanceMetric Metric>
+    std::vector<RowHit> scanTopK(const float* query, size_t k, size_t begin, size_t end,
+                                 const RowBitmap* filter = nullptr) const {
+        if (k == 0) {
+            return {};
+        }
+        
+        TopKCollector top(k, end - begin);
+        uint64_t evaluated = 0;
+        
+        // Sequential pass over the contiguous vector (or code) slab
+        withRowDistance<Metric>(kernels_, storage_, query, [&](const auto& distance_to) {
+            forEachRow(begin, end, filter, [&](size_t row) {
+                ++evaluated;
+                top.push(row, distance_to(row, top.threshold()));
+            });
+        });
+        
+        SearchWork::local().distances += evaluated;
+        return top.take();
+    }
+    
+    // Linear radius scan over rows [begin, end) specialized per metric (caller holds database_mutex_)
+    template <DistanceMetric Metric>
+    std::vector<RowHit> scanRadius(const float* query, float radius, size_t begin, size_t end,
+                                   const RowBitmap* filter = nullptr) const {
+        std::vector<RowHit> hits;
+        uint64_t evaluated = 0;
+        
+        withRowDistance<Metric>(kernels_, storage_, query, [&](const auto& distance_to) {
+            forEachRow(begin, end, filter, [&](size_t row) {
+                ++evaluated;
+                float distance = distance_to(row, radius);
+                if (distance <= radius) {
+                    hits.push_back({row, distance});
+                }
+            });
+        });
+        
+        SearchWork::local().distances += evaluated;
+        return hits;
+    }
+    
+    // stats() with the lock held
+    DatabaseStats statsLocked() const {
+        DatabaseStats stats;
+        stats.vectors = storage_.liveSize();
+        stats.deleted = storage_.deletedCount();
+        stats.capacity = config_.max_vectors;
+        stats.dimension = dimension_;
+        stats.query_cache = query_cache_stats();
+        stats.memory_bytes = storage_.vectorBytes() + storage_.idBytes() + storage_.attributes().memoryBytes() +
+                             (index_ ? index_->memoryBytes() : 0) + stats.query_cache.bytes;
+        stats.mapped_bytes = storage_.mapped() ? storage_.mappedBytes() : 0;
+        stats.lock_waits = database_mutex_.waitStats();
+        stats.async = async_search_stats();
+        metrics_.collect(stats);
+        return stats;
+    }
+    
+    // Worker pool for intra-query parallelism, created on first use
+    ThreadPool* threadPool() const {
+        size_t threads = config_.thread_count;
+        if (threads <= 1) {
+            return nullptr;
+        }
+        std::call_once(pool_once_, [this, threads] {
+            std::function<void()> pin;
+            if (config_.numa_node >= 0) {
+                pin = [node = static_cast<size_t>(config_.numa_node)] { NumaTopology::system().pinCurrentThread(node); };
+            }
+            pool_ = std::make_unique<ThreadPool>(threads - 1, std::move(pin));
+        });
+        return pool_.get();
+    }
+    
+    BatchScheduler<SearchResult>& asyncScheduler() const {
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        if (!async_scheduler_) {
+            async_scheduler_ = std::make_unique<BatchScheduler<SearchResult>>(
+                [this](const std::vector<std::vector<float>>& queries, size_t k, const SearchParams& params) {
+                    return search_batch(queries, k, params);
+                },
+                config_.async_max_batch, std::chrono::microseconds(config_.async_max_wait_us));
+        }
+        return *async_scheduler_;
+    }
+    
+    // Number of row partitions to scan in parallel (1 = stay on the calling thread)
+    size_t scanPartitions(size_t rows, size_t query_count = 1) const {
+        if (config_.thread_count <= 1 || rows < kParallelScanMinRows ||
+            rows * dimension_ * query_count < kParallelScanMinFloats) {
+            return 1;
+        }
+        return std::min(config_.thread_count, rows / (kParallelScanMinRows / 2));
+    }
+    
+    // Run fn(part, begin, end) for each contiguous row range, in parallel when
+    // possible. The search work of the partitions is counted on the caller.
+    template <typename Fn>
+    void forEachPartition(size_t partitions, Fn&& fn) const {
+        const size_t rows = storage_.size();
+        
+        ThreadPool* pool = partitions > 1 ? threadPool() : nullptr;
+        if (pool) {
+            std::vector<SearchWork> work(partitions);
+            pool->parallelFor(partitions, [&](size_t part) {
+                work[part] = SearchWork::measure([&] {
+                    fn(part, rows * part / partitions, rows * (part + 1) / partitions);
+                });
+            });
+            for (const SearchWork& done : work) {
+                SearchWork::local() += done;
+            }
+        } else {
+            for (size_t part = 0; part < partitions; ++part) {
+                fn(part, rows * part / partitions, rows * (part + 1) / partitions);
+            }
+        }
+    }
+    
+    // Collect scan(begin, end) for each partition
+    template <typename Scan>
+    std::vector<std::vector<RowHit>> scanPartitioned(size_t partitions, Scan&& scan) const {
+        std::vector<std::vector<RowHit>> partial(partitions);
+        forEachPartition(partitions, [&](size_t part, size_t begin, size_t end) {
+            partial[part] = scan(begin, end);
+        });
+        return partial;
+    }
+    
+    // Rows a search may return: those set in filter (the live rows are known)
+    size_t matchCount(const RowBitmap* filter) const {
+        if (!filter) {
+            return storage_.size();
+        }
+        return filter == storage_.liveRows() ? storage_.liveSize() : filter->count();
+    }
+    
+    // Filtered search plan: traverse the index, skipping rows outside the
+    // filter, or brute-force only the matching rows. To collect k matches when
+    // a fraction s of the rows pass, the index visits about searchCost / s
+    // rows, while the scan visits each of the matches once.
+    bool filterInIndex(size_t matches, size_t k, const SearchParams& params) const {
+        if (!index_ || matches == 0) {
+            return false;
+        }
+        double selectivity = static_cast<double>(matches) / static_cast<double>(storage_.size());
+        return index_->searchCost(storage_, k, params) / selectivity < static_cast<double>(matches);
+    }
+    
+    // Top-k from the index or a linear scan, before any re-ranking; with a
+    // filter only rows set in it are returned
+    std::vector<RowHit> collectRows(const std::vector<float>& query, size_t k, const SearchParams& params,
+                                    const RowBitmap* filter = nullptr) const {
+        if (!filter) filter = storage_.liveRows();
+        const size_t matches = matchCount(filter);
+        if (index_ && (!filter || filterInIndex(matches, k, params))) {
+            // Approximate indexes (and filtered traversals) can run out of
+            // candidates; fall back to the scan rather than return a short list
+            std::vector<RowHit> hits = index_->search(storage_, query.data(), k, params, filter);
+            if (hits.size() >= std::min(k, matches)) {
+                return hits;
+            }
+        }
+        
+        const size_t rows = storage_.size();
+        const size_t partitions = scanPartitions(matches);
+        
+        if (partitions == 1) {
+            return dispatchMetric([&](auto metric) {
+                return scanTopK<decltype(metric)::value>(query.data(), k, 0, rows, filter);
+            });
+        }
+        
+        // Per-partition top-k results, merged into the global top-k
+        auto partial = scanPartitioned(partitions, [&](size_t begin, size_t end) {
+            return dispatchMetric([&](auto metric) {
+                return scanTopK<decltype(metric)::value>(query.data(), k, begin, end, filter);
+            });
+        });
+        
+        return mergeTopK(partial, k);
+    }
+    
+    std::vector<RowHit> collectRadiusRows(const std::vector<float>& query, float radius, const SearchParams& params,
+                                          const RowBitmap* filter = nullptr) const {
+        if (!filter) filter = storage_.liveRows();
+        const size_t matches = matchCount(filter);
+        if (index_ && (!filter || filterInIndex(matches, 1, params))) {
+            return index_->searchRadius(storage_, query.data(), radius, params, filter);
+        }
+        
+        const size_t partitions = scanPartitions(matches);
+        
+        auto partial = scanPartitioned(partitions, [&](size_t begin, size_t end) {
+            return dispatchMetric([&](auto metric) {
+                return scanRadius<decltype(metric)::value>(query.data(), radius, begin, end, filter);
+            });
+        });
+        
+        std::vector<RowHit> hits;
+        if (partial.size() == 1) {
+            hits = std::move(partial.front());
+        } else {
+            for (const auto& part : partial) {
+                hits.insert(hits.end(), part.begin(), part.end());
+            }
+        }
+        sortHits(hits);
+        return hits;
+    }
+    
+    // Quantized storage with a full-precision file re-ranks the best candidates exactly
+    bool reranks() const {
+        return storage_.quantized() && storage_.hasFullPrecision() && config_.rerank_candidates > 0;
+    }
+    
+    // Replace approximate distances with exact ones read from the full-precision file
+    void rerankExact(const float* query, std::vector<RowHit>& hits) const {
+        std::vector<float> exact(dimension_);
+        SearchWork::local().distances += hits.size();
+        dispatchMetric([&](auto metric) {
+            const RowDistance<decltype(metric)::value> distance_to(kernels_, storage_, query);
+            for (RowHit& hit : hits) {
+                if (storage_.copyVector(hit.row, exact.data())) {
+                    hit.distance = distance_to.withNorm(exact.data(), storage_.norm(hit.row));
+                }
+            }
+        });
+        sortHits(hits);
+    }
+    
+    // Unfiltered searches go through the query cache when it is enabled
+    std::vector<RowHit> searchRows(const std::vector<float>& query, size_t k, const SearchParams& params,
+                                   const RowBitmap* filter = nullptr) const {
+        if (query_cache_ && !filter) {
+            QueryCache::Key key = query_cache_->key(QueryCache::Kind::TOP_K, k, params, query);
+            std::vector<RowHit> hits;
+            if (!query_cache_->lookup(key, generation_, hits)) {
+                hits = searchRowsUncached(query, k, params, nullptr);
+                query_cache_->insert(std::move(key), generation_, hits);
+            }
+            return hits;
+        }
+        return searchRowsUncached(query, k, params, filter);
+    }
+    
+    std::vector<RowHit> searchRadiusRows(const std::vector<float>& query, float radius, const SearchParams& params,
+                                         const RowBitmap* filter = nullptr) const {
+        if (query_cache_ && !filter) {
+            uint32_t radius_bits;
+            std::memcpy(&radius_bits, &radius, sizeof(radius_bits));
+            QueryCache::Key key = query_cache_->key(QueryCache::Kind::RADIUS, radius_bits, params, query);
+            std::vector<RowHit> hits;
+            if (!query_cache_->lookup(key, generation_, hits)) {
+                hits = searchRadiusRowsUncached(query, radius, params, nullptr);
+                query_cache_->insert(std::move(key), generation_, hits);
+            }
+            return hits;
+        }
+        return searchRadiusRowsUncached(query, radius, params, filter);
+    }
+    
+    std::vector<RowHit> searchRowsUncached(const std::vector<float>& query, size_t k, const SearchParams& params,
+                                           const RowBitmap* filter) const {
+        if (!reranks()) {
+            return collectRows(query, k, params, filter);
+        }
+        
+        std::vector<RowHit> hits = collectRows(query, std::max(k, config_.rerank_candidates), params, filter);
+        rerankExact(query.data(), hits);
+        if (hits.size() > k) {
+            hits.resize(k);
+        }
+        return hits;
+    }
+    
+    std::vector<RowHit> searchRadiusRowsUncached(const std::vector<float>& query, float radius,
+                                                 const SearchParams& params, const RowBitmap* filter) const {
+        std::vector<RowHit> hits = collectRadiusRows(query, radius, params, filter);
+        if (reranks()) {
+            rerankExact(query.data(), hits);
+            hits.erase(std::find_if(hits.begin(), hits.end(),
+                                    [radius](const RowHit& hit) { return hit.distance > radius; }),
+                       hits.end());
+        }
+        return hits;
+    }
+    
+    // Blocked multi-query top-k scan over rows [begin, end). Each block of rows
+    // is scored against every query while it is resident in cache, four queries
+    // per loaded row for the dot-product based metrics (caller holds database_mutex_).
+    template <DistanceMetric Metric>
+    std::vector<std::vector<RowHit>> scanBatchTopK(const std::vector<const float*>& queries,
+                                                   const std::vector<float>& query_norms,
+                                                   size_t k, size_t begin, size_t end) const {
+        constexpr bool uses_dot = Metric != DistanceMetric::MANHATTAN;
+        const size_t count = queries.size();
+        const size_t block_rows = std::max<size_t>(16, kBatchBlockBytes / (storage_.stride() * sizeof(float)));
+        const float* norms = storage_.norms();
+        const RowBitmap* live = storage_.liveRows();
+        
+        if (k == 0) {
+            return std::vector<std::vector<RowHit>>(count);
+        }
+        std::vector<TopKCollector> tops(count, TopKCollector(k, end - begin));
+        size_t scored = end - begin;
+        if (live) {
+            scored = 0;
+            live->forEach(begin, end, [&](size_t) { ++scored; });
+        }
+        SearchWork::local().distances += scored * count;
+        
+        for (size_t block = begin; block < end; block += block_rows) {
+            const size_t block_end = std::min(end, block + block_rows);
+            size_t q = 0;
+            
+            if (uses_dot) {
+                for (; q + 4 <= count; q += 4) {
+                    for (size_t row = block; row < block_end; ++row) {
+                        if (live && !live->test(row)) {
+                            continue;
+                        }
+                        float dots[4];
+                        kernels_.dot4(storage_.row(row), &queries[q], dimension_, dots);
+                        for (size_t j = 0; j < 4; ++j) {
+                            tops[q + j].push(row, distanceFromDot<Metric>(dots[j], query_norms[q + j], norms[row]));
+                        }
+                    }
+                }
+            }
+            
+            for (; q < count; ++q) {
+                for (size_t row = block; row < block_end; ++row) {
+                    if (live && !live->test(row)) {
+                        continue;
+                    }
+                    const float* candidate = storage_.row(row);
+                    float distance = uses_dot
+                        ? distanceFromDot<Metric>(kernels_.dot(queries[q], candidate, dimension_), query_norms[q], norms[row])
+                        : kernels_.l1_bounded(queries[q], candidate, dimension_, tops[q].threshold());
+                    tops[q].push(row, distance);
+                }
+            }
+        }
+        
+        std::vector<std::vector<RowHit>> results(count);
+        for (size_t q = 0; q < count; ++q) {
+            results[q] = tops[q].take();
+        }
+        return results;
+    }
+    
+    // Indexed batch: one index lookup per query, spread across the worker pool
+    std::vector<std::vector<RowHit>> searchBatchIndexed(const std::vector<std::vector<float>>& queries, size_t k,
+                                                        const SearchParams& params) const {
+        std::vector<std::vector<RowHit>> results(queries.size());
+        auto run = [&](size_t q) {
+            results[q] = searchRows(queries[q], k, params);
+        };
+        
+        ThreadPool* pool = queries.size() > 1 ? threadPool() : nullptr;
+        if (pool) {
+            std::vector<SearchWork> work(queries.size());
+            pool->parallelFor(queries.size(), [&](size_t q) {
+                work[q] = SearchWork::measure([&] { run(q); });
+            });
+            for (const SearchWork& done : work) {
+                SearchWork::local() += done;
+            }
+        } else {
+            for (size_t q = 0; q < queries.size(); ++q) {
+                run(q);
+            }
+        }
+        return results;
+    }
+    
+    template <DistanceMetric Metric>
+    std::vector<std::vector<RowHit>> searchBatchRows(const std::vector<std::vector<float>>& queries, size_t k,
+                                                     const SearchParams& params) const {
+        if (index_) {
+            return searchBatchIndexed(queries, k, params);
+        }
+        
+        // Encoded rows: one (internally parallel) scan per query
+        if (storage_.quantized()) {
+            std::vector<std::vector<RowHit>> results(queries.size());
+            for (size_t q = 0; q < queries.size(); ++q) {
+                results[q] = searchRows(queries[q], k, params);
+            }
+            return results;
+        }
+        
+        const size_t rows = storage_.size();
+        const size_t count = queries.size();
+        
+        std::vector<const float*> query_ptrs(count);
+        std::vector<float> query_norms(count);
+        for (size_t q = 0; q < count; ++q) {
+            query_ptrs[q] = queries[q].data();
+            query_norms[q] = std::sqrt(kernels_.dot(query_ptrs[q], query_ptrs[q], dimension_));
+        }
+        
+        const size_t partitions = scanPartitions(rows, count);
+        std::vector<std::vector<std::vector<RowHit>>> partial(partitions);
+        forEachPartition(partitions, [&](size_t part, size_t begin, size_t end) {
+            partial[part] = scanBatchTopK<Metric>(query_ptrs, query_norms, k, begin, end);
+        });
+        
+        std::vector<std::vector<RowHit>> results(count);
+        std::vector<std::vector<RowHit>> per_query(partitions);
+        for (size_t q = 0; q < count; ++q) {
+            for (size_t part = 0; part < partitions; ++part) {
+                per_query[part] = std::move(partial[part][q]);
+            }
+            results[q] = mergeTopK(per_query, k);
+            
+            // Decomposed Euclidean distances are squared and slightly lossy:
+            // recompute the exact values for the surviving hits
+            if (Metric == DistanceMetric::EUCLIDEAN) {
+                const RowDistance<Metric> distance_to(kernels_, storage_, query_ptrs[q]);
+                SearchWork::local().distances += results[q].size();
+                for (RowHit& hit : results[q]) {
+                    hit.distance = distance_to(hit.row, storage_.row(hit.row));
+                }
+                sortHits(results[q]);
+            }
+        }
+        return results;
+    }
+    
+    // Convert row hits into public results (caller holds database_mutex_)
+    std::vector<SearchResult> toSearchResults(const std::vector<RowHit>& hits) const {
+        std::vector<SearchResult> results;
+        results.reserve(hits.size());
+        std::vector<float> values(storage_.quantized() ? dimension_ : 0);
+        for (const RowHit& hit : hits) {
+            const float* vector = storage_.row(hit.row);
+            if (storage_.quantized()) {
+                storage_.copyVector(hit.row, values.data());
+                vector = values.data();
+            }
+            results.emplace_back(storage_.id(hit.row), hit.distance, vector, dimension_);
+        }
+        return results;
+    }
+    
+    std::vector<SearchHit> toSearchHits(const std::vector<RowHit>& hits) const {
+        std::vector<SearchHit> results;
+        results.reserve(hits.size());
+        for (const RowHit& hit : hits) {
+            results.emplace_back(storage_.id(hit.row), hit.distance);
+        }
+        return results;
+    }
+    
+    std::vector<SearchIdHit> toSearchIdHits(const std::vector<RowHit>& hits) const {
+        std::vector<SearchIdHit> results;
+        results.reserve(hits.size());
+        for (const RowHit& hit : hits) {
+            results.emplace_back(storage_.numericId(hit.row), hit.distance);
+        }
+        return results;
+    }
+    
+    bool validateVector(const std::vector<float>& vector) const {
+        return vector.size() == dimension_;
+    }
+    
+    bool validateId(std::string_view id) const {
+        uint64_t key;
+        if (id.empty()) {
+            std::cerr << "Error: Vector ID cannot be empty" << std::endl;
+            return false;
+        }
+        if (config_.integer_ids && !IdTable::parseNumber(id, key)) {
+            std::cerr << "Error: Vector ID is not an unsigned integer: " << id << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    bool requireIntegerIds() const {
+        if (!config_.integer_ids) {
+            std::cerr << "Error: Integer IDs need VectorDatabaseConfig::integer_ids" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    bool validateId(uint64_t) const { return requireIntegerIds(); }
+    
+    template <typename Id>
+    bool validateBatch(const Id* ids, const float* data, size_t count) const {
+        if (count > 0 && (ids == nullptr || data == nullptr)) {
+            std::cerr << "Error: Null batch arrays" << std::endl;
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (!validateId(ids[i])) {
+                std::cerr << "Error: Invalid ID in batch row " << i << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    // Index for the configured type, or null when searches should scan linearly
+    std::unique_ptr<VectorIndex> createIndex() const { return createIndex(config_); }
+    
+    std::unique_ptr<VectorIndex> createIndex(const VectorDatabaseConfig& config) const {
+        switch (config.index_type) {
+            case IndexType::KD_TREE:
+                if (!KDTreeIndex::supports(config.distance_metric)) {
+                    std::cerr << "Warning: KD-tree index supports Euclidean and Manhattan distance only, "
+                              << "using linear search" << std::endl;
+                    return nullptr;
+                }
+                if (config.encoding != VectorEncoding::FLOAT32) {
+                    std::cerr << "Warning: KD-tree index requires FLOAT32 encoding, using linear search" << std::endl;
+                    return nullptr;
+                }
+                return std::make_unique<KDTreeIndex>(config.distance_metric, kernels_, config.kd_tree_leaf_size);
+            case IndexType::HASH_TABLE:
+                if (config.encoding != VectorEncoding::FLOAT32) {
+                    std::cerr << "Warning: LSH index requires FLOAT32 encoding, using linear search" << std::endl;
+                    return nullptr;
+                }
+                return std::make_unique<LSHIndex>(config.distance_metric, kernels_, dimension_,
+                                                  config.lsh_tables, config.lsh_hash_bits,
+                                                  config.lsh_probes, config.lsh_bucket_width);
+            case IndexType::HNSW:
+                if (config.encoding != VectorEncoding::FLOAT32) {
+                    std::cerr << "Warning: HNSW index requires FLOAT32 encoding, using linear search" << std::endl;
+                    return nullptr;
+                }
+                return std::make_unique<HNSWIndex>(config.distance_metric, kernels_, dimension_, config.hnsw_m,
+                                                   config.hnsw_ef_construction, config.hnsw_ef_search);
+            case IndexType::IVF:
+                return std::make_unique<IVFIndex>(config.distance_metric, kernels_, dimension_, config.ivf_lists,
+                                                  config.ivf_nprobe, config.ivf_train_sample, threadPool());
+            default:
+                return nullptr;
+        }
+    }
+    
+    // Write a vector to storage and keep the index in sync (caller holds the write lock)
+    template <typename Id>
+    void putVector(const Id& id, const float* values) {
+        ++generation_;
+        recordRebuild(WriteAheadLog::Op::PUT, id, values);
+        size_t size = storage_.size();
+        size_t row = storage_.put(id, values);
+        if (index_) {
+            if (storage_.size() > size) {
+                index_->add(storage_, row);
+            } else {
+                index_->update(storage_, row);
+            }
+        }
+    }
+    
+    // Insert one vector of dimension_ floats (caller validated it)
+    template <typename Id>
+    bool insertVector(const Id& id, const float* values) {
+        auto timer = metrics_.time(DatabaseOperation::INSERT);
+        if (!validateId(id)) {
+            return false;
+        }
+        
+        uint64_t lsn = 0;
+        {
+            WriteLock lock(database_mutex_);
+            
+            if (storage_.liveSize() >= config_.max_vectors) {
+                std::cerr << "Error: Maximum vector capacity reached (" << config_.max_vectors << ")" << std::endl;
+                return false;
+            }
+            
+            if (wal_) lsn = logPut(id, values);
+            putVector(id, values);
+        }
+        return commitWrite(lsn);
+    }
+    
+    // Overwrite an existing ID's vector in place or insert it, as one write;
+    // only a new ID counts against max_vectors
+    template <typename Id>
+    bool upsertVector(const Id& id, const float* values) {
+        auto timer = metrics_.time(DatabaseOperation::UPSERT);
+        if (!validateId(id)) {
+            return false;
+        }
+        
+        uint64_t lsn = 0;
+        {
+            WriteLock lock(database_mutex_);
+            
+            if (storage_.find(id) == VectorStorage::npos && storage_.liveSize() >= config_.max_vectors) {
+                std::cerr << "Error: Maximum vector capacity reached (" << config_.max_vectors << ")" << std::endl;
+                return false;
+            }
+            
+            if (wal_) lsn = logPut(id, values);
+            putVector(id, values);
+        }
+        return commitWrite(lsn);
+    }
+    
+    // Insert count vectors of dimension_ floats under one lock. for_each_row(put)
+    // calls put(id, values) for every row. An upsert batch only counts IDs
+    // that are not stored yet against max_vectors.
+    template <typename ForEachRow>
+    bool insertRows(size_t count, ForEachRow&& for_each_row, bool upsert = false) {
+        auto timer = metrics_.time(DatabaseOperation::INSERT_BATCH);
+        uint64_t lsn = 0;
+        {
+            WriteLock lock(database_mutex_);
+            
+            size_t added = count;
+            if (upsert) {
+                added = 0;
+                for_each_row([&](const auto& id, const float*) {
+                    added += storage_.find(id) == VectorStorage::npos;
+                });
+            }
+            if (storage_.liveSize() + added > config_.max_vectors) {
+                std::cerr << "Error: Batch insert would exceed maximum capacity" << std::endl;
+                return false;
+            }
+            
+            // Insert all vectors; a batch at least as large as the database
+            // rebuilds the index in bulk instead of inserting row by row
+            storage_.reserve(storage_.size() + count);
+            bool bulk_build = index_ && count >= storage_.size();
+            for_each_row([&](const auto& id, const float* values) {
+                if (wal_) lsn = logPut(id, values);
+                if (bulk_build) {
+                    recordRebuild(WriteAheadLog::Op::PUT, id, values);
+                    storage_.put(id, values);
+                } else {
+                    putVector(id, values);
+                }
+            });
+            if (bulk_build) {
+                ++generation_;
+                index_->build(storage_);
+            }
+        }
+        
+        return commitWrite(lsn);
+    }
+    
+    // Tombstone an ID, or remove it at once with compaction_threshold 0
+    template <typename Id>
+    bool removeVector(const Id& id) {
+        size_t row = storage_.find(id);
+        if (row == VectorStorage::npos) {
+            return false;
+        }
+        ++generation_;
+        recordRebuild(WriteAheadLog::Op::REMOVE, id);
+        if (config_.compaction_threshold <= 0.0 && !rebuild_delta_) {
+            if (index_) index_->remove(storage_, row);
+            return storage_.remove(id);
+        }
+        storage_.tombstone(row);
+        if (!compaction_task_) {
+            compaction_task_ = std::make_unique<PeriodicTask>(std::chrono::milliseconds(100), [this] {
+                if (compactionDue()) {
+                    compact();
+                }
+            });
+        }
+        return true;
+    }
+    
+    bool compactionDue() const {
+        ReadLock lock(database_mutex_);
+        if (rebuild_delta_) {
+            return false;
+        }
+        size_t deleted = storage_.deletedCount();
+        return deleted > 0 && static_cast<double>(deleted) >= config_.compaction_threshold * storage_.size();
+    }
+    
+    // Drop tombstoned rows from the storage and index (caller holds the write
+    // lock). Once most rows are deleted, rebuilding the index is cheaper than
+    // taking them out one at a time.
+    size_t compactRows() {
+        if (rebuild_delta_) {
+            return 0;
+        }
+        bool rebuild = index_ && storage_.deletedCount() * 2 > storage_.size();
+        size_t removed = storage_.compact([&](size_t row) {
+            if (index_ && !rebuild) index_->remove(storage_, row);
+        });
+        if (removed > 0) {
+            ++generation_;
+        }
+        if (rebuild && removed > 0) {
+            index_->build(storage_);
+        }
+        return removed;
+    }
+    
+    template <typename Id>
+    std::vector<float> getVector(const Id& id) const {
+        ReadLock lock(database_mutex_);
+        size_t row = storage_.find(id);
+        if (row != VectorStorage::npos) {
+            std::vector<float> vector(dimension_);
+            storage_.copyVector(row, vector.data());
+            return vector;
+        }
+        return {};
+    }
+    
+    // Replayed attribute records; a record whose values no longer fit the
+    // columns (or whose ID is gone) is skipped like a remove of a missing ID
+    static void setAttributes(VectorStorage& storage, const std::string& id, const Attributes& attributes) {
+        std::string error;
+        size_t row = storage.find(id);
+        if (row != VectorStorage::npos && storage.attributes().accepts(attributes, error)) {
+            storage.attributes().set(row, attributes);
+        }
+    }
+    
+    bool validateAttributes(const Attributes& attributes) const {
+        std::string error;
+        if (!storage_.attributes().accepts(attributes, error)) {
+            std::cerr << "Error: " << error << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    // Set attributes of a stored ID and log them under its string form
+    template <typename Id>
+    bool setAttributesLogged(const Id& id, std::string_view logged_id, const Attributes& attributes) {
+        uint64_t lsn = 0;
+        {
+            WriteLock lock(database_mutex_);
+            size_t row = storage_.find(id);
+            if (row == VectorStorage::npos) {
+                std::cerr << "Error: Vector ID not found: " << logged_id << std::endl;
+                return false;
+            }
+            if (!validateAttributes(attributes)) {
+                return false;
+            }
+            storage_.attributes().set(row, attributes);
+            recordRebuild(WriteAheadLog::Op::ATTRIBUTES, logged_id, nullptr, attributes);
+            if (wal_) lsn = wal_->appendAttributes(logged_id, attributes);
+        }
+        return commitWrite(lsn);
+    }
+    
+    // Insert a vector together with attributes, both under one write lock
+    template <typename Id>
+    bool insertWithAttributes(const Id& id, std::string_view logged_id, const std::vector<float>& vector,
+                              const Attributes& attributes) {
+        auto timer = metrics_.time(DatabaseOperation::INSERT);
+        if (!validateVector(vector)) {
+            std::cerr << "Error: Vector dimension mismatch. Expected " << dimension_ 
+                      << ", got " << vector.size() << std::endl;
+            return false;
+        }
+        if (!validateId(id)) {
+            return false;
+        }
+        
+        uint64_t lsn = 0;
+        {
+            WriteLock lock(database_mutex_);
+            
+            if (storage_.liveSize() >= config_.max_vectors) {
+                std::cerr << "Error: Maximum vector capacity reached (" << config_.max_vectors << ")" << std::endl;
+                return false;
+            }
+            if (!validateAttributes(attributes)) {
+                return false;
+            }
+            
+            if (wal_) {
+                logPut(id, vector.data());
+                lsn = wal_->appendAttributes(logged_id, attributes);
+            }
+            putVector(id, vector.data());
+            storage_.attributes().set(storage_.find(id), attributes);
+            recordRebuild(WriteAheadLog::Op::ATTRIBUTES, logged_id, nullptr, attributes);
+        }
+        return commitWrite(lsn);
+    }
+    
+    template <typename Id>
+    Attributes getAttributes(const Id& id) const {
+        ReadLock lock(database_mutex_);
+        size_t row = storage_.find(id);
+        return row != VectorStorage::npos ? storage_.attributes().get(row) : Attributes();
+    }
+    
+    // Rows matching a filter (caller holds database_mutex_)
+    RowBitmap filterRows(const Filter& filter) const {
+        RowBitmap rows = storage_.attributes().evaluate(filter, storage_.size());
+        if (const RowBitmap* live = storage_.liveRows()) {
+            rows &= *live;
+        }
+        return rows;
+    }
+    
+    // Remove an ID and log it under its string form
+    template <typename Id>
+    bool removeLogged(const Id& id, std::string_view logged_id) {
+        auto timer = metrics_.time(DatabaseOperation::REMOVE);
+        uint64_t lsn = 0;
+        {
+            WriteLock lock(database_mutex_);
+            if (!removeVector(id)) {
+                return false;
+            }
+            if (wal_) lsn = wal_->appendRemove(logged_id);
+        }
+        return commitWrite(lsn);
+    }
+    
+    // The log records IDs as strings, integer IDs in decimal
+    uint64_t logPut(std::string_view id, const float* values) { return wal_->appendPut(id, values); }
+    uint64_t logPut(uint64_t id, const float* values) { return wal_->appendPut(std::to_string(id), values); }
+    
+    // Record a write for a running rebuild_index() (caller holds the write lock)
+    void recordRebuild(WriteAheadLog::Op op, std::string_view id, const float* values = nullptr,
+                       const Attributes& attributes = Attributes()) {
+        if (rebuild_delta_) rebuild_delta_->record(op, std::string(id), values, dimension_, attributes);
+    }
+    void recordRebuild(WriteAheadLog::Op op, uint64_t id, const float* values = nullptr) {
+        if (rebuild_delta_) rebuild_delta_->record(op, std::to_string(id), values, dimension_);
+    }
+
+    // Append a put record for every row of source; returns the last sequence number
+    uint64_t logRows(const VectorStorage& source) {
+        uint64_t lsn = 0;
+        std::vector<float> vector(dimension_);
+        for (size_t row = 0; row < source.size(); ++row) {
+            if (!source.live(row)) {
+                continue;
+            }
+            source.copyVector(row, vector.data());
+            const std::string id = source.id(row);
+            lsn = wal_->appendPut(id, vector.data());
+            if (source.attributes().hasAny(row)) {
+                lsn = wal_->appendAttributes(id, source.attributes().get(row));
+            }
+        }
+        return lsn;
+    }
+    
+    std::string snapshotPath() const { return config_.durability_path + ".snapshot"; }
+    std::string walPath() const { return config_.durability_path + ".wal"; }
+    // Log sealed by a checkpoint that has not been folded into the snapshot yet
+    std::string frozenWalPath() const { return config_.durability_path + ".wal.checkpoint"; }
+    
+    // The settings rebuild_index() takes over: index type and parameters, encoding
+    static void copyIndexSettings(const VectorDatabaseConfig& from, VectorDatabaseConfig& to) {
+        to.index_type = from.index_type;
+        to.kd_tree_leaf_size = from.kd_tree_leaf_size;
+        to.lsh_tables = from.lsh_tables;
+        to.lsh_hash_bits = from.lsh_hash_bits;
+        to.lsh_probes = from.lsh_probes;
+        to.lsh_bucket_width = from.lsh_bucket_width;
+        to.hnsw_m = from.hnsw_m;
+        to.hnsw_ef_construction = from.hnsw_ef_construction;
+        to.hnsw_ef_search = from.hnsw_ef_search;
+        to.ivf_lists = from.ivf_lists;
+        to.ivf_nprobe = from.ivf_nprobe;
+        to.ivf_train_sample = from.ivf_train_sample;
+        to.encoding = from.encoding;
+        to.pq_subspaces = from.pq_subspaces;
+        to.rerank_candidates = from.rerank_candidates;
+    }
+    
+    // Replay recorded writes on a storage and index being rebuilt; removes
+    // take rows out at once, the rebuilt storage is never tombstoned
+    static void applyRebuildDelta(VectorStorage& storage, VectorIndex* index,
+                                  const std::vector<RebuildDelta::Entry>& entries) {
+        for (const auto& entry : entries) {
+            switch (entry.op) {
+                case WriteAheadLog::Op::PUT: {
+                    size_t size = storage.size();
+                    size_t row = storage.put(entry.id, entry.values.data());
+                    if (index) {
+                        if (storage.size() > size) {
+                            index->add(storage, row);
+                        } else {
+                            index->update(storage, row);
+                        }
+                    }
+                    break;
+                }
+                case WriteAheadLog::Op::REMOVE: {
+                    size_t row = storage.find(entry.id);
+                    if (row != VectorStorage::npos) {
+                        if (index) index->remove(storage, row);
+                        storage.remove(entry.id);
+                    }
+                    break;
+                }
+                case WriteAheadLog::Op::CLEAR:
+                    storage.clear();
+                    if (index) index->build(storage);
+                    break;
+                case WriteAheadLog::Op::ATTRIBUTES:
+                    setAttributes(storage, entry.id, entry.attributes);
+                    break;
+            }
+        }
+    }
+    
+    // Wait for the log as the sync mode requires after a write logged as lsn
+    // (called without the database lock so concurrent writers group-commit)
+    bool commitWrite(uint64_t lsn) {
+        if (!wal_ || lsn == 0) {
+            return true;
+        }
+        switch (config_.wal_sync) {
+            case WalSyncMode::ALWAYS:
+                return wal_->commit(lsn, true);
+            case WalSyncMode::NONE:
+                return wal_->commit(lsn, false);
+            default:
+                return true;
+        }
+    }
+    
+    // Load the snapshot and replay the logs over it, then start logging
+    void recover() {
+        if (std::filesystem::exists(snapshotPath()) && !load(snapshotPath())) {
+            throw std::runtime_error("Cannot load database snapshot: " + snapshotPath());
+        }
+        
+        auto apply = [this](WriteAheadLog::Op op, const std::string& id, const float* values,
+                            const Attributes& attributes) {
+            switch (op) {
+                case WriteAheadLog::Op::PUT:
+                    putVector(id, values);
+                    break;
+                case WriteAheadLog::Op::REMOVE:
+                    removeVector(id);
+                    break;
+                case WriteAheadLog::Op::CLEAR:
+                    clearVectors();
+                    break;
+                case WriteAheadLog::Op::ATTRIBUTES:
+                    setAttributes(storage_, id, attributes);
+                    break;
+            }
+        };
+        uint64_t valid_bytes = 0;
+        if (!WriteAheadLog::replay(frozenWalPath(), dimension_, apply) ||
+            !WriteAheadLog::replay(walPath(), dimension_, apply, &valid_bytes)) {
+            throw std::runtime_error("Cannot replay write-ahead log: " + config_.durability_path);
+        }
+        
+        wal_ = std::make_unique<WriteAheadLog>(walPath(), dimension_, valid_bytes);
+        if (config_.wal_sync == WalSyncMode::INTERVAL) {
+            wal_sync_task_ = std::make_unique<PeriodicTask>(
+                std::chrono::milliseconds(std::max<size_t>(1, config_.wal_sync_interval_ms)),
+                [this] { wal_->commitAll(true); });
+        }
+        if (config_.checkpoint_wal_bytes > 0) {
+            checkpoint_task_ = std::make_unique<PeriodicTask>(std::chrono::milliseconds(100), [this] {
+                if (wal_->bytes() >= config_.checkpoint_wal_bytes) {
+                    checkpoint();
+                }
+            });
+        }
+    }
+    
+    void clearVectors() {
+        ++generation_;
+        recordRebuild(WriteAheadLog::Op::CLEAR, std::string_view());
+        storage_.clear();
+        if (index_) index_->build(storage_);
+    }
+    
+    // Storage for data being loaded. An exact-copy file for the new data is
+    // written beside the live one and moved into place by replaceStorage()
+    VectorStorage makeLoadingStorage() const {
+        return makeLoadingStorage(config_.encoding, config_.pq_subspaces, ".loading");
+    }
+    
+    VectorStorage makeLoadingStorage(VectorEncoding encoding, size_t pq_subspaces, const char* suffix) const {
+        std::string loading_path = config_.full_precision_path.empty() ? std::string()
+                                                                       : config_.full_precision_path + suffix;
+        return VectorStorage(dimension_, encoding, pq_subspaces, loading_path, config_.integer_ids);
+    }
+    
+    // Index freshly loaded data, then swap it in under the write lock
+    void replaceStorage(VectorStorage loaded) {
+        std::unique_ptr<VectorIndex> index = createIndex();
+        if (index) index->build(loaded);
+        
+        uint64_t lsn = 0;
+        {
+            WriteLock lock(database_mutex_);
+            ++generation_;
+            if (rebuild_delta_) rebuild_delta_->markReplaced();
+            storage_ = std::move(loaded);
+            index_ = std::move(index);
+            if (storage_.hasFullPrecision()) {
+                storage_.fullPrecisionFile()->rename(config_.full_precision_path);
+            }
+            // The log cannot refer to the loaded file, so it records the contents
+            if (wal_) {
+                lsn = wal_->appendClear();
+                lsn = std::max(lsn, logRows(storage_));
+            }
+        }
+        commitWrite(lsn);
+    }
+    
+    // Read a file in the original format: dimension and count as raw size_t,
+    // then per vector the ID length, ID bytes and the floats
+    bool readLegacy(const std::string& filepath, VectorStorage& loaded) const {
+        std::ifstream file(filepath, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Error: Cannot open file for reading: " << filepath << std::endl;
+            return false;
+        }
+        
+        size_t file_dimension;
+        file.read(reinterpret_cast<char*>(&file_dimension), sizeof(file_dimension));
+        
+        if (file_dimension != dimension_) {
+            std::cerr << "Error: File dimension mismatch. Expected " << dimension_ 
+                      << ", got " << file_dimension << std::endl;
+            return false;
+        }
+        
+        size_t vector_count;
+        file.read(reinterpret_cast<char*>(&vector_count), sizeof(vector_count));
+        
+        loaded.reserve(vector_count);
+        
+        std::vector<float> vector(dimension_);
+        for (size_t i = 0; i < vector_count; ++i) {
+            size_t id_length;
+            file.read(reinterpret_cast<char*>(&id_length), sizeof(id_length));
+            
+            std::string id(id_length, '\0');
+            file.read(&id[0], id_length);
+            
+            file.read(reinterpret_cast<char*>(vector.data()), dimension_ * sizeof(float));
+            if (!file.good() || !loaded.acceptsId(id)) {
+                break;
+            }
+            loaded.put(id, vector.data());
+        }
+        
+        if (!file.good()) {
+            std::cerr << "Error: Failed to read database file: " << filepath << std::endl;
+            return false;
+        }
+        if (loaded.size() < vector_count) {
+            std::cerr << "Error: " << filepath << " has IDs that are not unsigned integers" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    // Read a saved file into loaded (from makeLoadingStorage()) without
+    // touching the live data; load() then swaps it in with replaceStorage()
+    bool readFile(const std::string& filepath, VectorStorage& loaded) const {
+        if (!DatabaseFile::hasMagic(filepath)) {
+            return readLegacy(filepath, loaded);
+        }
+        
+        std::shared_ptr<const DatabaseFile> file = DatabaseFile::open(filepath);
+        if (!file) {
+            return false;
+        }
+        const DatabaseFileHeader& header = file->header();
+        if (header.dimension != dimension_) {
+            std::cerr << "Error: File dimension mismatch. Expected " << dimension_ 
+                      << ", got " << header.dimension << std::endl;
+            return false;
+        }
+        if (header.distance_metric != static_cast<uint32_t>(config_.distance_metric)) {
+            std::cerr << "Warning: " << filepath << " was saved with a different distance metric" << std::endl;
+        }
+        
+        if (config_.integer_ids) {
+            for (size_t row = 0; row < file->size(); ++row) {
+                if (!loaded.acceptsId(file->id(row))) {
+                    std::cerr << "Error: " << filepath << " has IDs that are not unsigned integers" << std::endl;
+                    return false;
+                }
+            }
+        }
+        if (config_.encoding == VectorEncoding::FLOAT32 && header.stride == loaded.stride()) {
+            loaded = VectorStorage(dimension_, file, config_.integer_ids);
+        } else {
+            loaded.reserve(file->size());
+            for (size_t row = 0; row < file->size(); ++row) {
+                loaded.put(file->id(row), file->rows() + row * header.stride);
+            }
+            loaded.attributes() = file->attributes();
+        }
+        return true;
+    }
+    
+    // Reads every shard's file before any shard's data is replaced
+    friend class ShardedVectorDatabase;
+    
+public:
+    // Constructors
+    explicit VectorDatabase(size_t dimension) 
+        : dimension_(dimension), config_(), storage_(dimension), kernels_(DistanceKernels::forDimension(dimension)) {
+        if (dimension == 0) {
+            throw std::invalid_argument("Vector dimension must be greater than 0");
+        }
+        index_ = createIndex();
+        if (index_) index_->build(storage_);
+        std::cout << "Created VectorDatabase for " << dimension << "-dimensional vectors" << std::endl;
+    }
+    
+    VectorDatabase(size_t dimension, const VectorDatabaseConfig& config)
+        : dimension_(dimension), config_(config),
+          storage_(dimension, config.encoding, config.pq_subspaces, config.full_precision_path, config.integer_ids),
+          kernels_(DistanceKernels::forDimension(dimension)) {
+        if (dimension == 0) {
+            throw std::invalid_argument("Vector dimension must be greater than 0");
+        }
+        index_ = createIndex();
+        if (index_) index_->build(storage_);
+        if (config_.query_cache_entries > 0) {
+            query_cache_ = std::make_unique<QueryCache>(config_.query_cache_entries, config_.query_cache_quantization);
+        }
+        if (!config_.durability_path.empty()) {
+            recover();
+        }
+        std::cout << "Created VectorDatabase for " << dimension << "-dimensional vectors with custom config" << std::endl;
+    }
+    
+    ~VectorDatabase() {
+        // Answer queued async searches, then stop the background tasks
+        // before the log they use goes away
+        async_scheduler_.reset();
+        compaction_task_.reset();
+        checkpoint_task_.reset();
+        wal_sync_task_.reset();
+    }
+    
+    // Utility functions for high-dimensional vectors
+    std::vector<float> generateRandomVector(float min_val = -1.0f, float max_val = 1.0f) const {
+        return VectorUtils::generateRandomVector(dimension_, min_val, max_val);
+    }
+    
+    std::vector<float> generateRandomUnitVector() const {
+        return VectorUtils::generateRandomUnitVector(dimension_);
+    }
+    
+    std::vector<float> generateGaussianVector(const std::vector<float>& center, float std_dev = 0.1f) const {
+        if (center.size() != dimension_) {
+            throw std::invalid_argument("Center vector dimension mismatch");
+        }
+        return VectorUtils::generateGaussianVector(center, std_dev);
+    }
+    
+    // Generate and insert random vectors for testing
+    bool insertRandomVectors(size_t count, const std::string& prefix = "rand") {
+        std::map<std::string, std::vector<float>> batch;
+        
+        for (size_t i = 0; i < count; ++i) {
+            std::string id = prefix + "_" + std::to_string(i);
+            batch[id] = generateRandomVector();
+        }
+        
+        return insert_batch(batch);
+    }
+    
+    // Generate and insert clustered vectors around centers
+    bool insertClusteredVectors(const std::vector<std::vector<float>>& centers, 
+                               size_t vectors_per_cluster, 
+                               float std_dev = 0.1f,
+                               const std::string& prefix = "cluster") {
+        std::map<std::string, std::vector<float>> batch;
+        
+        for (size_t c = 0; c < centers.size(); ++c) {
+            if (centers[c].size() != dimension_) {
+                std::cerr << "Error: Center " << c << " dimension mismatch" << std::endl;
+                return false;
+            }
+            
+            for (size_t i = 0; i < vectors_per_cluster; ++i) {
+                std::string id = prefix + "_" + std::to_string(c) + "_" + std::to_string(i);
+                batch[id] = generateGaussianVector(centers[c], std_dev);
+            }
+        }
+        
+        return insert_batch(batch);
+    }
+    
+    // Insert operations
+    bool insert(const std::string& id, const std::vector<float>& vector) {
+        if (!validateVector(vector)) {
+            std::cerr << "Error: Vector dimension mismatch. Expected " << dimension_ 
+                      << ", got " << vector.size() << std::endl;
+            return false;
+        }
+        return insertVector(id, vector.data());
+    }
+    
+    // Kept for callers passing temporary IDs; the ID is copied into the ID
+    // table and the values into the slab either way
+    bool insert(std::string&& id, const std::vector<float>& vector) {
+        if (!validateVector(vector)) {
+            std::cerr << "Error: Vector dimension mismatch. Expected " << dimension_ 
+                      << ", got " << vector.size() << std::endl;
+            return false;
+        }
+        return insertVector(id, vector.data());
+    }
+    
+    // Insert straight from a caller buffer of size floats
+    bool insert(const std::string& id, const float* data, size_t size) {
+        if (data == nullptr || size != dimension_) {
+            std::cerr << "Error: Vector dimension mismatch. Expected " << dimension_ 
+                      << ", got " << size << std::endl;
+            return false;
+        }
+        return insertVector(id, data);
+    }
+    
+    bool insert_batch(const std::map<std::string, std::vector<float>>& vectors) {
+        // Validate all vectors first, before blocking readers
+        for (const auto& pair : vectors) {
+            if (!validateVector(pair.second) || !validateId(pair.first)) {
+                std::cerr << "Error: Invalid vector in batch for ID: " << pair.first << std::endl;
+                return false;
+            }
+        }
+        
+        return insertRows(vectors.size(), [&](auto&& put) {
+            for (const auto& pair : vectors) {
+                put(pair.first, pair.second.data());
+            }
+        });
+    }
+    
+    // Insert count vectors from contiguous arrays: ids[i] names the dimension()
+    // floats at data + i * dimension() (row-major N x D, no per-vector containers)
+    bool insert_batch(const std::string* ids, const float* data, size_t count) {
+        if (!validateBatch(ids, data, count)) {
+            return false;
+        }
+        return insertRows(count, [&](auto&& put) {
+            for (size_t i = 0; i < count; ++i) {
+                put(ids[i], data + i * dimension_);
+            }
+        });
+    }
+    
+    // Same with the IDs and data in vectors; data holds ids.size() * dimension() floats
+    bool insert_batch(std::vector<std::string>&& ids, const std::vector<float>& data) {
+        if (data.size() != ids.size() * dimension_) {
+            std::cerr << "Error: Batch holds " << data.size() << " floats, expected "
+                      << ids.size() * dimension_ << std::endl;
+            return false;
+        }
+        if (!validateBatch(ids.data(), data.data(), ids.size())) {
+            return false;
+        }
+        return insertRows(ids.size(), [&](auto&& put) {
+            for (size_t i = 0; i < ids.size(); ++i) {
+                put(ids[i], data.data() + i * dimension_);
+            }
+        });
+    }
+    
+    // Integer-ID inserts (VectorDatabaseConfig::integer_ids): the keys are
+    // stored as they are, without going through strings
+    bool insert(uint64_t id, const std::vector<float>& vector) {
+        if (!validateVector(vector)) {
+            std::cerr << "Error: Vector dimension mismatch. Expected " << dimension_ 
+                      << ", got " << vector.size() << std::endl;
+            return false;
+        }
+        return insertVector(id, vector.data());
+    }
+    
+    bool insert(uint64_t id, const float* data, size_t size) {
+        if (data == nullptr || size != dimension_) {
+            std::cerr << "Error: Vector dimension mismatch. Expected " << dimension_ 
+                      << ", got " << size << std::endl;
+            return false;
+        }
+        return insertVector(id, data);
+    }
+    
+    // Replace the vector of an ID in place, or insert it if it is new. The
+    // update is one atomic write: readers see the old or the new vector,
+    // never a missing ID, and the index updates the row's entry.
+    bool upsert(const std::string& id, const std::vector<float>& vector) {
+        if (!validateVector(vector)) {
+            std::cerr << "Error: Vector dimension mismatch. Expected " << dimension_ 
+                      << ", got " << vector.size() << std::endl;
+            return false;
         }
+        return upsertVector(id, vector.data());
     }
     
-    bool validateVector(const std::vector<float>& vector) const {
-        return vector.size() == dimension_;
-    }
-
-public:
-    // Constructors
-    explicit VectorDatabase(size_t dimension) 
-        : dimension_(dimension), config_() {
-        if (dimension == 0) {
-            throw std::invalid_argument("Vector dimension must be greater than 0");
+    bool upsert(uint64_t id, const std::vector<float>& vector) {
+        if (!validateVector(vector)) {
+            std::cerr << "Error: Vector dimension mismatch. Expected " << dimension_ 
+                      << ", got " << vector.size() << std::endl;
+            return false;
         }
-        std::cout << "Created VectorDatabase for " << dimension << "-dimensional vectors" << std::endl;
+        return upsertVector(id, vector.data());
     }
     
-    VectorDatabase(size_t dimension, const VectorDatabaseConfig& config)
-        : dimension_(dimension), config_(config) {
-        if (dimension == 0) {
-            throw std::invalid_argument("Vector dimension must be greater than 0");
+    bool upsert_batch(const std::map<std::string, std::vector<float>>& vectors) {
+        for (const auto& pair : vectors) {
+            if (!validateVector(pair.second) || !validateId(pair.first)) {
+                std::cerr << "Error: Invalid vector in batch for ID: " << pair.first << std::endl;
+                return false;
+            }
         }
-        std::cout << "Created VectorDatabase for " << dimension << "-dimensional vectors with custom config" << std::endl;
+        
+        return insertRows(vectors.size(), [&](auto&& put) {
+            for (const auto& pair : vectors) {
+                put(pair.first, pair.second.data());
+            }
+        }, true);
     }
     
-    // Utility functions for high-dimensional vectors
-    std::vector<float> generateRandomVector(float min_val = -1.0f, float max_val = 1.0f) const {
-        return VectorUtils::generateRandomVector(dimension_, min_val, max_val);
+    // Insert a vector and set attributes on it; attributes the ID already had
+    // and that are not named here are kept
+    bool insert(const std::string& id, const std::vector<float>& vector, const Attributes& attributes) {
+        return insertWithAttributes(id, id, vector, attributes);
     }
     
-    std::vector<float> generateRandomUnitVector() const {
-        return VectorUtils::generateRandomUnitVector(dimension_);
+    bool insert(uint64_t id, const std::vector<float>& vector, const Attributes& attributes) {
+        return insertWithAttributes(id, std::to_string(id), vector, attributes);
     }
     
-    std::vector<float> generateGaussianVector(const std::vector<float>& center, float std_dev = 0.1f) const {
-        if (center.size() != dimension_) {
-            throw std::invalid_argument("Center vector dimension mismatch");
+    bool insert_batch(const uint64_t* ids, const float* data, size_t count) {
+        if (!validateBatch(ids, data, count)) {
+            return false;
         }
-        return VectorUtils::generateGaussianVector(center, std_dev);
+        return insertRows(count, [&](auto&& put) {
+            for (size_t i = 0; i < count; ++i) {
+                put(ids[i], data + i * dimension_);
+            }
+        });
     }
     
-    // Generate and insert random vectors for testing
-    bool insertRandomVectors(size_t count, const std::string& prefix = "rand") {
-        std::map<std::string, std::vector<float>> batch;
+    // Bulk-load every vector of an FBIN, FVECS or NPY file, naming them
+    // id_prefix + row number (the row number alone with integer_ids, which
+    // needs an empty prefix). The file is streamed in chunks: the next chunk
+    // is read while worker threads parse and validate the current one straight
+    // into a new storage, and the index is built on it before it is swapped
+    // in, so searches keep running until the import is complete. Importing
+    // into an empty database moves the new storage into place; otherwise its
+    // vectors are merged in (IDs already present are overwritten).
+    bool import_file(const std::string& path, const std::string& id_prefix = "",
+                     ImportFormat format = ImportFormat::AUTO) {
+        auto timer = metrics_.time(DatabaseOperation::LOAD);
+        VectorFileReader reader;
+        if (!reader.open(path, format)) {
+            return false;
+        }
+        const size_t count = reader.size();
+        if (count == 0) {
+            return true;
+        }
+        if (reader.dimension() != dimension_) {
+            std::cerr << "Error: File dimension mismatch. Expected " << dimension_
+                      << ", got " << reader.dimension() << std::endl;
+            return false;
+        }
+        if (count > config_.max_vectors) {
+            std::cerr << "Error: Import would exceed maximum capacity" << std::endl;
+            return false;
+        }
+        if (config_.integer_ids && !id_prefix.empty()) {
+            std::cerr << "Error: import_file() takes no ID prefix with integer_ids" << std::endl;
+            return false;
+        }
         
-        for (size_t i = 0; i < count; ++i) {
-            std::string id = prefix + "_" + std::to_string(i);
-            batch[id] = generateRandomVector();
+        VectorStorage imported = makeLoadingStorage();
+        imported.reserve(count);
+        const bool direct = config_.encoding == VectorEncoding::FLOAT32;
+        ThreadPool* pool = threadPool();
+        const size_t parts = pool ? pool->size() + 1 : 1;
+        const size_t chunk_rows = std::max<size_t>(1, kImportChunkBytes / reader.recordBytes());
+        
+        std::vector<char> current, ahead;
+        std::vector<std::string> ids;
+        std::vector<uint64_t> keys;
+        std::vector<float> staging;
+        std::atomic<size_t> bad_row(VectorStorage::npos);
+        bool read_ok = reader.read(current, chunk_rows);
+        for (size_t first = 0; first < count && read_ok; ) {
+            const size_t rows = current.size() / reader.recordBytes();
+            std::future<bool> next;
+            if (first + rows < count) {
+                next = std::async(std::launch::async, [&] { return reader.read(ahead, chunk_rows); });
+            }
+            
+            auto for_parts = [&](auto&& fn) {
+                auto run = [&](size_t part) { fn(rows * part / parts, rows * (part + 1) / parts); };
+                if (pool && rows >= parts) {
+                    pool->parallelFor(parts, run);
+                } else {
+                    for (size_t part = 0; part < parts; ++part) {
+                        run(part);
+                    }
+                }
+            };
+            auto parse = [&](size_t row, float* out) {
+                if (!reader.parse(current.data() + row * reader.recordBytes(), out)) {
+                    size_t expected = VectorStorage::npos;
+                    bad_row.compare_exchange_strong(expected, first + row);
+                    return false;
+                }
+                return true;
+            };
+            
+            if (config_.integer_ids) {
+                keys.resize(rows);
+                std::iota(keys.begin(), keys.end(), static_cast<uint64_t>(first));
+            } else {
+                ids.resize(rows);
+                for_parts([&](size_t begin, size_t end) {
+                    for (size_t row = begin; row < end; ++row) {
+                        ids[row] = id_prefix + std::to_string(first + row);
+                    }
+                });
+            }
+            
+            if (direct) {
+                // Parse straight into the rows of the new storage
+                const size_t base = config_.integer_ids ? imported.appendRows(keys) : imported.appendRows(ids);
+                for_parts([&](size_t begin, size_t end) {
+                    for (size_t row = begin; row < end; ++row) {
+                        float* out = imported.row(base + row);
+                        if (parse(row, out)) {
+                            imported.setNorm(base + row, std::sqrt(kernels_.dot(out, out, dimension_)));
+                        }
+                    }
+                });
+            } else {
+                // Compressed storage encodes as it inserts
+                staging.resize(rows * dimension_);
+                for_parts([&](size_t begin, size_t end) {
+                    for (size_t row = begin; row < end; ++row) {
+                        parse(row, staging.data() + row * dimension_);
+                    }
+                });
+                for (size_t row = 0; row < rows && bad_row == VectorStorage::npos; ++row) {
+                    if (config_.integer_ids) {
+                        imported.put(keys[row], staging.data() + row * dimension_);
+                    } else {
+                        imported.put(ids[row], staging.data() + row * dimension_);
+                    }
+                }
+            }
+            
+            if (next.valid()) {
+                read_ok = next.get();
+            }
+            if (bad_row != VectorStorage::npos) {
+                std::cerr << "Error: Malformed or non-finite vector at row " << bad_row.load()
+                          << " of " << path << std::endl;
+                return false;
+            }
+            current.swap(ahead);
+            first += rows;
+        }
+        if (!read_ok) {
+            std::cerr << "Error: Failed to read import file: " << path << std::endl;
+            return false;
         }
         
-        return insert_batch(batch);
-    }
-    
-    // Generate and insert clustered vectors around centers
-    bool insertClusteredVectors(const std::vector<std::vector<float>>& centers, 
-                               size_t vectors_per_cluster, 
-                               float std_dev = 0.1f,
-                               const std::string& prefix = "cluster") {
-        std::map<std::string, std::vector<float>> batch;
+        // Index the new data off the lock; it is only kept if the database
+        // is still empty when the lock is taken
+        std::unique_ptr<VectorIndex> index = createIndex();
+        if (index) index->build(imported);
         
-        for (size_t c = 0; c < centers.size(); ++c) {
-            if (centers[c].size() != dimension_) {
-                std::cerr << "Error: Center " << c << " dimension mismatch" << std::endl;
+        uint64_t lsn = 0;
+        {
+            WriteLock lock(database_mutex_);
+            if (storage_.liveSize() + imported.size() > config_.max_vectors) {
+                std::cerr << "Error: Import would exceed maximum capacity" << std::endl;
                 return false;
             }
             
-            for (size_t i = 0; i < vectors_per_cluster; ++i) {
-                std::string id = prefix + "_" + std::to_string(c) + "_" + std::to_string(i);
-                batch[id] = generateGaussianVector(centers[c], std_dev);
+            ++generation_;
+            if (storage_.empty()) {
+                if (rebuild_delta_) rebuild_delta_->markReplaced();
+                storage_ = std::move(imported);
+                index_ = std::move(index);
+                if (storage_.hasFullPrecision()) {
+                    storage_.fullPrecisionFile()->rename(config_.full_precision_path);
+                }
+                if (wal_) lsn = logRows(storage_);
+            } else {
+                storage_.reserve(storage_.size() + imported.size());
+                bool bulk_build = index_ && imported.size() >= storage_.size();
+                std::vector<float> vector(dimension_);
+                for (size_t row = 0; row < imported.size(); ++row) {
+                    std::string id = imported.id(row);
+                    imported.copyVector(row, vector.data());
+                    if (wal_) lsn = wal_->appendPut(id, vector.data());
+                    if (bulk_build) {
+                        recordRebuild(WriteAheadLog::Op::PUT, id, vector.data());
+                        storage_.put(id, vector.data());
+                    } else {
+                        putVector(id, vector.data());
+                    }
+                }
+                if (bulk_build) {
+                    index_->build(storage_);
+                }
             }
         }
+        return commitWrite(lsn);
+    }
+    
+    // Search operations
+    std::vector<SearchResult> search(const std::vector<float>& query, size_t k,
+                                     const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
+        if (!validateVector(query)) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            return {};
+        }
         
-        return insert_batch(batch);
+        ReadLock lock(database_mutex_);
+        
+        if (storage_.empty()) {
+            return {};
+        }
+        
+        return toSearchResults(searchRows(query, k, params));
     }
     
-    // Insert operations
-    bool insert(const std::string& id, const std::vector<float>& vector) {
-        if (!validateVector(vector)) {
-            std::cerr << "Error: Vector dimension mismatch. Expected " << dimension_ 
-                      << ", got " << vector.size() << std::endl;
-            return false;
+    std::vector<SearchResult> search_radius(const std::vector<float>& query, float radius,
+                                            const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_RADIUS, 1);
+        if (!validateVector(query)) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            return {};
         }
         
-        if (id.empty()) {
-            std::cerr << "Error: Vector ID cannot be empty" << std::endl;
-            return false;
+        ReadLock lock(database_mutex_);
+        
+        return toSearchResults(searchRadiusRows(query, radius, params));
+    }
+    
+    // Same as search(), but results carry only ID and distance (no vector copies)
+    std::vector<SearchHit> search_hits(const std::vector<float>& query, size_t k,
+                                       const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
+        if (!validateVector(query)) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            return {};
         }
         
-        std::lock_guard<std::mutex> lock(database_mutex_);
+        ReadLock lock(database_mutex_);
         
-        if (vectors_.size() >= config_.max_vectors) {
-            std::cerr << "Error: Maximum vector capacity reached (" << config_.max_vectors << ")" << std::endl;
-            return false;
+        if (storage_.empty()) {
+            return {};
         }
         
-        vectors_[id] = vector;
-        return true;
+        return toSearchHits(searchRows(query, k, params));
     }
     
-    bool insert_batch(const std::map<std::string, std::vector<float>>& vectors) {
-        std::lock_guard<std::mutex> lock(database_mutex_);
+    // Same as search_radius(), but results carry only ID and distance
+    std::vector<SearchHit> search_radius_hits(const std::vector<float>& query, float radius,
+                                              const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_RADIUS, 1);
+        if (!validateVector(query)) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            return {};
+        }
         
-        // Validate all vectors first
-        for (const auto& pair : vectors) {
-            if (!validateVector(pair.second) || pair.first.empty()) {
-                std::cerr << "Error: Invalid vector in batch for ID: " << pair.first << std::endl;
-                return false;
-            }
+        ReadLock lock(database_mutex_);
+        
+        return toSearchHits(searchRadiusRows(query, radius, params));
+    }
+    
+    // Same as search_hits(), returning integer IDs (integer_ids only)
+    std::vector<SearchIdHit> search_ids(const std::vector<float>& query, size_t k,
+                                        const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
+        if (!validateVector(query)) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            return {};
+        }
+        if (!requireIntegerIds()) {
+            return {};
         }
         
-        if (vectors_.size() + vectors.size() > config_.max_vectors) {
-            std::cerr << "Error: Batch insert would exceed maximum capacity" << std::endl;
-            return false;
+        ReadLock lock(database_mutex_);
+        
+        if (storage_.empty()) {
+            return {};
         }
         
-        // Insert all vectors
-        for (const auto& pair : vectors) {
-            vectors_[pair.first] = pair.second;
+        return toSearchIdHits(searchRows(query, k, params));
+    }
+    
+    // Same as search_radius_hits(), returning integer IDs (integer_ids only)
+    std::vector<SearchIdHit> search_radius_ids(const std::vector<float>& query, float radius,
+                                               const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_RADIUS, 1);
+        if (!validateVector(query)) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            return {};
+        }
+        if (!requireIntegerIds()) {
+            return {};
         }
         
-        return true;
+        ReadLock lock(database_mutex_);
+        
+        return toSearchIdHits(searchRadiusRows(query, radius, params));
     }
     
-    // Search operations
-    std::vector<SearchResult> search(const std::vector<float>& query, size_t k) const {
+    // Filtered searches: only vectors whose attributes match filter are
+    // returned. The filter is evaluated into a row bitmap which either
+    // restricts a brute-force scan or is consulted by the index during its
+    // traversal, whichever is estimated to visit fewer rows.
+    std::vector<SearchResult> search(const std::vector<float>& query, size_t k, const Filter& filter,
+                                     const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
         if (!validateVector(query)) {
             std::cerr << "Error: Query vector dimension mismatch" << std::endl;
             return {};
         }
         
-        std::lock_guard<std::mutex> lock(database_mutex_);
+        ReadLock lock(database_mutex_);
         
-        if (vectors_.empty()) {
+        RowBitmap rows = filterRows(filter);
+        return toSearchResults(searchRows(query, k, params, &rows));
+    }
+    
+    std::vector<SearchResult> search_radius(const std::vector<float>& query, float radius, const Filter& filter,
+                                            const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_RADIUS, 1);
+        if (!validateVector(query)) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
             return {};
         }
         
-        // Use priority queue to maintain top-k results
-        std::priority_queue<SearchResult, std::vector<SearchResult>, std::greater<SearchResult>> pq;
+        ReadLock lock(database_mutex_);
         
-        for (const auto& pair : vectors_) {
-            float distance = calculateDistance(query, pair.second);
-            
-            if (pq.size() < k) {
-                pq.emplace(pair.first, distance, pair.second);
-            } else if (distance < pq.top().distance) {
-                pq.pop();
-                pq.emplace(pair.first, distance, pair.second);
-            }
+        RowBitmap rows = filterRows(filter);
+        return toSearchResults(searchRadiusRows(query, radius, params, &rows));
+    }
+    
+    std::vector<SearchHit> search_hits(const std::vector<float>& query, size_t k, const Filter& filter,
+                                       const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
+        if (!validateVector(query)) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            return {};
         }
         
-        // Convert to vector and sort by distance
-        std::vector<SearchResult> results;
-        results.reserve(pq.size());
+        ReadLock lock(database_mutex_);
         
-        while (!pq.empty()) {
-            results.push_back(pq.top());
-            pq.pop();
+        RowBitmap rows = filterRows(filter);
+        return toSearchHits(searchRows(query, k, params, &rows));
+    }
+    
+    std::vector<SearchHit> search_radius_hits(const std::vector<float>& query, float radius, const Filter& filter,
+                                              const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_RADIUS, 1);
+        if (!validateVector(query)) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            return {};
         }
         
-        std::sort(results.begin(), results.end(), 
-                  [](const SearchResult& a, const SearchResult& b) {
-                      return a.distance < b.distance;
-                  });
+        ReadLock lock(database_mutex_);
         
-        return results;
+        RowBitmap rows = filterRows(filter);
+        return toSearchHits(searchRadiusRows(query, radius, params, &rows));
     }
     
-    std::vector<SearchResult> search_radius(const std::vector<float>& query, float radius) const {
+    std::vector<SearchIdHit> search_ids(const std::vector<float>& query, size_t k, const Filter& filter,
+                                        const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
         if (!validateVector(query)) {
             std::cerr << "Error: Query vector dimension mismatch" << std::endl;
             return {};
         }
+        if (!requireIntegerIds()) {
+            return {};
+        }
         
-        std::lock_guard<std::mutex> lock(database_mutex_);
+        ReadLock lock(database_mutex_);
         
-        std::vector<SearchResult> results;
+        RowBitmap rows = filterRows(filter);
+        return toSearchIdHits(searchRows(query, k, params, &rows));
+    }
+    
+    // Batched k-NN: one blocked pass over the database answers all queries
+    std::vector<std::vector<SearchResult>> search_batch(const std::vector<std::vector<float>>& queries, size_t k,
+                                                        const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_BATCH, queries.size());
+        for (const auto& query : queries) {
+            if (!validateVector(query)) {
+                std::cerr << "Error: Query vector dimension mismatch in batch" << std::endl;
+                return {};
+            }
+        }
         
-        for (const auto& pair : vectors_) {
-            float distance = calculateDistance(query, pair.second);
-            if (distance <= radius) {
-                results.emplace_back(pair.first, distance, pair.second);
+        ReadLock lock(database_mutex_);
+        
+        std::vector<std::vector<SearchResult>> results(queries.size());
+        if (storage_.empty()) {
+            return results;
+        }
+        
+        auto rows = dispatchMetric([&](auto metric) {
+            return searchBatchRows<decltype(metric)::value>(queries, k, params);
+        });
+        for (size_t q = 0; q < queries.size(); ++q) {
+            results[q] = toSearchResults(rows[q]);
+        }
+        return results;
+    }
+    
+    // Same as search_batch(), but results carry only ID and distance
+    std::vector<std::vector<SearchHit>> search_batch_hits(const std::vector<std::vector<float>>& queries, size_t k,
+                                                          const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_BATCH, queries.size());
+        for (const auto& query : queries) {
+            if (!validateVector(query)) {
+                std::cerr << "Error: Query vector dimension mismatch in batch" << std::endl;
+                return {};
             }
         }
         
-        // Sort by distance
-        std::sort(results.begin(), results.end(),
-                  [](const SearchResult& a, const SearchResult& b) {
-                      return a.distance < b.distance;
-                  });
+        ReadLock lock(database_mutex_);
+        
+        std::vector<std::vector<SearchHit>> results(queries.size());
+        if (storage_.empty()) {
+            return results;
+        }
         
+        auto rows = dispatchMetric([&](auto metric) {
+            return searchBatchRows<decltype(metric)::value>(queries, k, params);
+        });
+        for (size_t q = 0; q < queries.size(); ++q) {
+            results[q] = toSearchHits(rows[q]);
+        }
         return results;
     }
     
+    // Non-blocking k-NN. The query is queued and answered together with the
+    // other queries submitted within async_max_wait_us, in one search_batch
+    // pass; done receives the results on the scheduler thread (no results if
+    // the query has the wrong dimension).
+    void search_async(const std::vector<float>& query, size_t k,
+                      std::function<void(std::vector<SearchResult>)> done,
+                      const SearchParams& params = SearchParams()) const {
+        if (!validateVector(query)) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            asyncScheduler().reject(std::move(done));
+            return;
+        }
+        asyncScheduler().submit(query, k, params, std::move(done));
+    }
+    
+    std::future<std::vector<SearchResult>> search_async(const std::vector<float>& query, size_t k,
+                                                        const SearchParams& params = SearchParams()) const {
+        if (!validateVector(query)) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            std::promise<std::vector<SearchResult>> empty;
+            empty.set_value({});
+            return empty.get_future();
+        }
+        return asyncScheduler().submit(query, k, params);
+    }
+    
+    // Requests queued by search_async() and the batch passes that answered them
+    BatchScheduler<SearchResult>::Stats async_search_stats() const {
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        return async_scheduler_ ? async_scheduler_->stats() : BatchScheduler<SearchResult>::Stats();
+    }
+    
     // Database operations
+    // Write the database in the memory-mappable file format
     bool save(const std::string& filepath) const {
-        std::lock_guard<std::mutex> lock(database_mutex_);
-        
-        std::ofstream file(filepath, std::ios::binary);
-        if (!file.is_open()) {
-            std::cerr << "Error: Cannot open file for writing: " << filepath << std::endl;
+        auto timer = metrics_.time(DatabaseOperation::SAVE);
+        ReadLock lock(database_mutex_);
+        return DatabaseFile::write(filepath, storage_, config_.distance_metric);
+    }
+    
+    // Open a saved database. FLOAT32 databases are served straight from a
+    // read-only memory map of the file (nothing is deserialized, and the pages
+    // are shared with other processes mapping it); the first write copies the
+    // data into memory. Compressed encodings are built from the mapped rows.
+    // Files in the older unversioned format are still read.
+    bool load(const std::string& filepath) {
+        auto timer = metrics_.time(DatabaseOperation::LOAD);
+        // Build the new storage without holding the lock, then swap it in,
+        // so queries keep running against the old data while the file loads
+        VectorStorage loaded = makeLoadingStorage();
+        if (!readFile(filepath, loaded)) {
             return false;
         }
+        replaceStorage(std::move(loaded));
+        return true;
+    }
+    
+    // Fold the write-ahead log into a new snapshot. The log is sealed and
+    // a fresh one started under a short lock; the snapshot is then rebuilt
+    // from the previous snapshot and the sealed log alone, so searches and
+    // writes continue against the live database the whole time. A crash at
+    // any point is recovered from (old or new snapshot plus the logs);
+    // replaying a sealed log over a snapshot that already contains it is
+    // harmless as every record sets a final state.
+    bool checkpoint() {
+        if (!wal_) {
+            std::cerr << "Error: checkpoint() needs durability_path to be set" << std::endl;
+            return false;
+        }
+        std::lock_guard<std::mutex> guard(checkpoint_mutex_);
         
-        // Write header
-        file.write(reinterpret_cast<const char*>(&dimension_), sizeof(dimension_));
-        size_t vector_count = vectors_.size();
-        file.write(reinterpret_cast<const char*>(&vector_count), sizeof(vector_count));
-        
-        // Write vectors
-        for (const auto& pair : vectors_) {
-            size_t id_length = pair.first.length();
-            file.write(reinterpret_cast<const char*>(&id_length), sizeof(id_length));
-            file.write(pair.first.c_str(), id_length);
-            file.write(reinterpret_cast<const char*>(pair.second.data()), 
-                      dimension_ * sizeof(float));
+        // A sealed log left by a failed checkpoint is folded in first
+        if (!std::filesystem::exists(frozenWalPath()) && !wal_->rotate(frozenWalPath())) {
+            return false;
         }
         
-        return file.good();
+        VectorStorage merged(dimension_);
+        if (std::filesystem::exists(snapshotPath())) {
+            std::shared_ptr<const DatabaseFile> file = DatabaseFile::open(snapshotPath());
+            if (!file || file->header().dimension != dimension_ || file->header().stride != merged.stride()) {
+                std::cerr << "Error: Cannot read database snapshot: " << snapshotPath() << std::endl;
+                return false;
+            }
+            merged = VectorStorage(dimension_, file);
+        }
+        bool replayed = WriteAheadLog::replay(frozenWalPath(), dimension_,
+            [&merged](WriteAheadLog::Op op, const std::string& id, const float* values, const Attributes& attributes) {
+                switch (op) {
+                    case WriteAheadLog::Op::PUT:
+                        merged.put(id, values);
+                        break;
+                    case WriteAheadLog::Op::REMOVE:
+                        merged.remove(id);
+                        break;
+                    case WriteAheadLog::Op::CLEAR:
+                        merged.clear();
+                        break;
+                    case WriteAheadLog::Op::ATTRIBUTES:
+                        setAttributes(merged, id, attributes);
+                        break;
+                }
+            });
+        if (!replayed || !DatabaseFile::write(snapshotPath(), merged, config_.distance_metric)) {
+            return false;
+        }
+        std::remove(frozenWalPath().c_str());
+        return true;
     }
     
-    bool load(const std::string& filepath) {
-        std::ifstream file(filepath, std::ios::binary);
-        if (!file.is_open()) {
-            std::cerr << "Error: Cannot open file for reading: " << filepath << std::endl;
+    void clear() {
+        uint64_t lsn = 0;
+        {
+            WriteLock lock(database_mutex_);
+            clearVectors();
+            if (wal_) lsn = wal_->appendClear();
+        }
+        commitWrite(lsn);
+    }
+    
+    size_t size() const {
+        ReadLock lock(database_mutex_);
+        return storage_.liveSize();
+    }
+    
+    // Remove tombstoned rows from the storage and index now instead of
+    // waiting for the background compaction; returns the rows reclaimed
+    size_t compact() {
+        WriteLock lock(database_mutex_);
+        return compactRows();
+    }
+    
+    // Rebuild the index (and re-encode the vectors) under new settings while
+    // the database stays online. From config the index fields (index_type,
+    // kd_tree_*, lsh_*, hnsw_*, ivf_*), encoding, pq_subspaces and
+    // rerank_candidates are taken; the metric, capacity, durability and
+    // other settings stay as they are. The live rows are copied in chunks
+    // under the read lock and indexed without any lock, so searches keep
+    // using the current index and writes keep updating it. Writes made
+    // meanwhile are recorded and replayed on the copy, and the copy is swapped
+    // in under the write lock once at most config.rebuild_swap_entries remain,
+    // so searches are held up only for that many. Memory for a second copy
+    // of the vectors, plus up to config.rebuild_max_delta_bytes of recorded
+    // writes, is needed while it runs. Returns false, keeping the current
+    // index, if another rebuild is running, load() / import_file() replaced
+    // the data meanwhile, or writes came in faster than the copy caught up
+    // (the recorded writes overflowed, or still exceeded the swap budget
+    // after kRebuildCatchUpRounds).
+    bool rebuild_index(const VectorDatabaseConfig& config) {
+        std::unique_lock<std::mutex> rebuilding(rebuild_mutex_, std::try_to_lock);
+        if (!rebuilding.owns_lock()) {
+            std::cerr << "Error: An index rebuild is already running" << std::endl;
             return false;
         }
         
-        std::lock_guard<std::mutex> lock(database_mutex_);
+        VectorDatabaseConfig rebuilt_config;
+        size_t rows = 0;
+        {
+            WriteLock lock(database_mutex_);
+            rebuilt_config = config_;
+            rows = storage_.size();
+            rebuild_delta_ = std::make_unique<RebuildDelta>(config.rebuild_max_delta_bytes);
+        }
+        // Stop recording however the rebuild ends, so rows are not left
+        // pinned if building the copy throws
+        struct StopRecording {
+            VectorDatabase& db;
+            ~StopRecording() {
+                WriteLock lock(db.database_mutex_);
+                db.rebuild_delta_.reset();
+            }
+        } stop_recording{*this};
+        copyIndexSettings(config, rebuilt_config);
         
-        // Read header
-        size_t file_dimension;
-        file.read(reinterpret_cast<char*>(&file_dimension), sizeof(file_dimension));
+        // Rows keep their numbers while the delta is set, so each chunk picks
+        // up where the last one ended; later writes reach the copy by replay.
+        // The copy's exact-copy file is kept apart from a concurrent load()'s
+        VectorStorage rebuilt = makeLoadingStorage(rebuilt_config.encoding, rebuilt_config.pq_subspaces, ".rebuilding");
+        rebuilt.reserve(rows);
+        std::vector<float> vector(dimension_);
+        for (size_t begin = 0; begin < rows; begin += kRebuildCopyRows) {
+            ReadLock lock(database_mutex_);
+            const size_t end = std::min(begin + kRebuildCopyRows, storage_.size());
+            for (size_t row = begin; row < end; ++row) {
+                if (!storage_.live(row)) {
+                    continue;
+                }
+                storage_.copyVector(row, vector.data());
+                size_t copied = config_.integer_ids ? rebuilt.put(storage_.numericId(row), vector.data())
+                                                    : rebuilt.put(storage_.id(row), vector.data());
+                if (storage_.attributes().hasAny(row)) {
+                    rebuilt.attributes().set(copied, storage_.attributes().get(row));
+                }
+            }
+        }
         
-        if (file_dimension != dimension_) {
-            std::cerr << "Error: File dimension mismatch. Expected " << dimension_ 
-                      << ", got " << file_dimension << std::endl;
+        auto outpaced = [] {
+            std::cerr << "Error: Index rebuild abandoned, writes came in faster than it could replay them"
+                      << std::endl;
             return false;
+        };
+        if (rebuild_delta_->overflowed()) {
+            return outpaced();
         }
-
+        std::unique_ptr<VectorIndex> index = createIndex(rebuilt_config);
+        if (index) index->build(rebuilt);
         
-        size_t vector_count;
-        file.read(reinterpret_cast<char*>(&vector_count), sizeof(vector_count));
+        // Catch up off the lock while writes keep coming, then finish under it
+        for (size_t round = 0; round < kRebuildCatchUpRounds && !rebuild_delta_->replaced(); ++round) {
+            if (rebuild_delta_->overflowed()) {
+                return outpaced();
+            }
+            std::vector<RebuildDelta::Entry> entries = rebuild_delta_->take();
+            applyRebuildDelta(rebuilt, index.get(), entries);
+            if (entries.size() <= config.rebuild_swap_entries) {
+                break;
+            }
+        }
         
-        // Clear existing vectors
-        vectors_.clear();
+        WriteLock lock(database_mutex_);
+        std::unique_ptr<RebuildDelta> delta = std::move(rebuild_delta_);
+        if (delta->replaced()) {
+            std::cerr << "Error: Index rebuild abandoned, the data was replaced while it ran" << std::endl;
+            return false;
+        }
+        // Bound the replay that holds up searches
+        if (delta->overflowed() || delta->size() > config.rebuild_swap_entries) {
+            return outpaced();
+        }
+        applyRebuildDelta(rebuilt, index.get(), delta->take());
         
-        // Read vectors
-        for (size_t i = 0; i < vector_count; ++i) {
-            size_t id_length;
-            file.read(reinterpret_cast<char*>(&id_length), sizeof(id_length));
-            
-            std::string id(id_length, '\0');
-            file.read(&id[0], id_length);
-            
-            std::vector<float> vector(dimension_);
-            file.read(reinterpret_cast<char*>(vector.data()), dimension_ * sizeof(float));
-            
-            vectors_[id] = std::move(vector);
+        ++generation_;
+        copyIndexSettings(rebuilt_config, config_);
+        storage_ = std::move(rebuilt);
+        index_ = std::move(index);
+        if (storage_.hasFullPrecision()) {
+            storage_.fullPrecisionFile()->rename(config_.full_precision_path);
+        }
+        return true;
+    }
+    
+    // Rebuild with another index type, keeping the other settings
+    bool rebuild_index(IndexType index_type) {
+        VectorDatabaseConfig config;
+        {
+            ReadLock lock(database_mutex_);
+            config = config_;
         }
-        
-        return file.good();
+        config.index_type = index_type;
+        return rebuild_index(config);
     }
     
-    void clear() {
-        std::lock_guard<std::mutex> lock(database_mutex_);
-        vectors_.clear();
+    // Counters, latency histograms and sizes of the database; render them
+    // with DatabaseStats::prometheus() for monitoring
+    DatabaseStats stats() const {
+        ReadLock lock(database_mutex_);
+        return statsLocked();
     }
     
-    size_t size() const {
-        std::lock_guard<std::mutex> lock(database_mutex_);
-        return vectors_.size();
+    // Hit and miss counts, entries and approximate bytes of the query cache
+    // (all zero when query_cache_entries is 0)
+    QueryCache::Stats query_cache_stats() const {
+        return query_cache_ ? query_cache_->stats() : QueryCache::Stats();
     }
     
     size_t dimension() const {
@@ -527,46 +9237,71 @@ public:
     
     // Get vector by ID
     std::vector<float> get_vector(const std::string& id) const {
-        std::lock_guard<std::mutex> lock(database_mutex_);
-        auto it = vectors_.find(id);
-        if (it != vectors_.end()) {
-            return it->second;
-        }
-        return {};
+        return getVector(id);
+    }
+    
+    std::vector<float> get_vector(uint64_t id) const {
+        return validateId(id) ? getVector(id) : std::vector<float>();
+    }
+    
+    // Set attributes of a stored vector, keeping any it has that are not named
+    bool set_attributes(const std::string& id, const Attributes& attributes) {
+        return setAttributesLogged(id, id, attributes);
+    }
+    
+    bool set_attributes(uint64_t id, const Attributes& attributes) {
+        return validateId(id) && setAttributesLogged(id, std::to_string(id), attributes);
+    }
+    
+    // Attributes of a vector (empty if the ID does not exist or has none)
+    Attributes get_attributes(const std::string& id) const {
+        return getAttributes(id);
+    }
+    
+    Attributes get_attributes(uint64_t id) const {
+        return validateId(id) ? getAttributes(id) : Attributes();
     }
     
     // Check if vector exists
     bool exists(const std::string& id) const {
-        std::lock_guard<std::mutex> lock(database_mutex_);
-        return vectors_.find(id) != vectors_.end();
+        ReadLock lock(database_mutex_);
+        return storage_.find(id) != VectorStorage::npos;
+    }
+    
+    bool exists(uint64_t id) const {
+        if (!validateId(id)) {
+            return false;
+        }
+        ReadLock lock(database_mutex_);
+        return storage_.find(id) != VectorStorage::npos;
     }
     
     // Remove vector
     bool remove(const std::string& id) {
-        std::lock_guard<std::mutex> lock(database_mutex_);
-        return vectors_.erase(id) > 0;
+        return removeLogged(id, id);
+    }
+    
+    bool remove(uint64_t id) {
+        return validateId(id) && removeLogged(id, std::to_string(id));
     }
     
     // Get all vector IDs
     std::vector<std::string> get_all_ids() const {
-        std::lock_guard<std::mutex> lock(database_mutex_);
-        std::vector<std::string> ids;
-        ids.reserve(vectors_.size());
-        
-        for (const auto& pair : vectors_) {
-            ids.push_back(pair.first);
-        }
-        
-        return ids;
+        ReadLock lock(database_mutex_);
+        return storage_.ids();
     }
     
     // Display database stats
     void print_stats() const {
-        std::lock_guard<std::mutex> lock(database_mutex_);
+        ReadLock lock(database_mutex_);
+        DatabaseStats stats = statsLocked();
         
         std::cout << "=== VectorDatabase Statistics ===" << std::endl;
         std::cout << "Vector Dimension: " << dimension_ << std::endl;
-        std::cout << "Total Vectors: " << vectors_.size() << std::endl;
+        std::cout << "Total Vectors: " << stats.vectors << std::endl;
+        if (stats.deleted > 0) {
+            std::cout << "Deleted (awaiting compaction): " << stats.deleted << std::endl;
+        }
         std::cout << "Max Capacity: " << config_.max_vectors << std::endl;
         std::cout << "Distance Metric: ";
         
@@ -594,19 +9329,74 @@ public:
                 std::cout << "KD-Tree" << std::endl;
                 break;
             case IndexType::HASH_TABLE:
-                std::cout << "Hash Table" << std::endl;
+                std::cout << "Hash Table (LSH)" << std::endl;
+                break;
+            case IndexType::HNSW:
+                std::cout << "HNSW" << std::endl;
                 break;
+            case IndexType::IVF:
+                std::cout << "IVF" << std::endl;
+                break;
+        }
+        if (config_.index_type != IndexType::LINEAR && !index_) {
+            std::cout << "Index Fallback: Linear scan" << std::endl;
+        }
+        
+        std::cout << "SIMD Kernels: " << kernels_.name << std::endl;
+        if (config_.encoding != VectorEncoding::FLOAT32) {
+            const VectorCodec* codec = storage_.codec();
+            std::cout << "Vector Encoding: " << codec->name();
+            if (config_.encoding == VectorEncoding::PQ) {
+                std::cout << ", " << codec->subspaces() << " subspaces";
+            }
+            std::cout << (storage_.quantized() ? "" : " (collecting training data)") << std::endl;
+            std::cout << "Bytes per Vector: " << (storage_.quantized() ? codec->codeSize() : storage_.stride() * sizeof(float))
+                      << " (FLOAT32: " << dimension_ * sizeof(float) << ")" << std::endl;
+            if (storage_.hasFullPrecision()) {
+                std::cout << "Full-Precision File: " << config_.full_precision_path << std::endl;
+            }
+        }
+        
+        if (wal_) {
+            const char* sync = config_.wal_sync == WalSyncMode::ALWAYS   ? "every write"
+                               : config_.wal_sync == WalSyncMode::NONE   ? "at checkpoints"
+                                                                         : "every interval";
+            std::cout << "Write-Ahead Log: " << wal_->path() << " (" << wal_->bytes() / 1024
+                      << " KB, fsync " << sync << ")" << std::endl;
         }
         
-        std::cout << "Memory Usage (approx): " 
-                  << (vectors_.size() * dimension_ * sizeof(float)) / (1024 * 1024) 
-                  << " MB" << std::endl;
+        if (storage_.mapped()) {
+            std::cout << "Memory-Mapped Vectors: " << storage_.mappedBytes() / (1024 * 1024)
+                      << " MB (shared page cache, not counted below)" << std::endl;
+        }
+        
+        std::cout << "ID Table: " << (config_.integer_ids ? "integer" : "string") << " IDs, "
+                  << storage_.idBytes() / 1024 << " KB" << std::endl;
+        const AttributeTable& attributes = storage_.attributes();
+        if (!attributes.empty()) {
+            std::cout << "Attributes: " << attributes.columnCount() << " columns, "
+                      << attributes.memoryBytes() / 1024 << " KB" << std::endl;
+        }
+        
+        const QueryCache::Stats& cache = stats.query_cache;
+        if (query_cache_) {
+            std::cout << "Query Cache: " << cache.entries << "/" << config_.query_cache_entries << " entries, "
+                      << cache.bytes / 1024 << " KB, hit rate " << static_cast<int>(100 * stats.cacheHitRate())
+                      << "% (" << cache.hits << " hits, " << cache.misses << " misses)" << std::endl;
+        }
+        if (stats.async.requests > 0) {
+            std::cout << "Async Searches: " << stats.async.requests << " in " << stats.async.batches
+                      << " batches" << std::endl;
+        }
+        stats.printActivity(std::cout);
+        
+        std::cout << "Memory Usage (approx): " << stats.memory_bytes / (1024 * 1024) << " MB" << std::endl;
         std::cout << "=================================" << std::endl;
     }
     
     // Performance benchmark for high-dimensional vectors
     void benchmark_search(size_t num_queries = 100) const {
-        if (vectors_.empty()) {
+        if (size() == 0) {
             std::cout << "Cannot benchmark: database is empty" << std::endl;
             return;
         }
@@ -634,6 +9424,638 @@ public:
     }
 };
 
+// Merge per-partition results (each sorted by distance) into the k nearest
+// overall; ties keep partition order. Works for any result type with a
+// distance member, so shards of one process and remote partitions merge alike.
+template <typename Result>
+std::vector<Result> mergeNearest(std::vector<std::vector<Result>>& partial,
+                                 size_t k = std::numeric_limits<size_t>::max()) {
+    size_t total = 0;
+    for (const auto& results : partial) {
+        total += results.size();
+    }
+    std::vector<Result> merged;
+    merged.reserve(total);
+    for (auto& results : partial) {
+        std::move(results.begin(), results.end(), std::back_inserter(merged));
+    }
+    auto closer = [](const Result& a, const Result& b) { return a.distance < b.distance; };
+    std::stable_sort(merged.begin(), merged.end(), closer);
+    if (merged.size() > k) {
+        merged.erase(merged.begin() + k, merged.end());
+    }
+    return merged;
+}
+
+// A database split into independent VectorDatabase shards, each with its own
+// storage, index and lock, so writes to different shards run concurrently.
+// IDs are routed to a shard by a stable hash (integer IDs by value, so "42"
+// and 42 agree); single-ID operations touch only that shard. Searches run on
+// every shard in parallel and merge the per-shard top-k. The configuration
+// applies to each shard, except that max_vectors bounds the total and the
+// threads are divided among the shards.
+class ShardedVectorDatabase {
+private:
+    size_t dimension_;
+    VectorDatabaseConfig config_;
+    std::vector<std::unique_ptr<VectorDatabase>> shards_;
+    // Fans searches and batches out across shards; null with one thread
+    std::unique_ptr<ThreadPool> pool_;
+    // With numa_aware on a multi-node machine: the node of every shard and,
+    // per node, a pool with one pinned worker for each of its shards. Work
+    // for a shard then runs on its node instead of through pool_.
+    std::vector<size_t> shard_nodes_;
+    std::vector<std::unique_ptr<ThreadPool>> node_pools_;
+    // Latencies of the operations on the whole collection
+    mutable DatabaseMetrics metrics_;
+    // search_async() scheduler; declared last so it is destroyed, and its
+    // queue answered, while the shards and pools still exist
+    mutable std::mutex async_mutex_;
+    mutable std::unique_ptr<BatchScheduler<SearchResult>> async_scheduler_;
+    // Rows admitted against max_vectors whose shard writes have not finished.
+    // Taken and returned under capacity_mutex_, so a write still in flight is
+    // counted here until size() sees it and capacity is never oversubscribed.
+    std::mutex capacity_mutex_;
+    size_t reserved_ = 0;
+    
+    static uint64_t hashId(std::string_view id) {
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : id) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+    
+    static uint64_t hashId(uint64_t id) {
+        id ^= id >> 33;
+        id *= 0xff51afd7ed558ccdull;
+        id ^= id >> 33;
+        return id;
+    }
+    
+    size_t shardOf(uint64_t id) const { return hashId(id) % shards_.size(); }
+    
+    size_t shardOf(std::string_view id) const {
+        uint64_t number;
+        if (config_.integer_ids && IdTable::parseNumber(id, number)) {
+            return shardOf(number);
+        }
+        return hashId(id) % shards_.size();
+    }
+    
+    VectorDatabase& shardFor(const std::string& id) const { return *shards_[shardOf(id)]; }
+    VectorDatabase& shardFor(uint64_t id) const { return *shards_[shardOf(id)]; }
+    
+    std::string shardPath(const std::string& path, size_t shard) const {
+        return path.empty() ? path : path + ".shard" + std::to_string(shard);
+    }
+    
+    // Run fn(db) for one shard on a thread of the shard's NUMA node, so that
+    // memory it allocates is first touched, and so placed, on that node
+    template <typename Fn>
+    auto onShard(size_t shard, Fn&& fn) const {
+        if (node_pools_.empty()) {
+            return fn(*shards_[shard]);
+        }
+        return node_pools_[shard_nodes_[shard]]->submit([&] { return fn(*shards_[shard]); }).get();
+    }
+    
+    // Run fn(shard) for every shard, in parallel when there is a pool
+    template <typename Fn>
+    void forEachShard(Fn&& fn) const {
+        auto run = [&](size_t shard) { fn(shard, *shards_[shard]); };
+        if (!node_pools_.empty()) {
+            std::vector<std::future<void>> pending;
+            pending.reserve(shards_.size());
+            for (size_t shard = 0; shard < shards_.size(); ++shard) {
+                pending.push_back(node_pools_[shard_nodes_[shard]]->submit([&run, shard] { run(shard); }));
+            }
+            for (auto& done : pending) {
+                done.get();
+            }
+        } else if (pool_) {
+            pool_->parallelFor(shards_.size(), run);
+        } else {
+            for (size_t shard = 0; shard < shards_.size(); ++shard) {
+                run(shard);
+            }
+        }
+    }
+    
+    // Scatter a search to all shards and merge the results
+    template <typename Search>
+    auto gather(const std::vector<float>& query, size_t k, Search&& search) const {
+        using Results = decltype(search(*shards_[0]));
+        if (query.size() != dimension_) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            return Results();
+        }
+        std::vector<Results> partial(shards_.size());
+        forEachShard([&](size_t shard, const VectorDatabase& db) { partial[shard] = search(db); });
+        return mergeNearest(partial, k);
+    }
+    
+    template <typename Search>
+    auto gatherBatch(const std::vector<std::vector<float>>& queries, size_t k, Search&& search) const {
+        using Results = decltype(search(*shards_[0]));
+        for (const auto& query : queries) {
+            if (query.size() != dimension_) {
+                std::cerr << "Error: Query vector dimension mismatch in batch" << std::endl;
+                return Results();
+            }
+        }
+        std::vector<Results> partial(shards_.size());
+        forEachShard([&](size_t shard, const VectorDatabase& db) { partial[shard] = search(db); });
+        
+        Results merged(queries.size());
+        std::vector<typename Results::value_type> per_query(shards_.size());
+        for (size_t q = 0; q < queries.size(); ++q) {
+            for (size_t shard = 0; shard < shards_.size(); ++shard) {
+                per_query[shard] = std::move(partial[shard][q]);
+            }
+            merged[q] = mergeNearest(per_query, k);
+        }
+        return merged;
+    }
+    
+    bool requireIntegerIds() const {
+        if (!config_.integer_ids) {
+            std::cerr << "Error: Integer IDs need VectorDatabaseConfig::integer_ids" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    BatchScheduler<SearchResult>& asyncScheduler() const {
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        if (!async_scheduler_) {
+            async_scheduler_ = std::make_unique<BatchScheduler<SearchResult>>(
+                [this](const std::vector<std::vector<float>>& queries, size_t k, const SearchParams& params) {
+                    return search_batch(queries, k, params);
+                },
+                config_.async_max_batch, std::chrono::microseconds(config_.async_max_wait_us));
+        }
+        return *async_scheduler_;
+    }
+    
+    // Each shard is configured with the whole max_vectors, so the collection
+    // enforces it: write() runs only once room for added new rows is reserved
+    // across all shards, and the reservation is returned when it finishes
+    template <typename Write>
+    bool withCapacity(size_t added, Write&& write) {
+        {
+            std::lock_guard<std::mutex> lock(capacity_mutex_);
+            if (size() + reserved_ + added > config_.max_vectors) {
+                if (added == 1) {
+                    std::cerr << "Error: Maximum vector capacity reached (" << config_.max_vectors << ")" << std::endl;
+                } else {
+                    std::cerr << "Error: Batch insert would exceed maximum capacity" << std::endl;
+                }
+                return false;
+            }
+            reserved_ += added;
+        }
+        struct Release {
+            ShardedVectorDatabase& db;
+            size_t added;
+            ~Release() {
+                std::lock_guard<std::mutex> lock(db.capacity_mutex_);
+                db.reserved_ -= added;
+            }
+        } release{*this, added};
+        return write();
+    }
+    
+    std::string manifestPath(const std::string& path) const { return path + ".shards"; }
+    
+    // Split a batch by shard and write the parts concurrently. Each shard's
+    // part is atomic, the batch as a whole is not.
+    bool writeBatch(const std::map<std::string, std::vector<float>>& vectors, bool upsert) {
+        std::vector<std::map<std::string, std::vector<float>>> parts(shards_.size());
+        for (const auto& pair : vectors) {
+            parts[shardOf(pair.first)].insert(pair);
+        }
+        std::atomic<bool> ok{true};
+        forEachShard([&](size_t shard, VectorDatabase& db) {
+            if (!parts[shard].empty() && !(upsert ? db.upsert_batch(parts[shard]) : db.insert_batch(parts[shard]))) {
+                ok = false;
+            }
+        });
+        return ok;
+    }
+
+public:
+    ShardedVectorDatabase(size_t dimension, size_t shard_count,
+                          const VectorDatabaseConfig& config = VectorDatabaseConfig())
+        : dimension_(dimension), config_(config) {
+        if (shard_count == 0) {
+            throw std::invalid_argument("Shard count must be greater than 0");
+        }
+        VectorDatabaseConfig shard_config = config;
+        shard_config.thread_count = std::max<size_t>(1, config.thread_count / shard_count);
+        const NumaTopology& numa = NumaTopology::system();
+        if (config.numa_aware && numa.nodeCount() > 1) {
+            shard_nodes_.resize(shard_count);
+            for (size_t shard = 0; shard < shard_count; ++shard) {
+                shard_nodes_[shard] = shard % numa.nodeCount();
+            }
+        }
+        shards_.reserve(shard_count);
+        for (size_t shard = 0; shard < shard_count; ++shard) {
+            shard_config.durability_path = shardPath(config.durability_path, shard);
+            shard_config.full_precision_path = shardPath(config.full_precision_path, shard);
+            if (!shard_nodes_.empty()) {
+                shard_config.numa_node = static_cast<int>(shard_nodes_[shard]);
+            }
+            shards_.push_back(std::make_unique<VectorDatabase>(dimension, shard_config));
+        }
+        
+        if (!shard_nodes_.empty()) {
+            size_t nodes = std::min(shard_count, numa.nodeCount());
+            for (size_t node = 0; node < nodes; ++node) {
+                size_t workers = (shard_count - node + nodes - 1) / nodes;
+                node_pools_.push_back(std::make_unique<ThreadPool>(
+                    workers, [&numa, node] { numa.pinCurrentThread(node); }));
+            }
+            return;
+        }
+        size_t threads = std::min(shard_count, config.thread_count);
+        if (threads > 1) {
+            pool_ = std::make_unique<ThreadPool>(threads - 1);
+        }
+    }
+    
+    // Insert operations
+    bool insert(const std::string& id, const std::vector<float>& vector) {
+        auto timer = metrics_.time(DatabaseOperation::INSERT);
+        return withCapacity(1, [&] {
+            return onShard(shardOf(id), [&](VectorDatabase& db) { return db.insert(id, vector); });
+        });
+    }
+    
+    bool insert(uint64_t id, const std::vector<float>& vector) {
+        auto timer = metrics_.time(DatabaseOperation::INSERT);
+        return withCapacity(1, [&] {
+            return onShard(shardOf(id), [&](VectorDatabase& db) { return db.insert(id, vector); });
+        });
+    }
+    
+    bool insert(const std::string& id, const std::vector<float>& vector, const Attributes& attributes) {
+        auto timer = metrics_.time(DatabaseOperation::INSERT);
+        return withCapacity(1, [&] {
+            return onShard(shardOf(id), [&](VectorDatabase& db) { return db.insert(id, vector, attributes); });
+        });
+    }
+    
+    bool insert(uint64_t id, const std::vector<float>& vector, const Attributes& attributes) {
+        auto timer = metrics_.time(DatabaseOperation::INSERT);
+        return withCapacity(1, [&] {
+            return onShard(shardOf(id), [&](VectorDatabase& db) { return db.insert(id, vector, attributes); });
+        });
+    }
+    
+    bool insert_batch(const std::map<std::string, std::vector<float>>& vectors) {
+        auto timer = metrics_.time(DatabaseOperation::INSERT_BATCH);
+        return withCapacity(vectors.size(), [&] { return writeBatch(vectors, false); });
+    }
+    
+    bool upsert(const std::string& id, const std::vector<float>& vector) {
+        auto timer = metrics_.time(DatabaseOperation::UPSERT);
+        return withCapacity(exists(id) ? 0 : 1, [&] {
+            return onShard(shardOf(id), [&](VectorDatabase& db) { return db.upsert(id, vector); });
+        });
+    }
+    
+    bool upsert(uint64_t id, const std::vector<float>& vector) {
+        auto timer = metrics_.time(DatabaseOperation::UPSERT);
+        return withCapacity(exists(id) ? 0 : 1, [&] {
+            return onShard(shardOf(id), [&](VectorDatabase& db) { return db.upsert(id, vector); });
+        });
+    }
+    
+    bool upsert_batch(const std::map<std::string, std::vector<float>>& vectors) {
+        auto timer = metrics_.time(DatabaseOperation::INSERT_BATCH);
+        size_t added = 0;
+        for (const auto& pair : vectors) {
+            added += !shardFor(pair.first).exists(pair.first);
+        }
+        return withCapacity(added, [&] { return writeBatch(vectors, true); });
+    }
+    
+    bool remove(const std::string& id) {
+        auto timer = metrics_.time(DatabaseOperation::REMOVE);
+        return shardFor(id).remove(id);
+    }
+    
+    bool remove(uint64_t id) {
+        auto timer = metrics_.time(DatabaseOperation::REMOVE);
+        return shardFor(id).remove(id);
+    }
+    
+    // Single-ID reads, routed to the owning shard
+    bool exists(const std::string& id) const { return shardFor(id).exists(id); }
+    bool exists(uint64_t id) const { return shardFor(id).exists(id); }
+    std::vector<float> get_vector(const std::string& id) const { return shardFor(id).get_vector(id); }
+    std::vector<float> get_vector(uint64_t id) const { return shardFor(id).get_vector(id); }
+    
+    bool set_attributes(const std::string& id, const Attributes& attributes) {
+        return onShard(shardOf(id), [&](VectorDatabase& db) { return db.set_attributes(id, attributes); });
+    }
+    
+    bool set_attributes(uint64_t id, const Attributes& attributes) {
+        return onShard(shardOf(id), [&](VectorDatabase& db) { return db.set_attributes(id, attributes); });
+    }
+    
+    Attributes get_attributes(const std::string& id) const { return shardFor(id).get_attributes(id); }
+    Attributes get_attributes(uint64_t id) const { return shardFor(id).get_attributes(id); }
+    
+    // Search operations: every shard returns its k nearest, merged into the k nearest overall
+    std::vector<SearchResult> search(const std::vector<float>& query, size_t k,
+                                     const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
+        return gather(query, k, [&](const VectorDatabase& db) { return db.search(query, k, params); });
+    }
+    
+    std::vector<SearchResult> search(const std::vector<float>& query, size_t k, const Filter& filter,
+                                     const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
+        return gather(query, k, [&](const VectorDatabase& db) { return db.search(query, k, filter, params); });
+    }
+    
+    std::vector<SearchHit> search_hits(const std::vector<float>& query, size_t k,
+                                       const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
+        return gather(query, k, [&](const VectorDatabase& db) { return db.search_hits(query, k, params); });
+    }
+    
+    std::vector<SearchHit> search_hits(const std::vector<float>& query, size_t k, const Filter& filter,
+                                       const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
+        return gather(query, k, [&](const VectorDatabase& db) { return db.search_hits(query, k, filter, params); });
+    }
+    
+    std::vector<SearchIdHit> search_ids(const std::vector<float>& query, size_t k,
+                                        const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
+        if (!requireIntegerIds()) {
+            return {};
+        }
+        return gather(query, k, [&](const VectorDatabase& db) { return db.search_ids(query, k, params); });
+    }
+    
+    std::vector<SearchIdHit> search_ids(const std::vector<float>& query, size_t k, const Filter& filter,
+                                        const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH, 1);
+        if (!requireIntegerIds()) {
+            return {};
+        }
+        return gather(query, k, [&](const VectorDatabase& db) { return db.search_ids(query, k, filter, params); });
+    }
+    
+    std::vector<SearchResult> search_radius(const std::vector<float>& query, float radius,
+                                            const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_RADIUS, 1);
+        return gather(query, std::numeric_limits<size_t>::max(),
+                      [&](const VectorDatabase& db) { return db.search_radius(query, radius, params); });
+    }
+    
+    std::vector<SearchResult> search_radius(const std::vector<float>& query, float radius, const Filter& filter,
+                                            const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_RADIUS, 1);
+        return gather(query, std::numeric_limits<size_t>::max(),
+                      [&](const VectorDatabase& db) { return db.search_radius(query, radius, filter, params); });
+    }
+    
+    std::vector<SearchHit> search_radius_hits(const std::vector<float>& query, float radius,
+                                              const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_RADIUS, 1);
+        return gather(query, std::numeric_limits<size_t>::max(),
+                      [&](const VectorDatabase& db) { return db.search_radius_hits(query, radius, params); });
+    }
+    
+    std::vector<SearchHit> search_radius_hits(const std::vector<float>& query, float radius, const Filter& filter,
+                                              const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_RADIUS, 1);
+        return gather(query, std::numeric_limits<size_t>::max(),
+                      [&](const VectorDatabase& db) { return db.search_radius_hits(query, radius, filter, params); });
+    }
+    
+    // Batched k-NN: each shard answers the whole batch in one blocked pass
+    std::vector<std::vector<SearchResult>> search_batch(const std::vector<std::vector<float>>& queries, size_t k,
+                                                        const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_BATCH, queries.size());
+        return gatherBatch(queries, k, [&](const VectorDatabase& db) { return db.search_batch(queries, k, params); });
+    }
+    
+    std::vector<std::vector<SearchHit>> search_batch_hits(const std::vector<std::vector<float>>& queries, size_t k,
+                                                          const SearchParams& params = SearchParams()) const {
+        auto timer = metrics_.time(DatabaseOperation::SEARCH_BATCH, queries.size());
+        return gatherBatch(queries, k,
+                           [&](const VectorDatabase& db) { return db.search_batch_hits(queries, k, params); });
+    }
+    
+    // Non-blocking k-NN, micro-batched into search_batch() as in VectorDatabase
+    void search_async(const std::vector<float>& query, size_t k,
+                      std::function<void(std::vector<SearchResult>)> done,
+                      const SearchParams& params = SearchParams()) const {
+        if (query.size() != dimension_) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            asyncScheduler().reject(std::move(done));
+            return;
+        }
+        asyncScheduler().submit(query, k, params, std::move(done));
+    }
+    
+    std::future<std::vector<SearchResult>> search_async(const std::vector<float>& query, size_t k,
+                                                        const SearchParams& params = SearchParams()) const {
+        if (query.size() != dimension_) {
+            std::cerr << "Error: Query vector dimension mismatch" << std::endl;
+            std::promise<std::vector<SearchResult>> empty;
+            empty.set_value({});
+            return empty.get_future();
+        }
+        return asyncScheduler().submit(query, k, params);
+    }
+    
+    BatchScheduler<SearchResult>::Stats async_search_stats() const {
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        return async_scheduler_ ? async_scheduler_->stats() : BatchScheduler<SearchResult>::Stats();
+    }
+    
+    // Database operations, applied to every shard. save() writes one file per
+    // shard, <filepath>.shard<i>, and records the shard count in
+    // <filepath>.shards; load() needs the same count. load() reads every
+    // shard's file before replacing any shard's data, so on failure the
+    // database is left as it was.
+    bool save(const std::string& filepath) const {
+        auto timer = metrics_.time(DatabaseOperation::SAVE);
+        std::atomic<bool> ok{true};
+        forEachShard([&](size_t shard, const VectorDatabase& db) {
+            if (!db.save(shardPath(filepath, shard))) ok = false;
+        });
+        if (!ok) {
+            return false;
+        }
+        std::ofstream manifest(manifestPath(filepath), std::ios::trunc);
+        manifest << "shards " << shards_.size() << "\n";
+        if (!manifest.good()) {
+            std::cerr << "Error: Cannot write shard manifest: " << manifestPath(filepath) << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    bool load(const std::string& filepath) {
+        auto timer = metrics_.time(DatabaseOperation::LOAD);
+        // Saves without a manifest predate it; their shard count shows in
+        // which <filepath>.shard<i> files exist
+        size_t saved_shards = 0;
+        std::ifstream manifest(manifestPath(filepath));
+        if (manifest.is_open()) {
+            std::string key;
+            if (!(manifest >> key >> saved_shards) || key != "shards") {
+                std::cerr << "Error: Corrupt shard manifest: " << manifestPath(filepath) << std::endl;
+                return false;
+            }
+        } else {
+            while (std::filesystem::exists(shardPath(filepath, saved_shards))) {
+                ++saved_shards;
+            }
+        }
+        if (saved_shards != shards_.size()) {
+            std::cerr << "Error: " << filepath << " was saved with " << saved_shards << " shards, this database has "
+                      << shards_.size() << std::endl;
+            return false;
+        }
+        
+        std::vector<std::unique_ptr<VectorStorage>> loaded(shards_.size());
+        std::atomic<bool> ok{true};
+        forEachShard([&](size_t shard, VectorDatabase& db) {
+            loaded[shard] = std::make_unique<VectorStorage>(db.makeLoadingStorage());
+            if (!db.readFile(shardPath(filepath, shard), *loaded[shard])) ok = false;
+        });
+        if (!ok) {
+            return false;
+        }
+        forEachShard([&](size_t shard, VectorDatabase& db) { db.replaceStorage(std::move(*loaded[shard])); });
+        return true;
+    }
+    
+    bool checkpoint() {
+        std::atomic<bool> ok{true};
+        forEachShard([&](size_t, VectorDatabase& db) {
+            if (!db.checkpoint()) ok = false;
+        });
+        return ok;
+    }
+    
+    size_t compact() {
+        std::atomic<size_t> removed{0};
+        forEachShard([&](size_t, VectorDatabase& db) { removed += db.compact(); });
+        return removed;
+    }
+    
+    // Rebuild every shard's index under new settings (see
+    // VectorDatabase::rebuild_index), one shard at a time so only one shard is
+    // held twice; false if any shard's rebuild failed
+    bool rebuild_index(const VectorDatabaseConfig& config) {
+        bool ok = true;
+        for (size_t shard = 0; shard < shards_.size(); ++shard) {
+            if (!onShard(shard, [&](VectorDatabase& db) { return db.rebuild_index(config); })) {
+                std::cerr << "Error: Index rebuild failed on shard " << shard << std::endl;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+    
+    bool rebuild_index(IndexType index_type) {
+        bool ok = true;
+        for (size_t shard = 0; shard < shards_.size(); ++shard) {
+            if (!onShard(shard, [&](VectorDatabase& db) { return db.rebuild_index(index_type); })) {
+                std::cerr << "Error: Index rebuild failed on shard " << shard << std::endl;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+    
+    void clear() {
+        forEachShard([&](size_t, VectorDatabase& db) { db.clear(); });
+    }
+    
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& shard : shards_) {
+            total += shard->size();
+        }
+        return total;
+    }
+    
+    size_t dimension() const { return dimension_; }
+    size_t shard_count() const { return shards_.size(); }
+    
+    // Direct access to one shard, e.g. for per-shard stats
+    VectorDatabase& shard(size_t index) { return *shards_.at(index); }
+    const VectorDatabase& shard(size_t index) const { return *shards_.at(index); }
+    
+    // Shard a given ID is stored in
+    size_t shard_of(const std::string& id) const { return shardOf(id); }
+    size_t shard_of(uint64_t id) const { return shardOf(id); }
+    
+    std::vector<std::string> get_all_ids() const {
+        std::vector<std::string> ids;
+        for (const auto& shard : shards_) {
+            std::vector<std::string> shard_ids = shard->get_all_ids();
+            std::move(shard_ids.begin(), shard_ids.end(), std::back_inserter(ids));
+        }
+        return ids;
+    }
+    
+    // Sum of the shards' statistics, except that operation latencies and the
+    // query count are those of the collection: a search counts once, not
+    // once per shard, and takes as long as the whole scatter-gather
+    DatabaseStats stats() const {
+        DatabaseStats total;
+        for (const auto& shard : shards_) {
+            total += shard->stats();
+        }
+        DatabaseStats own;
+        metrics_.collect(own);
+        total.operations = own.operations;
+        total.queries = own.queries;
+        total.capacity = config_.max_vectors;
+        total.dimension = dimension_;
+        total.async = async_search_stats();
+        return total;
+    }
+    
+    void print_stats() const {
+        std::cout << "=== ShardedVectorDatabase Statistics ===" << std::endl;
+        std::cout << "Shards: " << shards_.size() << std::endl;
+        std::cout << "Total Vectors: " << size() << " (";
+        for (size_t shard = 0; shard < shards_.size(); ++shard) {
+            std::cout << (shard ? ", " : "") << shards_[shard]->size();
+        }
+        std::cout << ")" << std::endl;
+        std::cout << "Max Capacity: " << config_.max_vectors << std::endl;
+        if (!shard_nodes_.empty()) {
+            std::cout << "NUMA Nodes: " << node_pools_.size() << " (shard i on node i % "
+                      << node_pools_.size() << ")" << std::endl;
+        }
+        DatabaseStats stats = this->stats();
+        stats.printActivity(std::cout);
+        std::cout << "Memory Usage (approx): " << stats.memory_bytes / (1024 * 1024) << " MB" << std::endl;
+        std::cout << "========================================" << std::endl;
+    }
+};
+
+// The demos and main() below make this file a runnable program; code that
+// includes it for the library (the examples, benchmarks) defines
+// VECTORDB_NO_MAIN first
+#ifndef VECTORDB_NO_MAIN
+
 // Demo function to show basic usage
 void demo_basic_usage() {
     std::cout << "=== VectorDatabase Demo ===" << std::endl;
@@ -856,6 +10278,8 @@ int main() {
     return 0;
 }
 
+#endif  // VECTORDB_NO_MAIN
+
 // Run program: Ctrl + F5 or Debug > Start Without Debugging menu
 // Debug program: F5 or Debug > Start Debugging menu
 
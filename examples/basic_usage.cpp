@@ -7,6 +7,7 @@
 
 // Include the VectorDatabase header (assuming it's been separated)
 // For this example, we'll include the main implementation
+#define VECTORDB_NO_MAIN
 #include "../VectorDatabase.cpp"
 
 int main() {
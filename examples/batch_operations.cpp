@@ -10,6 +10,7 @@
 #include <iomanip>
 
 // Include the VectorDatabase implementation
+#define VECTORDB_NO_MAIN
 #include "../VectorDatabase.cpp"
 
 // Utility function to generate test data
@@ -178,8 +179,8 @@ int main() {
         
         std::cout << "   Final database size: " << large_db.size() << " vectors" << std::endl;
         
-        // 5. Batch update simulation (remove and re-insert)
-        std::cout << "\n5. Batch Update Simulation:" << std::endl;
+        // 5. Batch update (in-place upsert)
+        std::cout << "\n5. Batch Update:" << std::endl;
         
         // Get some existing vector IDs
         auto all_ids = large_db.get_all_ids();
@@ -187,40 +188,29 @@ int main() {
         std::mt19937 gen(rd());
         std::shuffle(all_ids.begin(), all_ids.end(), gen);
         
-        // Select 1000 vectors for "update"
+        // Select 1000 vectors for update
         size_t update_count = std::min(static_cast<size_t>(1000), all_ids.size());
         std::vector<std::string> update_ids(all_ids.begin(), all_ids.begin() + update_count);
         
-        std::cout << "   Simulating update of " << update_count << " vectors..." << std::endl;
+        std::cout << "   Updating " << update_count << " vectors..." << std::endl;
         
-        // Step 1: Remove old vectors
-        double remove_time = measureTime([&]() {
-            for (const auto& id : update_ids) {
-                large_db.remove(id);
-            }
-        });
-        
-        // Step 2: Generate new versions
+        // Generate new versions under the same IDs
         std::map<std::string, std::vector<float>> updated_vectors;
         for (const auto& id : update_ids) {
-            auto new_vector = VectorUtils::generateRandomVector(dimension);
-            updated_vectors[id + "_updated"] = new_vector;
+            updated_vectors[id] = VectorUtils::generateRandomVector(dimension);
         }
         
-        // Step 3: Insert updated vectors
-        double update_insert_time = measureTime([&]() {
-            if (!large_db.insert_batch(updated_vectors)) {
-                throw std::runtime_error("Update batch insert failed");
+        // Overwrite the stored vectors in place; no remove + insert churn
+        double update_time = measureTime([&]() {
+            if (!large_db.upsert_batch(updated_vectors)) {
+                throw std::runtime_error("Batch upsert failed");
             }
         });
         
-        double total_update_time = remove_time + update_insert_time;
-        
-        std::cout << "     Remove time: " << std::fixed << std::setprecision(2) << remove_time << " ms" << std::endl;
-        std::cout << "     Insert time: " << std::fixed << std::setprecision(2) << update_insert_time << " ms" << std::endl;
-        std::cout << "     Total time:  " << std::fixed << std::setprecision(2) << total_update_time << " ms" << std::endl;
+        std::cout << "     Upsert time: " << std::fixed << std::setprecision(2) << update_time << " ms" << std::endl;
         std::cout << "     Update rate: " << std::fixed << std::setprecision(0) 
-                  << (update_count / total_update_time * 1000) << " updates/sec" << std::endl;
+                  << (update_count / update_time * 1000) << " updates/sec" << std::endl;
+        std::cout << "     Database size: " << large_db.size() << " vectors (unchanged)" << std::endl;
         
         // 6. Memory usage analysis
         std::cout << "\n6. Memory Usage Analysis:" << std::endl;
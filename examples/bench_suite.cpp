@@ -0,0 +1,629 @@
+// bench_suite.cpp - Reproducible benchmark suite
+// Measures every index type on a standard dataset (SIFT1M, GloVe, ... in
+// fvecs, fbin or npy form) or on a seeded synthetic one: build time, memory,
+// recall@k against exact ground truth, and per-query latency percentiles and
+// QPS at several client thread counts. Results are printed as a table and can
+// be written as JSON for tracking regressions across commits and machines.
+//
+// Usage:
+//   bench_suite [--base FILE --queries FILE [--groundtruth FILE.ivecs]]
+//               [--synthetic ROWSxDIM] [--query-count N] [--seed N]
+//               [--index linear,kd,lsh,hnsw,ivf] [--threads 1,2,4,...]
+//               [--k N] [--metric euclidean|cosine|manhattan|dot]
+//               [--encoding float32|fp16|bf16|int8|pq]
+//               [--ef-search N] [--nprobe N] [--warmup N] [--json FILE]
+//
+// Without --base a clustered Gaussian dataset is generated from --seed, so
+// two runs with the same arguments measure the same data. Without
+// --groundtruth the exact neighbors are computed with a linear scan first.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <fstream>
+#include <sstream>
+
+// Include the VectorDatabase implementation
+#define VECTORDB_NO_MAIN
+#include "../VectorDatabase.cpp"
+
+#if defined(_WIN32)
+#include <psapi.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "psapi.lib")
+#endif
+#endif
+
+// Vectors of one file or generated set, stored row-major
+struct Dataset {
+    size_t dimension = 0;
+    size_t count = 0;
+    std::vector<float> values;
+
+    const float* row(size_t index) const { return values.data() + index * dimension; }
+    std::vector<float> vector(size_t index) const { return std::vector<float>(row(index), row(index) + dimension); }
+};
+
+struct SuiteOptions {
+    std::string base_path;
+    std::string query_path;
+    std::string groundtruth_path;
+    std::string json_path;
+    size_t synthetic_rows = 100000;
+    size_t synthetic_dimension = 128;
+    size_t query_count = 1000;
+    uint32_t seed = 42;
+    size_t k = 10;
+    size_t warmup = 100;
+    size_t ef_search = 0;
+    size_t nprobe = 0;
+    DistanceMetric metric = DistanceMetric::EUCLIDEAN;
+    VectorEncoding encoding = VectorEncoding::FLOAT32;
+    std::vector<IndexType> indexes = {IndexType::LINEAR, IndexType::KD_TREE, IndexType::HASH_TABLE,
+                                      IndexType::HNSW, IndexType::IVF};
+    std::vector<size_t> threads;
+};
+
+// Latency and throughput of one pass over the queries
+struct ThroughputRun {
+    size_t threads = 0;
+    double qps = 0.0;
+    double mean_us = 0.0;
+    double p50_us = 0.0;
+    double p95_us = 0.0;
+    double p99_us = 0.0;
+};
+
+struct IndexResult {
+    IndexType type;
+    std::string name;
+    double build_seconds = 0.0;
+    size_t memory_bytes = 0;  // DatabaseStats::memory_bytes
+    size_t rss_bytes = 0;     // resident set over the baseline after building
+    double recall = 0.0;
+    double distances_per_query = 0.0;
+    std::vector<ThroughputRun> runs;
+};
+
+const char* indexKey(IndexType type) {
+    switch (type) {
+        case IndexType::LINEAR: return "linear";
+        case IndexType::KD_TREE: return "kd";
+        case IndexType::HASH_TABLE: return "lsh";
+        case IndexType::HNSW: return "hnsw";
+        case IndexType::IVF: return "ivf";
+    }
+    return "unknown";
+}
+
+const char* encodingKey(VectorEncoding encoding) {
+    switch (encoding) {
+        case VectorEncoding::FLOAT32: return "float32";
+        case VectorEncoding::FP16: return "fp16";
+        case VectorEncoding::BF16: return "bf16";
+        case VectorEncoding::INT8: return "int8";
+        case VectorEncoding::PQ: return "pq";
+    }
+    return "unknown";
+}
+
+const char* metricKey(DistanceMetric metric) {
+    switch (metric) {
+        case DistanceMetric::EUCLIDEAN: return "euclidean";
+        case DistanceMetric::COSINE: return "cosine";
+        case DistanceMetric::MANHATTAN: return "manhattan";
+        case DistanceMetric::DOT_PRODUCT: return "dot";
+    }
+    return "unknown";
+}
+
+// Resident set size of this process in bytes (peak instead when peak is set);
+// 0 where the platform offers no cheap way to read it
+size_t residentBytes(bool peak = false) {
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    const std::string key = peak ? "VmHWM:" : "VmRSS:";
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, key.size(), key) == 0) {
+            return static_cast<size_t>(std::strtoull(line.c_str() + key.size(), nullptr, 10)) * 1024;
+        }
+    }
+    return 0;
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return peak ? counters.PeakWorkingSetSize : counters.WorkingSetSize;
+#else
+    (void)peak;
+    return 0;
+#endif
+}
+
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+bool parseOptions(int argc, char** argv, SuiteOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Error: Missing value for " << arg << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+
+        if (arg == "--base") {
+            options.base_path = value;
+        } else if (arg == "--queries") {
+            options.query_path = value;
+        } else if (arg == "--groundtruth") {
+            options.groundtruth_path = value;
+        } else if (arg == "--json") {
+            options.json_path = value;
+        } else if (arg == "--synthetic") {
+            unsigned long long rows = 0, dimension = 0;
+            if (std::sscanf(value.c_str(), "%llux%llu", &rows, &dimension) != 2 || rows == 0 || dimension == 0) {
+                std::cerr << "Error: --synthetic expects ROWSxDIM, e.g. 100000x128" << std::endl;
+                return false;
+            }
+            options.synthetic_rows = static_cast<size_t>(rows);
+            options.synthetic_dimension = static_cast<size_t>(dimension);
+        } else if (arg == "--query-count") {
+            options.query_count = std::stoul(value);
+        } else if (arg == "--seed") {
+            options.seed = static_cast<uint32_t>(std::stoul(value));
+        } else if (arg == "--k") {
+            options.k = std::max<size_t>(1, std::stoul(value));
+        } else if (arg == "--warmup") {
+            options.warmup = std::stoul(value);
+        } else if (arg == "--ef-search") {
+            options.ef_search = std::stoul(value);
+        } else if (arg == "--nprobe") {
+            options.nprobe = std::stoul(value);
+        } else if (arg == "--metric") {
+            if (value == "euclidean") {
+                options.metric = DistanceMetric::EUCLIDEAN;
+            } else if (value == "cosine") {
+                options.metric = DistanceMetric::COSINE;
+            } else if (value == "manhattan") {
+                options.metric = DistanceMetric::MANHATTAN;
+            } else if (value == "dot") {
+                options.metric = DistanceMetric::DOT_PRODUCT;
+            } else {
+                std::cerr << "Error: Unknown metric " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--encoding") {
+            const VectorEncoding encodings[] = {VectorEncoding::FLOAT32, VectorEncoding::FP16, VectorEncoding::BF16,
+                                                VectorEncoding::INT8, VectorEncoding::PQ};
+            auto it = std::find_if(std::begin(encodings), std::end(encodings),
+                                   [&](VectorEncoding encoding) { return value == encodingKey(encoding); });
+            if (it == std::end(encodings)) {
+                std::cerr << "Error: Unknown encoding " << value << std::endl;
+                return false;
+            }
+            options.encoding = *it;
+        } else if (arg == "--index") {
+            options.indexes.clear();
+            for (const auto& name : splitList(value)) {
+                const IndexType types[] = {IndexType::LINEAR, IndexType::KD_TREE, IndexType::HASH_TABLE,
+                                           IndexType::HNSW, IndexType::IVF};
+                auto it = std::find_if(std::begin(types), std::end(types),
+                                       [&](IndexType type) { return name == indexKey(type); });
+                if (it == std::end(types)) {
+                    std::cerr << "Error: Unknown index " << name << std::endl;
+                    return false;
+                }
+                options.indexes.push_back(*it);
+            }
+        } else if (arg == "--threads") {
+            options.threads.clear();
+            for (const auto& count : splitList(value)) {
+                options.threads.push_back(std::max<size_t>(1, std::stoul(count)));
+            }
+        } else {
+            std::cerr << "Error: Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (options.base_path.empty() != options.query_path.empty()) {
+        std::cerr << "Error: --base and --queries must be given together" << std::endl;
+        return false;
+    }
+    if (options.threads.empty()) {
+        // 1, 2, 4, ... up to the hardware threads
+        const size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t count = 1; count < hardware; count *= 2) {
+            options.threads.push_back(count);
+        }
+        options.threads.push_back(hardware);
+    }
+    return true;
+}
+
+// Load an fvecs, fbin or npy file through the importer's reader
+bool loadVectors(const std::string& path, size_t limit, Dataset& dataset) {
+    VectorFileReader reader;
+    if (!reader.open(path, ImportFormat::AUTO)) {
+        return false;
+    }
+    dataset.dimension = reader.dimension();
+    dataset.count = limit != 0 ? std::min(limit, reader.size()) : reader.size();
+    dataset.values.resize(dataset.count * dataset.dimension);
+
+    const size_t chunk_rows = 4096;
+    std::vector<char> buffer;
+    for (size_t begin = 0; begin < dataset.count; begin += chunk_rows) {
+        const size_t rows = std::min(chunk_rows, dataset.count - begin);
+        if (!reader.read(buffer, rows)) {
+            std::cerr << "Error: Truncated file " << path << std::endl;
+            return false;
+        }
+        for (size_t r = 0; r < rows; ++r) {
+            if (!reader.parse(buffer.data() + r * reader.recordBytes(), dataset.values.data() + (begin + r) * dataset.dimension)) {
+                std::cerr << "Error: Malformed record " << begin + r << " in " << path << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Ground truth neighbor lists from an .ivecs file (per row an i32 count and
+// that many i32 indexes into the base set)
+bool loadGroundTruth(const std::string& path, size_t queries, size_t k, std::vector<std::vector<uint64_t>>& truth) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Cannot open ground truth " << path << std::endl;
+        return false;
+    }
+    truth.assign(queries, {});
+    std::vector<int32_t> row;
+    for (size_t q = 0; q < queries; ++q) {
+        int32_t count = 0;
+        if (!file.read(reinterpret_cast<char*>(&count), sizeof(count)) || count <= 0) {
+            std::cerr << "Error: Ground truth " << path << " has fewer rows than queries" << std::endl;
+            return false;
+        }
+        row.resize(static_cast<size_t>(count));
+        file.read(reinterpret_cast<char*>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(int32_t)));
+        if (static_cast<size_t>(count) < k) {
+            std::cerr << "Error: Ground truth " << path << " holds " << count << " neighbors, k is " << k << std::endl;
+            return false;
+        }
+        truth[q].assign(row.begin(), row.begin() + k);
+    }
+    return static_cast<bool>(file);
+}
+
+// Clustered Gaussian vectors: real embeddings are far from uniform, and
+// uniform data makes every approximate index look worse than it is
+void generateSynthetic(size_t rows, size_t queries, size_t dimension, uint32_t seed, Dataset& base, Dataset& query) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> spread(0.0f, 1.0f);
+    const size_t clusters = std::max<size_t>(1, static_cast<size_t>(std::sqrt(static_cast<double>(rows)) / 4));
+    std::vector<float> centers(clusters * dimension);
+    for (auto& value : centers) {
+        value = spread(rng) * 4.0f;
+    }
+    std::uniform_int_distribution<size_t> pick(0, clusters - 1);
+
+    auto fill = [&](Dataset& dataset, size_t count) {
+        dataset.dimension = dimension;
+        dataset.count = count;
+        dataset.values.resize(count * dimension);
+        for (size_t r = 0; r < count; ++r) {
+            const float* center = centers.data() + pick(rng) * dimension;
+            for (size_t d = 0; d < dimension; ++d) {
+                dataset.values[r * dimension + d] = center[d] + spread(rng);
+            }
+        }
+    };
+    fill(base, rows);
+    fill(query, queries);
+}
+
+VectorDatabaseConfig makeConfig(const SuiteOptions& options, IndexType type, size_t rows) {
+    VectorDatabaseConfig config;
+    config.distance_metric = options.metric;
+    config.index_type = type;
+    config.max_vectors = rows;
+    config.integer_ids = true;
+    config.encoding = options.encoding;
+    // Queries are parallelized by the client threads, not inside one search
+    config.thread_count = 1;
+    config.hnsw_ef_search = options.ef_search != 0 ? options.ef_search : config.hnsw_ef_search;
+    config.ivf_nprobe = options.nprobe != 0 ? options.nprobe : config.ivf_nprobe;
+    return config;
+}
+
+// Insert the base set as one batch under IDs 0..count-1, the row numbers
+// that ground truth files refer to
+bool buildDatabase(VectorDatabase& db, const Dataset& base) {
+    std::vector<uint64_t> ids(base.count);
+    std::iota(ids.begin(), ids.end(), uint64_t(0));
+    return db.insert_batch(ids.data(), base.values.data(), base.count);
+}
+
+// Run every query once, spread round-robin over threads; fills the neighbor
+// lists when answers is non-null
+ThroughputRun runQueries(const VectorDatabase& db, const std::vector<std::vector<float>>& queries, size_t k,
+                         size_t threads, std::vector<std::vector<uint64_t>>* answers) {
+    std::vector<double> latencies(queries.size());
+    auto worker = [&](size_t first) {
+        for (size_t q = first; q < queries.size(); q += threads) {
+            auto start = std::chrono::steady_clock::now();
+            auto hits = db.search_ids(queries[q], k);
+            auto end = std::chrono::steady_clock::now();
+            latencies[q] = std::chrono::duration<double, std::micro>(end - start).count();
+            if (answers) {
+                auto& ids = (*answers)[q];
+                ids.clear();
+                for (const auto& hit : hits) {
+                    ids.push_back(hit.id);
+                }
+            }
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; ++t) {
+        pool.emplace_back(worker, t);
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    ThroughputRun run;
+    run.threads = threads;
+    run.qps = seconds > 0.0 ? queries.size() / seconds : 0.0;
+    if (latencies.empty()) {
+        return run;
+    }
+    run.mean_us = std::accumulate(latencies.begin(), latencies.end(), 0.0) / latencies.size();
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double fraction) {
+        size_t rank = static_cast<size_t>(std::ceil(fraction * latencies.size()));
+        return latencies[std::min(latencies.size(), std::max<size_t>(1, rank)) - 1];
+    };
+    run.p50_us = percentile(0.50);
+    run.p95_us = percentile(0.95);
+    run.p99_us = percentile(0.99);
+    return run;
+}
+
+// Mean fraction of the true k nearest neighbors found
+double recallAtK(const std::vector<std::vector<uint64_t>>& answers, const std::vector<std::vector<uint64_t>>& truth,
+                 size_t k) {
+    if (answers.empty()) {
+        return 0.0;
+    }
+    double total = 0.0;
+    for (size_t q = 0; q < answers.size(); ++q) {
+        size_t found = 0;
+        for (uint64_t id : answers[q]) {
+            found += std::find(truth[q].begin(), truth[q].end(), id) != truth[q].end();
+        }
+        total += static_cast<double>(found) / k;
+    }
+    return total / answers.size();
+}
+
+IndexResult benchmarkIndex(const SuiteOptions& options, IndexType type, size_t rss_baseline, const Dataset& base,
+                           const std::vector<std::vector<float>>& queries,
+                           const std::vector<std::vector<uint64_t>>& truth) {
+    IndexResult result;
+    result.type = type;
+    result.name = indexKey(type);
+
+    VectorDatabase db(base.dimension, makeConfig(options, type, base.count));
+    auto start = std::chrono::steady_clock::now();
+    if (!buildDatabase(db, base)) {
+        std::cerr << "Error: Building the " << result.name << " index failed" << std::endl;
+        return result;
+    }
+    result.build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const size_t rss_after = residentBytes();
+    result.rss_bytes = rss_after > rss_baseline ? rss_after - rss_baseline : 0;
+    result.memory_bytes = db.stats().memory_bytes;
+
+    // Warm caches and lazily built structures before anything is timed
+    std::vector<std::vector<float>> warmup(queries.begin(), queries.begin() + std::min(options.warmup, queries.size()));
+    runQueries(db, warmup, options.k, 1, nullptr);
+
+    // One single-threaded pass gives the answers for recall and the work per
+    // query; the stats are read as a difference so warmup does not count
+    const DatabaseStats before = db.stats();
+    std::vector<std::vector<uint64_t>> answers(queries.size());
+    runQueries(db, queries, options.k, 1, &answers);
+    result.recall = recallAtK(answers, truth, options.k);
+    const DatabaseStats after = db.stats();
+    if (after.queries > before.queries) {
+        result.distances_per_query = static_cast<double>(after.distance_evaluations - before.distance_evaluations) /
+                                     (after.queries - before.queries);
+    }
+
+    for (size_t threads : options.threads) {
+        result.runs.push_back(runQueries(db, queries, options.k, threads, nullptr));
+    }
+    return result;
+}
+
+void printResults(const std::vector<IndexResult>& results) {
+    std::cout << "\n" << std::string(104, '=') << std::endl;
+    std::cout << std::left << std::setw(8) << "Index" << std::right
+              << std::setw(10) << "Build (s)"
+              << std::setw(12) << "Memory (MB)"
+              << std::setw(10) << "RSS (MB)"
+              << std::setw(9) << "Recall"
+              << std::setw(12) << "Dist/Query"
+              << std::setw(9) << "Threads"
+              << std::setw(11) << "QPS"
+              << std::setw(11) << "p50 (us)"
+              << std::setw(11) << "p95 (us)"
+              << std::setw(11) << "p99 (us)" << std::endl;
+    std::cout << std::string(104, '-') << std::endl;
+
+    for (const auto& result : results) {
+        for (size_t r = 0; r < result.runs.size(); ++r) {
+            const auto& run = result.runs[r];
+            std::cout << std::left << std::setw(8) << (r == 0 ? result.name : "") << std::right << std::fixed;
+            if (r == 0) {
+                std::cout << std::setprecision(2) << std::setw(10) << result.build_seconds
+                          << std::setprecision(1) << std::setw(12) << result.memory_bytes / 1048576.0
+                          << std::setw(10) << result.rss_bytes / 1048576.0
+                          << std::setprecision(4) << std::setw(9) << result.recall
+                          << std::setprecision(0) << std::setw(12) << result.distances_per_query;
+            } else {
+                std::cout << std::setw(10 + 12 + 10 + 9 + 12) << "";
+            }
+            std::cout << std::setw(9) << run.threads
+                      << std::setprecision(0) << std::setw(11) << run.qps
+                      << std::setprecision(1) << std::setw(11) << run.p50_us
+                      << std::setw(11) << run.p95_us
+                      << std::setw(11) << run.p99_us << std::endl;
+        }
+    }
+    std::cout << std::string(104, '=') << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+}
+
+std::string jsonString(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+bool writeJson(const std::string& path, const SuiteOptions& options, const Dataset& base, size_t queries,
+               bool computed_truth, const std::vector<IndexResult>& results) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        std::cerr << "Error: Cannot write " << path << std::endl;
+        return false;
+    }
+    out << std::setprecision(6);
+    out << "{\n";
+    out << "  \"environment\": {\"simd\": " << jsonString(DistanceKernels::active().name)
+        << ", \"hardware_threads\": " << std::thread::hardware_concurrency()
+        << ", \"peak_rss_bytes\": " << residentBytes(true) << "},\n";
+    out << "  \"dataset\": {\"base\": " << jsonString(options.base_path.empty() ? "synthetic" : options.base_path)
+        << ", \"queries\": " << jsonString(options.query_path.empty() ? "synthetic" : options.query_path)
+        << ", \"seed\": " << options.seed
+        << ", \"rows\": " << base.count << ", \"dimension\": " << base.dimension
+        << ", \"query_count\": " << queries << ", \"metric\": " << jsonString(metricKey(options.metric))
+        << ", \"encoding\": " << jsonString(encodingKey(options.encoding))
+        << ", \"ground_truth\": " << jsonString(computed_truth ? "computed" : options.groundtruth_path) << "},\n";
+    out << "  \"k\": " << options.k << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& result = results[i];
+        out << "    {\"index\": " << jsonString(result.name)
+            << ", \"build_seconds\": " << result.build_seconds
+            << ", \"memory_bytes\": " << result.memory_bytes
+            << ", \"rss_bytes\": " << result.rss_bytes
+            << ", \"recall\": " << result.recall
+            << ", \"distances_per_query\": " << result.distances_per_query
+            << ", \"runs\": [";
+        for (size_t r = 0; r < result.runs.size(); ++r) {
+            const auto& run = result.runs[r];
+            out << (r == 0 ? "" : ", ") << "{\"threads\": " << run.threads << ", \"qps\": " << run.qps
+                << ", \"mean_us\": " << run.mean_us << ", \"p50_us\": " << run.p50_us
+                << ", \"p95_us\": " << run.p95_us << ", \"p99_us\": " << run.p99_us << "}";
+        }
+        out << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+int main(int argc, char** argv) {
+    SuiteOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    std::cout << "=== VectorDatabase Benchmark Suite ===" << std::endl;
+    std::cout << "SIMD kernels: " << DistanceKernels::active().name
+              << ", hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+
+    // 1. Dataset
+    Dataset base, query;
+    if (options.base_path.empty()) {
+        generateSynthetic(options.synthetic_rows, options.query_count, options.synthetic_dimension, options.seed, base, query);
+    } else if (!loadVectors(options.base_path, 0, base) || !loadVectors(options.query_path, options.query_count, query)) {
+        return 1;
+    }
+    if (base.dimension != query.dimension || base.count == 0 || query.count == 0) {
+        std::cerr << "Error: Base and query sets must be non-empty and of one dimension" << std::endl;
+        return 1;
+    }
+    options.k = std::min(options.k, base.count);
+    std::vector<std::vector<float>> queries;
+    for (size_t q = 0; q < query.count; ++q) {
+        queries.push_back(query.vector(q));
+    }
+    std::cout << "Dataset: " << base.count << " x " << base.dimension << ", " << queries.size()
+              << " queries, k = " << options.k << ", metric " << metricKey(options.metric)
+              << ", encoding " << encodingKey(options.encoding) << std::endl;
+
+    // 2. Ground truth. The resident set is sampled first so each index is
+    // measured against the datasets alone; the allocator may keep pages of
+    // earlier databases resident, so the figure is an upper bound
+    const size_t rss_baseline = residentBytes();
+    std::vector<std::vector<uint64_t>> truth(queries.size());
+    const bool computed_truth = options.groundtruth_path.empty();
+    if (computed_truth) {
+        std::cout << "Computing exact ground truth..." << std::endl;
+        VectorDatabaseConfig exact_config = makeConfig(options, IndexType::LINEAR, base.count);
+        exact_config.encoding = VectorEncoding::FLOAT32;
+        VectorDatabase exact(base.dimension, exact_config);
+        if (!buildDatabase(exact, base)) {
+            return 1;
+        }
+        runQueries(exact, queries, options.k, std::max(1u, std::thread::hardware_concurrency()), &truth);
+    } else if (!loadGroundTruth(options.groundtruth_path, queries.size(), options.k, truth)) {
+        return 1;
+    }
+
+    // 3. Indexes, each built and measured on its own
+    std::vector<IndexResult> results;
+    for (IndexType type : options.indexes) {
+        std::cout << "Benchmarking " << indexKey(type) << "..." << std::endl;
+        results.push_back(benchmarkIndex(options, type, rss_baseline, base, queries, truth));
+    }
+
+    printResults(results);
+
+    if (!options.json_path.empty()) {
+        if (!writeJson(options.json_path, options, base, queries.size(), computed_truth, results)) {
+            return 1;
+        }
+        std::cout << "Results written to " << options.json_path << std::endl;
+    }
+    return 0;
+}
@@ -12,6 +12,7 @@
 #include <thread>
 
 // Include the VectorDatabase implementation
+#define VECTORDB_NO_MAIN
 #include "../VectorDatabase.cpp"
 
 // Structure to hold benchmark results
@@ -38,9 +39,29 @@ double measureTime(Func&& func) {
     return static_cast<double>(duration.count()) / 1000.0; // Return milliseconds
 }
 
-// Function to estimate memory usage
-size_t estimateMemoryUsage(const VectorDatabase& db) {
-    return (db.size() * db.dimension() * sizeof(float)) / (1024 * 1024); // MB
+// Memory held by the database (vectors, IDs, index), as it reports it
+size_t memoryUsageMB(const VectorDatabase& db) {
+    return db.stats().memory_bytes / (1024 * 1024);
+}
+
+// Random vectors generated up front, so timed loops only measure the database
+std::vector<std::vector<float>> generateVectors(size_t count, size_t dimension) {
+    std::vector<std::vector<float>> vectors;
+    vectors.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        vectors.push_back(VectorUtils::generateRandomVector(dimension));
+    }
+    return vectors;
+}
+
+// Mean milliseconds per search over a set of queries
+double measureSearchTime(const VectorDatabase& db, const std::vector<std::vector<float>>& queries, size_t k) {
+    double total = measureTime([&]() {
+        for (const auto& query : queries) {
+            auto search_results = db.search(query, k);
+        }
+    });
+    return total / queries.size();
 }
 
 // Function to print benchmark results table
@@ -94,7 +115,7 @@ std::vector<BenchmarkResult> benchmarkInserts() {
             });
             
             double ops_per_second = count / (insert_time / 1000.0);
-            size_t memory_usage = estimateMemoryUsage(db);
+            size_t memory_usage = memoryUsageMB(db);
             
             results.emplace_back("Individual Insert", dim, count, insert_time, ops_per_second, memory_usage);
             
@@ -110,7 +131,7 @@ std::vector<BenchmarkResult> benchmarkInserts() {
             });
             
             double batch_ops_per_second = count / (batch_time / 1000.0);
-            size_t batch_memory_usage = estimateMemoryUsage(batch_db);
+            size_t batch_memory_usage = memoryUsageMB(batch_db);
             
             results.emplace_back("Batch Insert", dim, count, batch_time, batch_ops_per_second, batch_memory_usage);
         }
@@ -160,7 +181,7 @@ std::vector<BenchmarkResult> benchmarkSearches() {
                 });
                 
                 double searches_per_second = num_queries / (search_time / 1000.0);
-                size_t memory_usage = estimateMemoryUsage(db);
+                size_t memory_usage = memoryUsageMB(db);
                 
                 std::string operation = "Search k=" + std::to_string(k);
                 results.emplace_back(operation, dim, db_size, search_time, searches_per_second, memory_usage);
@@ -219,7 +240,7 @@ std::vector<BenchmarkResult> benchmarkDistanceMetrics() {
         });
         
         double searches_per_second = num_queries / (search_time / 1000.0);
-        size_t memory_usage = estimateMemoryUsage(db);
+        size_t memory_usage = memoryUsageMB(db);
         
         results.emplace_back(metric_names[m], dimension, database_size, search_time, searches_per_second, memory_usage);
     }
@@ -241,23 +262,20 @@ std::vector<BenchmarkResult> benchmarkMemoryScalability() {
         VectorDatabase db(dimension);
         
         // Measure insertion time and memory growth
+        auto vectors = generateVectors(db_size, dimension);
         double insert_time = measureTime([&]() {
             for (size_t i = 0; i < db_size; ++i) {
-                auto vector = VectorUtils::generateRandomVector(dimension);
-                db.insert("vec_" + std::to_string(i), vector);
+                db.insert("vec_" + std::to_string(i), vectors[i]);
             }
         });
         
-        size_t memory_usage = estimateMemoryUsage(db);
+        size_t memory_usage = memoryUsageMB(db);
         double ops_per_second = db_size / (insert_time / 1000.0);
         
         results.emplace_back("Memory Scale", dimension, db_size, insert_time, ops_per_second, memory_usage);
         
         // Test search performance at this scale
-        auto query = VectorUtils::generateRandomVector(dimension);
-        double search_time = measureTime([&]() {
-            auto search_results = db.search(query, 10);
-        });
+        double search_time = measureSearchTime(db, generateVectors(20, dimension), 10);
         
         double searches_per_second = 1000.0 / search_time;
         
@@ -281,23 +299,20 @@ std::vector<BenchmarkResult> benchmarkHighDimensional() {
         VectorDatabase db(dim);
         
         // Benchmark insertion
+        auto vectors = generateVectors(database_size, dim);
         double insert_time = measureTime([&]() {
             for (size_t i = 0; i < database_size; ++i) {
-                auto vector = VectorUtils::generateRandomVector(dim);
-                db.insert("vec_" + std::to_string(i), vector);
+                db.insert("vec_" + std::to_string(i), vectors[i]);
             }
         });
         
         double insert_ops_per_second = database_size / (insert_time / 1000.0);
-        size_t memory_usage = estimateMemoryUsage(db);
+        size_t memory_usage = memoryUsageMB(db);
         
         results.emplace_back("High-D Insert", dim, database_size, insert_time, insert_ops_per_second, memory_usage);
         
         // Benchmark search
-        auto query = VectorUtils::generateRandomVector(dim);
-        double search_time = measureTime([&]() {
-            auto search_results = db.search(query, 10);
-        });
+        double search_time = measureSearchTime(db, generateVectors(20, dim), 10);
         
         double search_ops_per_second = 1000.0 / search_time;
         
@@ -334,7 +349,7 @@ std::vector<BenchmarkResult> benchmarkPersistence() {
         });
         
         double save_ops_per_second = db_size / (save_time / 1000.0);
-        size_t memory_usage = estimateMemoryUsage(db);
+        size_t memory_usage = memoryUsageMB(db);
         
         results.emplace_back("Save", dimension, db_size, save_time, save_ops_per_second, memory_usage);
         
@@ -355,6 +370,115 @@ std::vector<BenchmarkResult> benchmarkPersistence() {
     return results;
 }
 
+// Fraction of the exact top-k that an approximate result recovered
+double recallAtK(const std::vector<SearchHit>& exact, const std::vector<SearchHit>& approximate) {
+    if (exact.empty()) return 1.0;
+    
+    size_t found = 0;
+    for (const auto& hit : exact) {
+        for (const auto& candidate : approximate) {
+            if (candidate.id == hit.id) {
+                ++found;
+                break;
+            }
+        }
+    }
+    return static_cast<double>(found) / exact.size();
+}
+
+// Benchmark approximate indexes: recall@k against the LINEAR baseline and QPS
+void benchmarkIndexRecall() {
+    std::cout << "\n=== Index Recall Benchmarks ===" << std::endl;
+    
+    const size_t dimension = 128;
+    const size_t database_size = 20000;
+    const size_t num_clusters = 100;
+    const size_t num_queries = 200;
+    const size_t k = 10;
+    
+    // Clustered data, so nearest neighbours are meaningful
+    std::vector<std::vector<float>> centers;
+    for (size_t c = 0; c < num_clusters; ++c) {
+        centers.push_back(VectorUtils::generateRandomVector(dimension));
+    }
+    std::map<std::string, std::vector<float>> data;
+    for (size_t i = 0; i < database_size; ++i) {
+        data["vec_" + std::to_string(i)] = VectorUtils::generateGaussianVector(centers[i % num_clusters], 0.2f);
+    }
+    std::vector<std::vector<float>> queries;
+    for (size_t q = 0; q < num_queries; ++q) {
+        queries.push_back(VectorUtils::generateGaussianVector(centers[q % num_clusters], 0.2f));
+    }
+    
+    // Exact baseline
+    VectorDatabase linear_db(dimension);
+    linear_db.insert_batch(data);
+    std::vector<std::vector<SearchHit>> exact(num_queries);
+    double linear_time = measureTime([&]() {
+        for (size_t q = 0; q < num_queries; ++q) {
+            exact[q] = linear_db.search_hits(queries[q], k);
+        }
+    });
+    
+    std::cout << "\n" << std::string(70, '=') << std::endl;
+    std::cout << std::setw(20) << "Index"
+              << std::setw(12) << "Parameter"
+              << std::setw(14) << "Build (ms)"
+              << std::setw(12) << "Recall@" + std::to_string(k)
+              << std::setw(12) << "QPS" << std::endl;
+    std::cout << std::string(70, '-') << std::endl;
+    std::cout << std::setw(20) << "Linear" << std::setw(12) << "-" << std::setw(14) << "-"
+              << std::setw(12) << std::fixed << std::setprecision(3) << 1.0
+              << std::setw(12) << std::fixed << std::setprecision(0) << num_queries / (linear_time / 1000.0) << std::endl;
+    
+    auto report = [&](const std::string& name, const std::string& ef, double build_time,
+                      const VectorDatabase& db, const SearchParams& params) {
+        std::vector<std::vector<SearchHit>> approximate(num_queries);
+        double search_time = measureTime([&]() {
+            for (size_t q = 0; q < num_queries; ++q) {
+                approximate[q] = db.search_hits(queries[q], k, params);
+            }
+        });
+        
+        double recall = 0.0;
+        for (size_t q = 0; q < num_queries; ++q) {
+            recall += recallAtK(exact[q], approximate[q]);
+        }
+        
+        std::cout << std::setw(20) << name << std::setw(12) << ef
+                  << std::setw(14) << std::fixed << std::setprecision(1) << build_time
+                  << std::setw(12) << std::fixed << std::setprecision(3) << recall / num_queries
+                  << std::setw(12) << std::fixed << std::setprecision(0) << num_queries / (search_time / 1000.0) << std::endl;
+    };
+    
+    VectorDatabaseConfig lsh_config;
+    lsh_config.index_type = IndexType::HASH_TABLE;
+    VectorDatabase lsh_db(dimension, lsh_config);
+    double lsh_build = measureTime([&]() { lsh_db.insert_batch(data); });
+    report("Hash Table (LSH)", "-", lsh_build, lsh_db, SearchParams());
+    
+    VectorDatabaseConfig hnsw_config;
+    hnsw_config.index_type = IndexType::HNSW;
+    VectorDatabase hnsw_db(dimension, hnsw_config);
+    double hnsw_build = measureTime([&]() { hnsw_db.insert_batch(data); });
+    for (size_t ef : {16, 32, 64, 128, 256}) {
+        SearchParams params;
+        params.ef_search = ef;
+        report("HNSW", std::to_string(ef), hnsw_build, hnsw_db, params);
+    }
+    
+    VectorDatabaseConfig ivf_config;
+    ivf_config.index_type = IndexType::IVF;
+    VectorDatabase ivf_db(dimension, ivf_config);
+    double ivf_build = measureTime([&]() { ivf_db.insert_batch(data); });
+    for (size_t nprobe : {1, 4, 8, 16, 32}) {
+        SearchParams params;
+        params.nprobe = nprobe;
+        report("IVF", "nprobe " + std::to_string(nprobe), ivf_build, ivf_db, params);
+    }
+    std::cout << std::string(70, '=') << std::endl;
+}
+
 // Function to run comprehensive performance analysis
 void runPerformanceAnalysis() {
     std::cout << "\n=== Performance Analysis Summary ===" << std::endl;
@@ -375,10 +499,10 @@ void runPerformanceAnalysis() {
     std::cout << "\nPhase 1: Database Creation" << std::endl;
     auto start_total = std::chrono::high_resolution_clock::now();
     
+    auto vectors = generateVectors(database_size, dimension);
     double creation_time = measureTime([&]() {
         for (size_t i = 0; i < database_size; ++i) {
-            auto vector = VectorUtils::generateRandomVector(dimension);
-            db.insert("vector_" + std::to_string(i), vector);
+            db.insert("vector_" + std::to_string(i), vectors[i]);
         }
     });
     
@@ -410,13 +534,13 @@ void runPerformanceAnalysis() {
     
     // 3. Memory usage
     std::cout << "\nPhase 3: Memory Analysis" << std::endl;
-    size_t memory_usage = estimateMemoryUsage(db);
+    size_t memory_bytes = db.stats().memory_bytes;
     
-    std::cout << "✓ Estimated memory usage: " << memory_usage << " MB" << std::endl;
+    std::cout << "✓ Memory usage: " << memory_bytes / (1024 * 1024) << " MB" << std::endl;
     std::cout << "✓ Memory per vector: " << std::fixed << std::setprecision(2) 
-              << (static_cast<double>(memory_usage * 1024 * 1024) / database_size) << " bytes" << std::endl;
+              << (static_cast<double>(memory_bytes) / database_size) << " bytes" << std::endl;
     std::cout << "✓ Memory efficiency: " << std::fixed << std::setprecision(1) 
-              << (static_cast<double>(dimension * sizeof(float)) / (static_cast<double>(memory_usage * 1024 * 1024) / database_size) * 100) 
+              << (static_cast<double>(dimension * sizeof(float)) / (static_cast<double>(memory_bytes) / database_size) * 100) 
               << "%" << std::endl;
     
     // 4. Persistence performance
@@ -471,6 +595,9 @@ int main() {
         std::cout << "\n=== COMPREHENSIVE BENCHMARK RESULTS ===" << std::endl;
         printBenchmarkTable(all_results);
         
+        // Approximate index quality
+        benchmarkIndexRecall();
+        
         // Run performance analysis
         runPerformanceAnalysis();
         
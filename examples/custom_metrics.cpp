@@ -9,6 +9,7 @@
 #include <iomanip>
 
 // Include the VectorDatabase implementation
+#define VECTORDB_NO_MAIN
 #include "../VectorDatabase.cpp"
 
 // Helper function to create test vectors with known relationships
@@ -10,6 +10,7 @@
 #include <fstream>
 
 // Include the VectorDatabase implementation
+#define VECTORDB_NO_MAIN
 #include "../VectorDatabase.cpp"
 
 // Utility function to check if file exists